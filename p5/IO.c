@@ -3,12 +3,27 @@
     @author Jayani Sivakumar
     This file provides implementations for reading the contents of a file into a 
     dynamically allocated byte array and for writing a given byte array to a file.
-    All file operations are performed in binary mode.
+    All file operations are performed in binary mode.  Large files can
+    also be mapped into memory, so they're read and written in place.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "IO.h"
+#include "stats.h"
+
+/** Permissions for a newly created output file, before the umask. */
+#define OUTPUT_MODE 0666
+
+/** File the operating system provides random bytes through. */
+#define RANDOM_SOURCE "/dev/urandom"
 
 byte *readFile( const char *filename, int *n ) 
 {  
@@ -31,7 +46,7 @@ byte *readFile( const char *filename, int *n )
     }
     
     // reading the file contents temporarily
-    size_t read = fread( temp, 1, *n, file );
+    size_t read = readBytes( file, temp, *n );
     if ( read != ( size_t )*n ) {
         free( temp );
         fclose( file );
@@ -51,7 +66,7 @@ bool writeFile( const char *filename, byte *data, int n )
     }
     
     // writing to the file
-    if ( fwrite( data, 1, n, file ) != ( size_t )n) {
+    if ( !writeBytes( file, data, n ) ) {
         fclose( file );
         return false;
     }
@@ -61,8 +76,145 @@ bool writeFile( const char *filename, byte *data, int n )
     
 }
 
+FILE *openInput( const char *filename )
+{
+    if ( strcmp( filename, STDIO_NAME ) == 0 ) {
+        return stdin;
+    }
+    return fopen( filename, "rb" );
+}
+
+FILE *openOutput( const char *filename )
+{
+    if ( strcmp( filename, STDIO_NAME ) == 0 ) {
+        return stdout;
+    }
+    return fopen( filename, "wb" );
+}
+
+size_t readBytes( FILE *file, byte data[], size_t len )
+{
+    STATS_BEGIN( STAGE_READ );
+    size_t got = fread( data, 1, len, file );
+    STATS_END( STAGE_READ, got );
+    return got;
+}
+
+bool writeBytes( FILE *file, byte const data[], size_t len )
+{
+    STATS_BEGIN( STAGE_WRITE );
+    size_t put = fwrite( data, 1, len, file );
+    STATS_END( STAGE_WRITE, put );
+    return put == len;
+}
+
+bool readAt( FILE *file, uint64_t pos, byte data[], size_t len )
+{
+    return fseek( file, pos, SEEK_SET ) == 0 && readBytes( file, data, len ) == len;
+}
+
+bool randomBytes( byte data[], size_t len )
+{
+    FILE *file = fopen( RANDOM_SOURCE, "rb" );
+    if ( !file ) {
+        return false;
+    }
+    size_t got = fread( data, 1, len, file );
+    fclose( file );
+    return got == len;
+}
+
+bool sameFile( FILE *file, const char *filename )
+{
+    struct stat openInfo, namedInfo;
+    if ( fstat( fileno( file ), &openInfo ) != 0 || stat( filename, &namedInfo ) != 0 ) {
+        return false;
+    }
+    return openInfo.st_dev == namedInfo.st_dev && openInfo.st_ino == namedInfo.st_ino;
+}
 
+bool mapInput( FILE *file, MappedFile *map )
+{
+    struct stat info;
+    int fd = fileno( file );
+    if ( fstat( fd, &info ) != 0 || !S_ISREG( info.st_mode ) ) {
+        return false;
+    }
+    
+    // an empty file can't be mapped, but there's nothing to read anyway
+    map->fd = -1;
+    map->len = info.st_size;
+    map->data = NULL;
+    if ( map->len == 0 ) {
+        return true;
+    }
+    
+    // the pages are only read as they're used, so this just counts the bytes
+    STATS_BEGIN( STAGE_READ );
+    void *data = mmap( NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if ( data == MAP_FAILED ) {
+        return false;
+    }
+    posix_madvise( data, map->len, POSIX_MADV_SEQUENTIAL );
+    map->data = data;
+    STATS_END( STAGE_READ, map->len );
+    return true;
+}
 
+bool mapOutput( const char *filename, uint64_t len, MappedFile *map )
+{
+    int fd = open( filename, O_RDWR | O_CREAT | O_TRUNC, OUTPUT_MODE );
+    if ( fd < 0 ) {
+        return false;
+    }
+    
+    // sizing the file before mapping it
+    if ( ftruncate( fd, len ) != 0 ) {
+        close( fd );
+        return false;
+    }
+    map->fd = fd;
+    map->len = len;
+    map->data = NULL;
+    if ( len == 0 ) {
+        return true;
+    }
 
+    // reserving the blocks now, since a full disk would be a SIGBUS once it's mapped
+    if ( posix_fallocate( fd, 0, len ) != 0 ) {
+        close( fd );
+        return false;
+    }
+    
+    void *data = mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( data == MAP_FAILED ) {
+        close( fd );
+        return false;
+    }
+    posix_madvise( data, len, POSIX_MADV_SEQUENTIAL );
+    map->data = data;
+    return true;
+}
 
-    
\ No newline at end of file
+bool unmapFile( MappedFile *map, uint64_t len )
+{
+    bool ok = true;
+    if ( map->data != NULL && munmap( map->data, map->len ) != 0 ) {
+        ok = false;
+    }
+    
+    // output files keep only the bytes that were used
+    if ( map->fd >= 0 ) {
+        STATS_BEGIN( STAGE_WRITE );
+        if ( ftruncate( map->fd, len ) != 0 ) {
+            ok = false;
+        }
+        if ( close( map->fd ) != 0 ) {
+            ok = false;
+        }
+        STATS_END( STAGE_WRITE, len );
+    }
+    map->data = NULL;
+    map->fd = -1;
+    return ok;
+}
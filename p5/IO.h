@@ -8,10 +8,31 @@
 #define _IO_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** File name that stands for standard input or standard output. */
+#define STDIO_NAME "-"
+
+/** Result code when a file can't be read. */
+#define READ_ERROR -1
+
+/** Result code when a file can't be written. */
+#define WRITE_ERROR -2
 
 /** Type used to represent a byte. */
 typedef unsigned char byte;
 
+/** A file mapped into memory, so it can be read or written in place. */
+typedef struct {
+    /** Contents of the file, or NULL if it's empty. */
+    byte *data;
+    /** Number of bytes mapped. */
+    uint64_t len;
+    /** Descriptor for the file, or -1 if it's not open. */
+    int fd;
+} MappedFile;
+
 /**
     This function reads the contents of the file with the given filename.
  
@@ -32,6 +53,107 @@ byte *readFile( const char *filename, int *n );
  */
 bool writeFile( const char *filename, byte *data, int n );
 
+/**
+    This function opens a file for reading a piece at a time, in binary mode.
+    The name STDIO_NAME gives standard input.
+
+    @param filename the name of the file to read.
+    @return the open file, or NULL if it can't be opened.
+ */
+FILE *openInput( const char *filename );
+
+/**
+    This function opens a file for writing a piece at a time, in binary mode.
+    The name STDIO_NAME gives standard output.
+
+    @param filename the name of the file to write.
+    @return the open file, or NULL if it can't be opened.
+ */
+FILE *openOutput( const char *filename );
+
+/**
+    This function reads up to len bytes from the current position in a file,
+    like fread(), counting them as input for the stage statistics.
+    @param file the file to read.
+    @param data array where the bytes are stored.
+    @param len number of bytes to read.
+    @return number of bytes read, which is less than len at the end of the file or on an error.
+ */
+size_t readBytes( FILE *file, byte data[], size_t len );
+
+/**
+    This function writes len bytes to a file, like fwrite(), counting them as
+    output for the stage statistics.
+    @param file the file to write.
+    @param data bytes to write.
+    @param len number of bytes to write.
+    @return true if they were all written, else false.
+ */
+bool writeBytes( FILE *file, byte const data[], size_t len );
+
+/**
+    This function reads part of a file at the given position.
+    @param file the file, which has to be seekable.
+    @param pos position to read from, in bytes from the start of the file.
+    @param data array where the bytes are stored.
+    @param len number of bytes to read.
+    @return true if they could all be read, else false.
+ */
+bool readAt( FILE *file, uint64_t pos, byte data[], size_t len );
+
+/**
+    This function fills an array with random bytes from the operating system, for
+    values like IVs that mustn't be predictable.
+    @param data array to fill.
+    @param len number of bytes to store.
+    @return true if successful, else false.
+ */
+bool randomBytes( byte data[], size_t len );
+
+/**
+    This function reports whether the file with the given name is the same file as
+    one that's already open, so it's not truncated before it's read.
+
+    @param file the open file.
+    @param filename name of the other file, which might not exist.
+    @return true if both refer to the same file, else false.
+ */
+bool sameFile( FILE *file, const char *filename );
+
+/**
+    This function maps the contents of an open file into memory for reading, with a
+    hint that it will be read from start to end. It only works for regular files.
+
+    @param file the open file to map.
+    @param map where the mapping is returned.
+    @return true if successful, false if the file can't be mapped.
+ */
+bool mapInput( FILE *file, MappedFile *map );
+
+/**
+    This function creates or truncates the output file with the given name, sizes it
+    to len bytes and maps it into memory so the output can be written in place.  The
+    space is reserved on disk first, so running out of it is an error here instead of
+    a signal while the mapping is written.
+
+    @param filename the name of the output file.
+    @param len number of bytes in the output file.
+    @param map where the mapping is returned.
+    @return true if successful, false if the file can't be created or mapped.
+ */
+bool mapOutput( const char *filename, uint64_t len, MappedFile *map );
+
+/**
+    This function unmaps a file mapped with mapInput() or mapOutput(). For an output
+    file, it's truncated to the given length, which can be less than the length that
+    was mapped.
+
+    @param map the mapped file.
+    @param len number of bytes to keep in an output file, ignored for an input file.
+    @return true if successful, else false.
+ */
+bool unmapFile( MappedFile *map, uint64_t len );
+
 #endif
 
 
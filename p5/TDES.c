@@ -7,6 +7,9 @@
 #include "TDES.h"
 #include "magic.h"
 #include "TDESinternal.h"
+#include "engine.h"
+#include "destables.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,18 +17,62 @@
 /** Number of halves used when combining subkeys.*/
 #define NUM_HALVES 2
 
-/** Number of DES key parts used in Triple DES.*/
-#define NUM_KEY_PARTS 3
-
 /** A full byte value with all bits set. */
 #define FULL_BYTE 0xFF
 
-/** Mask to get upper 4 bits of the byte. */
-#define UPPER_MASK 0xF0
-
 /** Mask to get the lower 4 bits of the byte. */
 #define LOWER_MASK 0x0F
 
+/** Mask to get the 6-bit input to an S-Box. */
+#define SBOX_MASK ( SBOX_INPUTS - 1 )
+
+/** Number of bits in R after the E expansion when the two wrap-around
+    bits are kept on each end instead of being repeated in the middle. */
+#define WRAPPED_R_BITS ( HALF_BLOCK_BITS + 2 )
+
+/** Number of bits C and D are padded with when stored in HALF_SUBKEY_BYTES bytes. */
+#define HALF_SUBKEY_PAD ( HALF_SUBKEY_BYTES * BYTE_SIZE - HALF_SUBKEY_BITS )
+
+/** Mask to get one 28-bit half (C or D) of the subkey input. */
+#define HALF_SUBKEY_MASK ( ( 1U << HALF_SUBKEY_BITS ) - 1 )
+
+/** Number of bits the 56-bit CD value is shifted up to be used as input
+    to a compiled permutation. */
+#define CD_PAD ( BLOCK_BITS - NUM_HALVES * HALF_SUBKEY_BITS )
+
+/** Number of places a rotated half is turned right so the inputs to the
+    odd-numbered S-Boxes line up with the groups in split[ r ][ 0 ]. */
+#define SPLIT_ROTATION 4
+
+/** Number of entries in the memo each chunk keeps, a power of two. */
+#define MEMO_SLOTS 1024
+
+/** Number of bits in an index into the memo. */
+#define MEMO_BITS 10
+
+/** Number of entries looked at for a block before it's left out of the memo. */
+#define MEMO_PROBES 8
+
+/** Number of blocks looked up before the new ones go through the engine together. */
+#define MEMO_PIECE 1024
+
+/** Odd multiplier that spreads a block over the bits of a memo index. */
+#define MEMO_MULTIPLIER 0x9E3779B97F4A7C15ULL
+
+/** State of a memo entry that hasn't been used. */
+#define MEMO_EMPTY 0
+
+/** State of a memo entry for a block that's waiting for the engine, with
+    its position among the new blocks in place of its result. */
+#define MEMO_PENDING 1
+
+/** State of a memo entry with the result for its block. */
+#define MEMO_DONE 2
+
+/** Position among the new blocks for a block whose result was stored as
+    soon as it was looked up. */
+#define MEMO_STORED UINT16_MAX
+
 
 /** 
     Helper method that rotates a 28-bit value stored in an array of
@@ -35,6 +82,150 @@
  */
 static void rotateLeft( byte bits[], int shift );
 
+/**
+    Helper method that returns the first four bytes of the given array as a
+    32-bit word, with bit 1 of the array in the high-order bit of the word.
+    @param data array of at least four bytes.
+    @return the bytes packed into a word.
+ */
+static uint32_t loadWord( byte const data[] );
+
+/**
+    Helper method that stores a 32-bit word into the first four bytes of the
+    given array, with the high-order bit of the word in bit 1 of the array.
+    @param data array of at least four bytes.
+    @param word the word to store.
+ */
+static void storeWord( byte data[], uint32_t word );
+
+/**
+    Helper method that returns a 48-bit subkey stored in SUBKEY_BYTES bytes
+    as a number, with bit 1 of the subkey in bit 47.
+    @param K the subkey.
+    @return the subkey packed into the low-order bits of a 64-bit value.
+ */
+static uint64_t loadSubkey( byte const K[ SUBKEY_BYTES ] );
+
+/**
+    Helper method that stores a 48-bit subkey held in the low-order bits
+    of a 64-bit value into SUBKEY_BYTES bytes.
+    @param K array where the subkey is stored.
+    @param value the subkey packed into a 64-bit value.
+ */
+static void storeSubkey( byte K[ SUBKEY_BYTES ], uint64_t value );
+
+/**
+    Helper method that splits a 48-bit subkey into the two words used for the
+    S-Box lookups, as described for TDESSchedule.split.
+    @param K 48-bit subkey in the low-order bits, with bit 1 in bit 47.
+    @return the word for the odd-numbered S-Boxes in the high-order 32 bits and
+    the word for the even-numbered ones in the low-order 32 bits.
+ */
+static uint64_t splitSubkey( uint64_t K );
+
+/**
+    Helper method that computes the f function from a split subkey.  R is kept
+    rotated left one place, so the six bits going into each S-Box, wrap-around
+    bits included, sit at the bottom of one byte of R or of R rotated right
+    SPLIT_ROTATION places.  The result is rotated the same way.
+    @param R right half rotated left one place.
+    @param K the subkey split as described for TDESSchedule.split.
+    @return result of the f function, rotated left one place.
+ */
+static inline uint32_t fFunctionSplit( uint32_t R, uint32_t const K[ SPLIT_WORDS ] );
+
+/**
+    Helper method that applies the initial permutation to a block and
+    splits the result into its left and right halves.
+    @param block the 64-bit block.
+    @param L pointer to the word where L_0 is stored.
+    @param R pointer to the word where R_0 is stored.
+ */
+static void initialPerm64( uint64_t block, uint32_t *L, uint32_t *R );
+
+/**
+    Helper method that combines the halves left by desRounds() and
+    applies the final permutation.
+    @param L the left half, which is R_16 after the last round.
+    @param R the right half, which is L_16 after the last round.
+    @return the finished 64-bit block.
+ */
+static uint64_t finalPerm64( uint32_t L, uint32_t R );
+
+/**
+    Helper method that runs all 16 rounds of DES on the given halves,
+    using the subkeys in the order they're stored in the schedule.  The
+    halves are swapped at the end, so they're left as R_16 L_16.  That's
+    the input to the final permutation, and it's also what the initial
+    permutation of another DES pass would give, so the passes of Triple
+    DES can be chained without the final and initial permutations between them.
+    @param L pointer to the left half.
+    @param R pointer to the right half.
+    @param sched subkeys for the 16 rounds.
+ */
+static void desRounds( uint32_t *L, uint32_t *R, TDESSchedule const *sched );
+
+/** Description of a run of blocks split into chunks for a pool of threads. */
+typedef struct {
+    /** Key schedule shared by every thread. */
+    TDESContext const *ctx;
+    /** Array where the result blocks are stored. */
+    byte *out;
+    /** Array of blocks to encrypt or decrypt. */
+    byte const *in;
+    /** Total number of blocks. */
+    size_t blocks;
+    /** True to decrypt, false to encrypt. */
+    bool decrypt;
+} ChunkJob;
+
+/** Blocks a chunk has already encrypted or decrypted. */
+typedef struct {
+    /** Block for each entry. */
+    uint64_t block[ MEMO_SLOTS ];
+    /** Result for each entry, or its position among the new blocks while it's pending. */
+    uint64_t result[ MEMO_SLOTS ];
+    /** MEMO_EMPTY, MEMO_PENDING or MEMO_DONE for each entry. */
+    byte state[ MEMO_SLOTS ];
+} Memo;
+
+/**
+    Helper method that finds the memo entry for a block.
+    @param memo the memo.
+    @param block block to look for, which isn't zero.
+    @return index of the entry for the block, or of an empty one where it can go, or
+    -1 if neither is within MEMO_PROBES entries.
+ */
+static int memoFind( Memo const *memo, uint64_t block );
+
+/**
+    Helper method like tdesCryptBlocks() that only sends the first copy of each block
+    through the engine.  All-zero blocks, which fill sparse files, skip the memo
+    lookup.  The counts are added to the ones in the key schedule.
+    @param ctx key schedule made by tdesInit(), with memo counts.
+    @param out array where the result blocks are stored.
+    @param in array of blocks to encrypt or decrypt, which may be the same as out.
+    @param blocks number of blocks.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+static void memoBlocks( TDESContext const *ctx, byte out[], byte const in[], size_t blocks,
+                        bool decrypt );
+
+/**
+    Helper method run by the pool for each chunk of a ChunkJob.
+    @param arg pointer to the ChunkJob.
+    @param job number of the chunk.
+ */
+static void cryptChunk( void *arg, size_t job );
+
+/**
+    Helper method that copies a schedule with the subkeys in reverse
+    order, so decryption can run the rounds forward through it.
+    @param dest schedule to fill in.
+    @param src schedule to copy.
+ */
+static void reverseSchedule( TDESSchedule *dest, TDESSchedule const *src );
+
 int getBit( byte const data[], int idx ) 
 {
     // start from zero
@@ -65,6 +256,7 @@ void putBit( byte data[], int idx, int val )
 
 void permute( byte output[], byte const input[], int const perm[], int n ) 
 {
+    STATS_BEGIN( STAGE_PERMUTE );
     // setting bits to 0
     for ( int i = 0; i < ( n + BYTE_SIZE - 1 ) / BYTE_SIZE; i++ ) {
         output[ i ] = 0;
@@ -81,20 +273,52 @@ void permute( byte output[], byte const input[], int const perm[], int n )
         int p = ( FULL_BYTE << ( BYTE_SIZE - bits ) ) & FULL_BYTE;
         output[ index ] &= p;
     }
+    STATS_END( STAGE_PERMUTE, 0 );
+}
+
+void compilePerm( CompiledPerm *cp, int const perm[], int n )
+{
+    memset( cp->lut, 0, sizeof( cp->lut ) );
+    cp->inBytes = 0;
+    for ( int i = 0; i < n; i++ ) {
+        // finding the input byte and bit position for this output bit
+        int bytIndex = ( perm[ i ] - 1 ) / BYTE_SIZE;
+        int bitIndex = ( BYTE_SIZE - 1 ) - ( ( perm[ i ] - 1 ) % BYTE_SIZE );
+        uint64_t outBit = ( uint64_t ) 1 << ( n - 1 - i );
+        
+        // every value of that input byte with the bit set selects it
+        for ( int v = 0; v < BYTE_VALUES; v++ ) {
+            if ( ( v >> bitIndex ) & 1 ) {
+                cp->lut[ bytIndex ][ v ] |= outBit;
+            }
+        }
+        if ( bytIndex >= cp->inBytes ) {
+            cp->inBytes = bytIndex + 1;
+        }
+    }
+}
+
+uint64_t applyPerm( CompiledPerm const *cp, uint64_t input )
+{
+    uint64_t output = 0;
+    for ( int i = 0; i < cp->inBytes; i++ ) {
+        int v = ( input >> ( BLOCK_BITS - BYTE_SIZE - i * BYTE_SIZE ) ) & FULL_BYTE;
+        output |= cp->lut[ i ][ v ];
+    }
+    return output;
 }
 
 void generateSubkeys( byte K[ ROUND_COUNT ][ SUBKEY_BYTES ], byte const key[ BLOCK_BYTES ] )
 {
+    STATS_BEGIN( STAGE_KEY_SCHEDULE );
     // arrays to hold the 28-bits
-    byte C[ HALF_SUBKEY_BYTES ] = { 0 };
-    byte D[ HALF_SUBKEY_BYTES ] = { 0 };
+    byte C[ HALF_SUBKEY_BYTES ];
+    byte D[ HALF_SUBKEY_BYTES ];
     
     // getting left and right
-    permute( C, key, leftSubkeyPerm, HALF_SUBKEY_BITS );
-    permute( D, key, rightSubkeyPerm, HALF_SUBKEY_BITS );
-    
-    C[ HALF_SUBKEY_BYTES - 1 ] &= UPPER_MASK;
-    D[ HALF_SUBKEY_BYTES - 1 ] &= UPPER_MASK;
+    uint64_t CD = applyPerm( &subkeyInputTable, loadBlock( key ) );
+    storeWord( C, ( CD >> HALF_SUBKEY_BITS ) << HALF_SUBKEY_PAD );
+    storeWord( D, ( CD & HALF_SUBKEY_MASK ) << HALF_SUBKEY_PAD );
     
     // subkey calculation
     for ( int round = 1; round < ROUND_COUNT; round++ ) {
@@ -103,24 +327,35 @@ void generateSubkeys( byte K[ ROUND_COUNT ][ SUBKEY_BYTES ], byte const key[ BLO
         rotateLeft( C, shift );
         rotateLeft( D, shift );
         // combining C and D to a 56-bit value
-        int comb = ROUND_TO_BYTES( HALF_SUBKEY_BITS * NUM_HALVES );
-        byte CD[ comb ];
-        for ( int i = 0; i < comb; i++ ) {
-            CD[ i ] = 0;
-        }
-        // copying C into first 28 bits
-        for ( int i = 1; i <= HALF_SUBKEY_BITS; i++ ) {
-            int value = getBit( C, i );
-            putBit( CD, i, value );
-        }
-        // copying D into last 28 bits
-        for ( int i = 1; i <= HALF_SUBKEY_BITS; i++ ) {
-            int value = getBit( D, i );
-            putBit( CD, i + HALF_SUBKEY_BITS, value );
-        }
+        CD = ( ( uint64_t )( loadWord( C ) >> HALF_SUBKEY_PAD ) << HALF_SUBKEY_BITS ) |
+             ( loadWord( D ) >> HALF_SUBKEY_PAD );
         // compressing the bits into the subkey
-        permute( K[ round ], CD, subkeyPerm, SUBKEY_BITS );
+        storeSubkey( K[ round ], applyPerm( &subkeyPermTable, CD << CD_PAD ) );
     }
+    STATS_END( STAGE_KEY_SCHEDULE, BLOCK_BYTES );
+}
+
+void scheduleKey( TDESSchedule *sched, byte const key[ BLOCK_BYTES ] )
+{
+    STATS_BEGIN( STAGE_KEY_SCHEDULE );
+    uint64_t CD = applyPerm( &subkeyInputTable, loadBlock( key ) );
+    uint32_t C = CD >> HALF_SUBKEY_BITS;
+    uint32_t D = CD & HALF_SUBKEY_MASK;
+
+    // nothing for round 0, so schedules for the same key compare equal
+    sched->K[ 0 ] = 0;
+    memset( sched->split[ 0 ], 0, sizeof( sched->split[ 0 ] ) );
+    for ( int round = 1; round < ROUND_COUNT; round++ ) {
+        int shift = subkeyShiftSchedule[ round ];
+        C = ( ( C << shift ) | ( C >> ( HALF_SUBKEY_BITS - shift ) ) ) & HALF_SUBKEY_MASK;
+        D = ( ( D << shift ) | ( D >> ( HALF_SUBKEY_BITS - shift ) ) ) & HALF_SUBKEY_MASK;
+        CD = ( ( ( uint64_t ) C << HALF_SUBKEY_BITS ) | D ) << CD_PAD;
+        sched->K[ round ] = applyPerm( &subkeyPermTable, CD );
+        uint64_t split = applyPerm( &subkeySplitTable, CD );
+        sched->split[ round ][ 0 ] = split >> HALF_BLOCK_BITS;
+        sched->split[ round ][ 1 ] = ( uint32_t ) split;
+    }
+    STATS_END( STAGE_KEY_SCHEDULE, BLOCK_BYTES );
 }
 
 static void rotateLeft( byte bits[], int shift )
@@ -140,6 +375,7 @@ static void rotateLeft( byte bits[], int shift )
 
 void sBox( byte output[ 1 ], byte const input[ SUBKEY_BYTES ], int idx )
 {
+    STATS_BEGIN( STAGE_SBOX );
     // starting bit computation
     int start = idx * SBOX_INPUT_BITS + 1;
     int bits = 0;
@@ -159,10 +395,12 @@ void sBox( byte output[ 1 ], byte const input[ SUBKEY_BYTES ], int idx )
     
     // output
     output[ 0 ] = ( byte )( sboxVal << SBOX_OUTPUT_BITS );
+    STATS_END( STAGE_SBOX, 0 );
 }
 
 void fFunction( byte result[ HALF_BLOCK_BYTES ], byte const R[ HALF_BLOCK_BYTES ], byte const K[ SUBKEY_BYTES ] )
 {
+    STATS_BEGIN( STAGE_FFUNCTION );
     // making the 32-bit R larger to 48 bits.
     byte expandedR[ SUBKEY_BYTES ];
     for ( int i = 0; i < SUBKEY_BYTES; i++ ) {
@@ -193,227 +431,499 @@ void fFunction( byte result[ HALF_BLOCK_BYTES ], byte const R[ HALF_BLOCK_BYTES
     }
     
     permute( result, sBoxOutput, fFunctionPerm, HALF_BLOCK_BITS );
+    STATS_END( STAGE_FFUNCTION, 0 );
 }
 
-void encryptBlock( byte block[ BLOCK_BYTES ], byte const K[ ROUND_COUNT ][ SUBKEY_BYTES ] )
+static uint32_t loadWord( byte const data[] )
 {
-    // splitting block into half
-    byte L[ HALF_BLOCK_BYTES ];
-    byte R[ HALF_BLOCK_BYTES ];
+    uint32_t word = 0;
     for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-        L[ i ] = 0;
-        R[ i ] = 0;
+        word = ( word << BYTE_SIZE ) | data[ i ];
+    }
+    return word;
+}
+
+static void storeWord( byte data[], uint32_t word )
+{
+    for ( int i = HALF_BLOCK_BYTES - 1; i >= 0; i-- ) {
+        data[ i ] = word & FULL_BYTE;
+        word >>= BYTE_SIZE;
+    }
+}
+
+static uint64_t loadSubkey( byte const K[ SUBKEY_BYTES ] )
+{
+    uint64_t value = 0;
+    for ( int i = 0; i < SUBKEY_BYTES; i++ ) {
+        value = ( value << BYTE_SIZE ) | K[ i ];
+    }
+    return value;
+}
+
+static void storeSubkey( byte K[ SUBKEY_BYTES ], uint64_t value )
+{
+    for ( int i = SUBKEY_BYTES - 1; i >= 0; i-- ) {
+        K[ i ] = value & FULL_BYTE;
+        value >>= BYTE_SIZE;
     }
-    permute( L, block, leftInitialPerm, HALF_BLOCK_BITS );
-    permute( R, block, rightInitialPerm, HALF_BLOCK_BITS );
+}
+
+uint32_t fFunction32( uint32_t R, uint64_t K )
+{
+    // expanding R with bit 32 in front and bit 1 at the end, so each
+    // S-Box input is six consecutive bits of this value
+    uint64_t wrapped = ( ( uint64_t )( R & 1 ) << ( WRAPPED_R_BITS - 1 ) ) |
+                       ( ( uint64_t ) R << 1 ) | ( R >> ( HALF_BLOCK_BITS - 1 ) );
     
-    // processing
+    uint32_t result = 0;
+    for ( int i = 0; i < SBOX_COUNT; i++ ) {
+        int e = ( wrapped >> ( WRAPPED_R_BITS - SBOX_INPUT_BITS - i * SBOX_OUTPUT_BITS ) ) & SBOX_MASK;
+        int k = ( K >> ( SUBKEY_BITS - SBOX_INPUT_BITS - i * SBOX_INPUT_BITS ) ) & SBOX_MASK;
+        result |= spTable[ i ][ e ^ k ];
+    }
+    return result;
+}
+
+static uint64_t splitSubkey( uint64_t K )
+{
+    uint64_t split = 0;
+    for ( int i = 0; i < SBOX_COUNT; i++ ) {
+        uint64_t group = ( K >> ( SUBKEY_BITS - SBOX_INPUT_BITS - i * SBOX_INPUT_BITS ) ) & SBOX_MASK;
+        // S-Boxes take turns between the words, from the high-order byte down
+        int word = ( SPLIT_WORDS - 1 ) - i % SPLIT_WORDS;
+        int byt = ( GROUPS_PER_WORD - 1 ) - i / SPLIT_WORDS;
+        split |= group << ( word * HALF_BLOCK_BITS + byt * BYTE_SIZE );
+    }
+    return split;
+}
+
+static inline uint32_t fFunctionSplit( uint32_t R, uint32_t const K[ SPLIT_WORDS ] )
+{
+    uint32_t odd = ( ( R >> SPLIT_ROTATION ) | ( R << ( HALF_BLOCK_BITS - SPLIT_ROTATION ) ) ) ^ K[ 0 ];
+    uint32_t even = R ^ K[ 1 ];
+    uint32_t result = 0;
+    for ( int i = 0; i < GROUPS_PER_WORD; i++ ) {
+        int shift = ( GROUPS_PER_WORD - 1 - i ) * BYTE_SIZE;
+        result |= spTable[ i * SPLIT_WORDS ][ ( odd >> shift ) & SBOX_MASK ] |
+                  spTable[ i * SPLIT_WORDS + 1 ][ ( even >> shift ) & SBOX_MASK ];
+    }
+    return ( result << 1 ) | ( result >> ( HALF_BLOCK_BITS - 1 ) );
+}
+
+uint64_t loadBlock( byte const block[ BLOCK_BYTES ] )
+{
+    uint64_t value = 0;
+    for ( int i = 0; i < BLOCK_BYTES; i++ ) {
+        value = ( value << BYTE_SIZE ) | block[ i ];
+    }
+    return value;
+}
+
+void storeBlock( byte block[ BLOCK_BYTES ], uint64_t value )
+{
+    for ( int i = BLOCK_BYTES - 1; i >= 0; i-- ) {
+        block[ i ] = value & FULL_BYTE;
+        value >>= BYTE_SIZE;
+    }
+}
+
+void loadSchedule( TDESSchedule *sched, byte const K[ ROUND_COUNT ][ SUBKEY_BYTES ] )
+{
+    memset( sched, 0, sizeof( *sched ) );
     for ( int round = 1; round < ROUND_COUNT; round++ ) {
-        byte fOut[ HALF_BLOCK_BYTES ];
-        for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-            fOut [ i ] = 0;
-        }
-        fFunction( fOut, R, K[ round ] );
-        // the new right half
-        byte rNext[ HALF_BLOCK_BYTES ];
-        for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-            rNext[ i ] = L[ i ] ^ fOut[ i ];
-        }
-        // left half
-        for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-            L[ i ] = R[ i ];
-        }
-        // right half
-        for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-            R[ i ] = rNext[ i ];
-        }
+        sched->K[ round ] = loadSubkey( K[ round ] );
+        uint64_t split = splitSubkey( sched->K[ round ] );
+        sched->split[ round ][ 0 ] = split >> HALF_BLOCK_BITS;
+        sched->split[ round ][ 1 ] = ( uint32_t ) split;
+    }
+}
+
+static void initialPerm64( uint64_t block, uint32_t *L, uint32_t *R )
+{
+    uint64_t permuted = applyPerm( &initialPermTable, block );
+    *L = permuted >> HALF_BLOCK_BITS;
+    *R = ( uint32_t ) permuted;
+}
+
+static uint64_t finalPerm64( uint32_t L, uint32_t R )
+{
+    return applyPerm( &finalPermTable, ( ( uint64_t ) L << HALF_BLOCK_BITS ) | R );
+}
+
+static void desRounds( uint32_t *L, uint32_t *R, TDESSchedule const *sched )
+{
+    // both halves rotated left one place for the split subkeys
+    uint32_t left = ( *L << 1 ) | ( *L >> ( HALF_BLOCK_BITS - 1 ) );
+    uint32_t right = ( *R << 1 ) | ( *R >> ( HALF_BLOCK_BITS - 1 ) );
+    // two rounds at a time, so the halves don't have to trade places
+    for ( int round = 1; round < ROUND_COUNT; round += NUM_HALVES ) {
+        left ^= fFunctionSplit( right, sched->split[ round ] );
+        right ^= fFunctionSplit( left, sched->split[ round + 1 ] );
     }
-    
     // combined final halves in reverse order
-    byte combinedBlock[ BLOCK_BYTES ] = { 0 };
-    // copying R 
-    for ( int i = 1; i <= HALF_BLOCK_BITS; i++ ) {
-        int value = getBit( R, i );
-        putBit( combinedBlock, i, value );
+    *L = ( right >> 1 ) | ( right << ( HALF_BLOCK_BITS - 1 ) );
+    *R = ( left >> 1 ) | ( left << ( HALF_BLOCK_BITS - 1 ) );
+}
+
+static void reverseSchedule( TDESSchedule *dest, TDESSchedule const *src )
+{
+    memset( dest, 0, sizeof( *dest ) );
+    for ( int round = 1; round < ROUND_COUNT; round++ ) {
+        dest->K[ round ] = src->K[ ROUND_COUNT - round ];
+        memcpy( dest->split[ round ], src->split[ ROUND_COUNT - round ], sizeof( dest->split[ round ] ) );
     }
-    // copying L
-    for ( int i = 1; i <= HALF_BLOCK_BITS; i++ ) {
-        int value = getBit( L, i );
-        putBit( combinedBlock, i + HALF_BLOCK_BITS, value );
+}
+
+uint64_t encryptBlock64( uint64_t block, TDESSchedule const *sched )
+{
+    uint32_t L, R;
+    initialPerm64( block, &L, &R );
+    desRounds( &L, &R, sched );
+    return finalPerm64( L, R );
+}
+
+uint64_t decryptBlock64( uint64_t block, TDESSchedule const *sched )
+{
+    TDESSchedule reversed;
+    reverseSchedule( &reversed, sched );
+    return encryptBlock64( block, &reversed );
+}
+
+void encryptBlock( byte block[ BLOCK_BYTES ], byte const K[ ROUND_COUNT ][ SUBKEY_BYTES ] )
+{
+    TDESSchedule sched;
+    loadSchedule( &sched, K );
+    storeBlock( block, encryptBlock64( loadBlock( block ), &sched ) );
+}
+
+void decryptBlock( byte block[ BLOCK_BYTES ], byte const K[ ROUND_COUNT ][ SUBKEY_BYTES ] )
+{
+    TDESSchedule sched;
+    loadSchedule( &sched, K );
+    storeBlock( block, decryptBlock64( loadBlock( block ), &sched ) );
+}
+
+bool tdesInit( TDESContext *ctx, byte const key[], int keyLen )
+{
+    if ( keyLen != TDES_KEY_BYTES ) {
+        return false;
     }
     
-    // producing the final block
-    byte finOutput[ BLOCK_BYTES ] = { 0 };
-    permute( finOutput, combinedBlock, finalPerm, BLOCK_BITS );
+    for ( int part = 0; part < NUM_KEY_PARTS; part++ ) {
+        scheduleKey( &ctx->enc[ part ], key + part * BLOCK_BYTES );
+        reverseSchedule( &ctx->dec[ part ], &ctx->enc[ part ] );
+    }
     
-    // copying to the original array
-    for ( int i = 0; i < BLOCK_BYTES; i++ ) {
-        block[ i ] = finOutput[ i ];
+    // the parity bits aren't in the subkeys, so this also catches keys that only differ there
+    ctx->memo = NULL;
+    ctx->singleKey = NO_SINGLE_KEY;
+    if ( memcmp( &ctx->enc[ 0 ], &ctx->enc[ 1 ], sizeof( TDESSchedule ) ) == 0 ) {
+        ctx->singleKey = 2;
+    } else if ( memcmp( &ctx->enc[ 1 ], &ctx->enc[ 2 ], sizeof( TDESSchedule ) ) == 0 ) {
+        ctx->singleKey = 0;
     }
+    return true;
 }
 
-void decryptBlock( byte block[ BLOCK_BYTES ], byte const K[ ROUND_COUNT ][ SUBKEY_BYTES ] )
+uint64_t tdesEncryptBlock64( TDESContext const *ctx, uint64_t block )
 {
-    // splitting block into half
-    byte L[ HALF_BLOCK_BYTES ];
-    byte R[ HALF_BLOCK_BYTES ];
-    for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-        L[ i ] = 0;
-        R[ i ] = 0;
+    // the final and initial permutations between the passes cancel out
+    uint32_t L, R;
+    initialPerm64( block, &L, &R );
+    if ( ctx->singleKey != NO_SINGLE_KEY ) {
+        desRounds( &L, &R, &ctx->enc[ ctx->singleKey ] );
+        return finalPerm64( L, R );
+    }
+    desRounds( &L, &R, &ctx->enc[ 0 ] );
+    desRounds( &L, &R, &ctx->dec[ 1 ] );
+    desRounds( &L, &R, &ctx->enc[ 2 ] );
+    return finalPerm64( L, R );
+}
+
+uint64_t tdesDecryptBlock64( TDESContext const *ctx, uint64_t block )
+{
+    uint32_t L, R;
+    initialPerm64( block, &L, &R );
+    if ( ctx->singleKey != NO_SINGLE_KEY ) {
+        desRounds( &L, &R, &ctx->dec[ ctx->singleKey ] );
+        return finalPerm64( L, R );
+    }
+    desRounds( &L, &R, &ctx->dec[ 2 ] );
+    desRounds( &L, &R, &ctx->enc[ 1 ] );
+    desRounds( &L, &R, &ctx->dec[ 0 ] );
+    return finalPerm64( L, R );
+}
+
+void tdesCryptBlocks( TDESContext const *ctx, byte out[], byte const in[], size_t blocks, bool decrypt )
+{
+    // whole batches go through the selected engine, and a stage is only counted if it runs
+    size_t batch = engineBlocks();
+    size_t done = 0;
+    if ( blocks >= batch ) {
+        STATS_BEGIN( STAGE_KERNEL );
+        for ( ; blocks - done >= batch; done += batch ) {
+            engineCrypt( ctx, out + done * BLOCK_BYTES, in + done * BLOCK_BYTES, decrypt );
+        }
+        STATS_END( STAGE_KERNEL, done * BLOCK_BYTES );
     }
-    permute( L, block, leftInitialPerm, HALF_BLOCK_BITS );
-    permute( R, block, rightInitialPerm, HALF_BLOCK_BITS );
     
-    // processing
-    for ( int round = 1; round < ROUND_COUNT; round++ ) {
-        byte fOut[ HALF_BLOCK_BYTES ];
-        for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-            fOut[ i ] = 0;
+    // the rest go one at a time
+    if ( done < blocks ) {
+        STATS_BEGIN( STAGE_SCALAR );
+        for ( ; done < blocks; done++ ) {
+            uint64_t value = loadBlock( in + done * BLOCK_BYTES );
+            if ( decrypt ) {
+                value = tdesDecryptBlock64( ctx, value );
+            } else {
+                value = tdesEncryptBlock64( ctx, value );
+            }
+            storeBlock( out + done * BLOCK_BYTES, value );
+        }
+        STATS_END( STAGE_SCALAR, blocks % batch * BLOCK_BYTES );
+    }
+}
+
+static int memoFind( Memo const *memo, uint64_t block )
+{
+    size_t home = ( block * MEMO_MULTIPLIER ) >> ( 64 - MEMO_BITS );
+    for ( int probe = 0; probe < MEMO_PROBES; probe++ ) {
+        size_t slot = ( home + probe ) & ( MEMO_SLOTS - 1 );
+        if ( memo->state[ slot ] == MEMO_EMPTY || memo->block[ slot ] == block ) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+static void memoBlocks( TDESContext const *ctx, byte out[], byte const in[], size_t blocks,
+                        bool decrypt )
+{
+    Memo memo;
+    memset( memo.state, MEMO_EMPTY, sizeof( memo.state ) );
+    byte fresh[ MEMO_PIECE * BLOCK_BYTES ];
+    int freshSlot[ MEMO_PIECE ];
+    uint16_t ref[ MEMO_PIECE ];
+    bool haveZero = false;
+    uint64_t zeroResult = 0;
+    uint64_t hits = 0;
+
+    for ( size_t start = 0; start < blocks; start += MEMO_PIECE ) {
+        size_t count = blocks - start < MEMO_PIECE ? blocks - start : MEMO_PIECE;
+        size_t freshCount = 0;
+        int zeroRef = -1;
+        for ( size_t i = 0; i < count; i++ ) {
+            byte *dest = out + ( start + i ) * BLOCK_BYTES;
+            uint64_t block = loadBlock( in + ( start + i ) * BLOCK_BYTES );
+            ref[ i ] = MEMO_STORED;
+
+            // results already known are stored right away, even over the input
+            int slot = -1;
+            if ( block == 0 ) {
+                if ( haveZero || zeroRef >= 0 ) {
+                    hits++;
+                    if ( haveZero ) {
+                        storeBlock( dest, zeroResult );
+                    } else {
+                        ref[ i ] = zeroRef;
+                    }
+                    continue;
+                }
+                zeroRef = freshCount;
+            } else {
+                slot = memoFind( &memo, block );
+                if ( slot >= 0 && memo.state[ slot ] != MEMO_EMPTY ) {
+                    hits++;
+                    if ( memo.state[ slot ] == MEMO_DONE ) {
+                        storeBlock( dest, memo.result[ slot ] );
+                    } else {
+                        ref[ i ] = memo.result[ slot ];
+                    }
+                    continue;
+                }
+                if ( slot >= 0 ) {
+                    memo.state[ slot ] = MEMO_PENDING;
+                    memo.block[ slot ] = block;
+                    memo.result[ slot ] = freshCount;
+                }
+            }
+            freshSlot[ freshCount ] = slot;
+            storeBlock( fresh + freshCount * BLOCK_BYTES, block );
+            ref[ i ] = freshCount++;
         }
-        fFunction( fOut, R, K[ ROUND_COUNT - round ] );
-        // the new right half
-        byte rNext[ HALF_BLOCK_BYTES ];
-        for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-            rNext[ i ] = L[ i ] ^ fOut[ i ];
+
+        // the new blocks go through the engine together
+        tdesCryptBlocks( ctx, fresh, fresh, freshCount, decrypt );
+        for ( size_t j = 0; j < freshCount; j++ ) {
+            if ( freshSlot[ j ] >= 0 ) {
+                memo.state[ freshSlot[ j ] ] = MEMO_DONE;
+                memo.result[ freshSlot[ j ] ] = loadBlock( fresh + j * BLOCK_BYTES );
+            }
         }
-        // left half
-        for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-            L[ i ] = R[ i ];
+        if ( zeroRef >= 0 ) {
+            haveZero = true;
+            zeroResult = loadBlock( fresh + zeroRef * BLOCK_BYTES );
         }
-        // right half
-        for ( int i = 0; i < HALF_BLOCK_BYTES; i++ ) {
-            R[ i ] = rNext[ i ];
+        for ( size_t i = 0; i < count; i++ ) {
+            if ( ref[ i ] != MEMO_STORED ) {
+                memcpy( out + ( start + i ) * BLOCK_BYTES, fresh + ref[ i ] * BLOCK_BYTES, BLOCK_BYTES );
+            }
         }
     }
-    
-    // combined final halves in reverse order
-    byte combinedBlock[ BLOCK_BYTES ] = { 0 };
-    // copying R 
-    for ( int i = 1; i <= HALF_BLOCK_BITS; i++ ) {
-        int value = getBit( R, i );
-        putBit( combinedBlock, i, value );
+    __atomic_fetch_add( &ctx->memo->lookups, blocks, __ATOMIC_RELAXED );
+    __atomic_fetch_add( &ctx->memo->hits, hits, __ATOMIC_RELAXED );
+}
+
+static void cryptChunk( void *arg, size_t job )
+{
+    ChunkJob const *chunk = arg;
+    size_t first = job * CHUNK_BLOCKS;
+    size_t count = chunk->blocks - first < CHUNK_BLOCKS ? chunk->blocks - first : CHUNK_BLOCKS;
+    if ( chunk->ctx->memo != NULL ) {
+        memoBlocks( chunk->ctx, chunk->out + first * BLOCK_BYTES,
+                    chunk->in + first * BLOCK_BYTES, count, chunk->decrypt );
+        return;
     }
-    // copying L
-    for ( int i = 1; i <= HALF_BLOCK_BITS; i++ ) {
-        int value = getBit( L, i );
-        putBit( combinedBlock, i + HALF_BLOCK_BITS, value );
+    tdesCryptBlocks( chunk->ctx, chunk->out + first * BLOCK_BYTES,
+                     chunk->in + first * BLOCK_BYTES, count, chunk->decrypt );
+}
+
+void tdesCryptBlocksParallel( TDESContext const *ctx, Pool *pool, byte out[], byte const in[],
+                              size_t blocks, bool decrypt )
+{
+    ChunkJob chunk = { ctx, out, in, blocks, decrypt };
+    poolRun( pool, ( blocks + CHUNK_BLOCKS - 1 ) / CHUNK_BLOCKS, cryptChunk, &chunk );
+}
+
+size_t tdesPaddedLen( size_t len )
+{
+    // a whole block of padding if the data ends on a block boundary
+    return len - len % BLOCK_BYTES + BLOCK_BYTES;
+}
+
+char const *tdesErrorMessage( int status )
+{
+    switch ( status ) {
+        case TDES_OK:
+            return "Success";
+        case TDES_ERR_LENGTH:
+            return "Invalid encrypted data length";
+        case TDES_ERR_PADDING:
+            return "Invalid padding";
+        case TDES_ERR_SPACE:
+            return "Output buffer too small";
+        case TDES_ERR_FORMAT:
+            return "Invalid container";
+        default:
+            return "Unknown error";
     }
-    
-    // producing the final block
-    byte finOutput[ BLOCK_BYTES ] = { 0 };
-    permute( finOutput, combinedBlock, finalPerm, BLOCK_BITS );
-    
-    // copying to the original array
-    for ( int i = 0; i < BLOCK_BYTES; i++ ) {
-        block[ i ] = finOutput[ i ];
-    }  
 }
 
-byte *encryptTDES( byte input[], int inputLen, byte key[], int keyLen, int *n ) 
+int tdesEncryptInto( TDESContext const *ctx, Pool *pool, byte out[], size_t outCap,
+                     byte const in[], size_t inLen, size_t *outLen )
 {
-    if ( keyLen != ( NUM_KEY_PARTS * BLOCK_BYTES ) ) {
-        fprintf( stderr, "Invalid key length\n" );
-        exit( EXIT_FAILURE );
+    size_t totalLength = tdesPaddedLen( inLen );
+    if ( outCap < totalLength ) {
+        return TDES_ERR_SPACE;
     }
     
-    // computing the padding
-    int desBlockSize = BLOCK_BYTES;
-    int padCount = desBlockSize - ( inputLen % desBlockSize );
-    if ( ( inputLen % desBlockSize ) == 0 )
-        padCount = desBlockSize;
-    int totalLength = inputLen + padCount;
-    
-    // new array for the padded input
-    byte *paddedData = malloc( totalLength );
-    if ( paddedData == NULL ) {
-        exit( EXIT_FAILURE );
-    }   
-    memcpy( paddedData, input, inputLen );
-    for ( int i = inputLen; i < totalLength; i++ ) {
-        paddedData[ i ] = ( byte ) padCount;
+    // padding goes after the plaintext, which stays put when encrypting in place
+    if ( out != in ) {
+        memmove( out, in, inLen );
     }
-    
-    // subkeys
-    byte subkeys1[ ROUND_COUNT ][ SUBKEY_BYTES ];
-    byte subkeys2[ ROUND_COUNT ][ SUBKEY_BYTES ];
-    byte subkeys3[ ROUND_COUNT ][ SUBKEY_BYTES ];
-    generateSubkeys( subkeys1, key );
-    generateSubkeys( subkeys2, key + BLOCK_BYTES );
-    generateSubkeys( subkeys3, key + ( NUM_HALVES * BLOCK_BYTES ) );
+    byte padCount = totalLength - inLen;
+    memset( out + inLen, padCount, padCount );
     
     // processing each block using Triple DES
-    for ( int blkIdx = 0; blkIdx < totalLength; blkIdx += desBlockSize ) {
-        byte *curBlock = paddedData + blkIdx;
-        encryptBlock( curBlock, subkeys1 );
-        decryptBlock( curBlock, subkeys2 );
-        encryptBlock( curBlock, subkeys3 );
-    }
-    *n = totalLength;
-    return paddedData;
+    tdesCryptBlocksParallel( ctx, pool, out, out, totalLength / BLOCK_BYTES, false );
+    *outLen = totalLength;
+    return TDES_OK;
 }
 
-byte *decryptTDES( byte input[], int inputLen, byte key[], int keyLen, int *n )
+int tdesDecryptInto( TDESContext const *ctx, Pool *pool, byte out[], size_t outCap,
+                     byte const in[], size_t inLen, size_t *outLen )
 {
-    if ( keyLen != ( NUM_KEY_PARTS * BLOCK_BYTES ) ) {
-        fprintf( stderr, "Invalid key length\n" );
-        exit( EXIT_FAILURE );
+    if ( inLen == 0 || inLen % BLOCK_BYTES != 0 ) {
+        return TDES_ERR_LENGTH;
     }
-    
-    // computing the padding
-    int desBlockSize = BLOCK_BYTES;
-    if ( inputLen == 0 || ( inputLen % desBlockSize ) != 0 ) {
-        fprintf( stderr, "Invalid encrypted data length\n" );
-        exit( EXIT_FAILURE );
+    if ( outCap < inLen ) {
+        return TDES_ERR_SPACE;
     }
     
-    // ciphertext
-    byte *cipherBuffer = malloc( inputLen );
-    if ( cipherBuffer == NULL ) {
-        exit( EXIT_FAILURE );
-    }
-    memcpy( cipherBuffer, input, inputLen );
-    
-    // subkeys
-    byte subkeys1[ ROUND_COUNT ][ SUBKEY_BYTES ];
-    byte subkeys2[ ROUND_COUNT ][ SUBKEY_BYTES ];
-    byte subkeys3[ ROUND_COUNT ][ SUBKEY_BYTES ];
-    generateSubkeys( subkeys1, key );
-    generateSubkeys( subkeys2, key + BLOCK_BYTES );
-    generateSubkeys( subkeys3, key + ( NUM_HALVES * BLOCK_BYTES ) );
-    
     // processing each block using Triple DES
-    for ( int blkIdx = 0; blkIdx < inputLen; blkIdx += desBlockSize ) {
-        byte *curBlock = cipherBuffer + blkIdx;
-        decryptBlock( curBlock, subkeys3 );
-        encryptBlock( curBlock, subkeys2 );
-        decryptBlock( curBlock, subkeys1 );
-    }
+    tdesCryptBlocksParallel( ctx, pool, out, in, inLen / BLOCK_BYTES, true );
     
-    // rmeoving padding
-    int padValue = cipherBuffer[ inputLen - 1 ];
-    if ( padValue < 1 || padValue > desBlockSize ) {
-        fprintf(stderr, "Invalid padding\n");
-        free( cipherBuffer );
+    // removing padding
+    int padValue = out[ inLen - 1 ];
+    if ( padValue < 1 || padValue > BLOCK_BYTES ) {
+        return TDES_ERR_PADDING;
+    }
+    *outLen = inLen - padValue;
+    return TDES_OK;
+}
+
+byte *tdesEncrypt( TDESContext const *ctx, Pool *pool, byte input[], int inputLen, int *n )
+{
+    size_t totalLength = tdesPaddedLen( inputLen );
+    byte *paddedData = malloc( totalLength );
+    if ( paddedData == NULL ) {
         exit( EXIT_FAILURE );
     }
-    int plainLen = inputLen - padValue;
     
-    byte *plainBuffer = malloc( plainLen );
+    size_t outLen;
+    tdesEncryptInto( ctx, pool, paddedData, totalLength, input, inputLen, &outLen );
+    *n = outLen;
+    return paddedData;
+}
+
+byte *tdesDecrypt( TDESContext const *ctx, Pool *pool, byte input[], int inputLen, int *n )
+{
+    // one buffer holds the ciphertext's blocks, then the plaintext
+    byte *plainBuffer = malloc( inputLen > 0 ? inputLen : 1 );
     if ( plainBuffer == NULL ) {
-        free( cipherBuffer );
         exit( EXIT_FAILURE );
     }
-    memcpy( plainBuffer, cipherBuffer, plainLen );
-    free( cipherBuffer );
     
+    size_t plainLen;
+    int status = tdesDecryptInto( ctx, pool, plainBuffer, inputLen, input, inputLen, &plainLen );
+    if ( status != TDES_OK ) {
+        fprintf( stderr, "%s\n", tdesErrorMessage( status ) );
+        free( plainBuffer );
+        exit( EXIT_FAILURE );
+    }
     *n = plainLen;
     return plainBuffer;
-    
 }
 
+byte *encryptTDES( byte input[], int inputLen, byte key[], int keyLen, int *n ) 
+{
+    return encryptTDESMemo( input, inputLen, key, keyLen, n, NULL );
+}
+
+byte *decryptTDES( byte input[], int inputLen, byte key[], int keyLen, int *n )
+{
+    return decryptTDESMemo( input, inputLen, key, keyLen, n, NULL );
+}
 
+byte *encryptTDESMemo( byte input[], int inputLen, byte key[], int keyLen, int *n,
+                       TDESMemoStats *memo )
+{
+    TDESContext ctx;
+    if ( !tdesInit( &ctx, key, keyLen ) ) {
+        fprintf( stderr, "Invalid key length\n" );
+        exit( EXIT_FAILURE );
+    }
+    ctx.memo = memo;
+    return tdesEncrypt( &ctx, NULL, input, inputLen, n );
+}
 
-    
-    
-    
-    
\ No newline at end of file
+byte *decryptTDESMemo( byte input[], int inputLen, byte key[], int keyLen, int *n,
+                       TDESMemoStats *memo )
+{
+    TDESContext ctx;
+    if ( !tdesInit( &ctx, key, keyLen ) ) {
+        fprintf( stderr, "Invalid key length\n" );
+        exit( EXIT_FAILURE );
+    }
+    ctx.memo = memo;
+    return tdesDecrypt( &ctx, NULL, input, inputLen, n );
+}
@@ -4,9 +4,65 @@
     Header for the Triple DES Implementation.
 */
 
+#ifndef _TDES_H_
+#define _TDES_H_
+
+#include <stddef.h>
+#include <stdint.h>
 #include "IO.h"
+#include "pool.h"
 #include "TDESinternal.h"
 
+/** Number of DES key parts used in Triple DES.*/
+#define NUM_KEY_PARTS 3
+
+/** Number of bytes in a whole Triple DES key. */
+#define TDES_KEY_BYTES ( NUM_KEY_PARTS * BLOCK_BYTES )
+
+/** Size of a cache line, used to align data that's read on every block. */
+#define CACHE_LINE_BYTES 64
+
+/** Number of different values a byte can have. */
+#define BYTE_VALUES 256
+
+/** Number of different 6-bit inputs to each S-Box. */
+#define SBOX_INPUTS ( 1 << SBOX_INPUT_BITS )
+
+/** Number of words each subkey is split into for the S-Box lookups, one
+    for the odd-numbered S-Boxes and one for the even-numbered ones. */
+#define SPLIT_WORDS 2
+
+/** Number of 6-bit groups in each word of a split subkey, one to a byte. */
+#define GROUPS_PER_WORD ( SBOX_COUNT / SPLIT_WORDS )
+
+/** Number of blocks in each chunk handed to a thread.  It's a whole
+    number of batches for every bitsliced kernel, and at 64 KB it stays
+    in cache while a thread works on it. */
+#define CHUNK_BLOCKS 8192
+
+/** A permutation table from magic.c compiled into one lookup table per
+    input byte, so it can be applied with a lookup and an OR for each
+    byte instead of moving one bit at a time. */
+typedef struct {
+    /** Number of input bytes the permutation reads bits from. */
+    int inBytes;
+    /** lut[ i ][ v ] holds the output bits selected from input byte i
+        when that byte has the value v. */
+    uint64_t lut[ BLOCK_BYTES ][ BYTE_VALUES ];
+} CompiledPerm;
+
+/** Subkeys for one DES key, packed into words for the 64-bit block engine. */
+typedef struct {
+    /** 48-bit subkeys K_1 .. K_16 in the low-order bits of each element,
+        with bit 1 of the subkey in bit 47.  K[ 0 ] is unused. */
+    uint64_t K[ ROUND_COUNT ];
+    /** The same subkeys split into the 6-bit groups for each S-Box, one
+        group in the low-order bits of each byte.  split[ r ][ 0 ] holds
+        the groups for S-Boxes 1, 3, 5 and 7 from the high-order byte down,
+        and split[ r ][ 1 ] the groups for S-Boxes 2, 4, 6 and 8. */
+    uint32_t split[ ROUND_COUNT ][ SPLIT_WORDS ];
+} TDESSchedule;
+
 /**
     This function returns zero or one based on the value of the bit
     at index idx in the given array of bytes.
@@ -35,6 +91,25 @@ void putBit( byte data[], int idx, int val );
  */
 void permute( byte output[], byte const input[], int const perm[], int n );
 
+/**
+    This function compiles a permutation table like the ones used by permute() into
+    a lookup table for each input byte. The permutation can select bits from up to
+    the first 64 bits of its input.
+    @param cp compiled permutation to fill in.
+    @param perm permutation array that specifies which bits to copy.
+    @param n number of bits to permute, at most 64.
+ */
+void compilePerm( CompiledPerm *cp, int const perm[], int n );
+
+/**
+    This function applies a compiled permutation. It gives the same result as
+    permute() with the table the permutation was compiled from.
+    @param cp the compiled permutation.
+    @param input input bits, with bit 1 in the high-order bit.
+    @return the n output bits in the low-order bits, with bit 1 in bit n - 1.
+ */
+uint64_t applyPerm( CompiledPerm const *cp, uint64_t input );
+
 /**
     This function computes 16 subkeys based on the input key and stores each
     one in an element of the given K array. The resulting subkeys are stored in K[ 1 ] .. K[ 16 ].
@@ -64,6 +139,17 @@ void sBox( byte output[ 1 ], byte const input[ SUBKEY_BYTES ], int idx );
  */
 void fFunction( byte result[ HALF_BLOCK_BYTES ], byte const R[ HALF_BLOCK_BYTES ], byte const K[ SUBKEY_BYTES ] );
 
+/**
+    This function is a table-driven version of fFunction() that works on words instead
+    of byte arrays. The S-Box lookups and the P permutation are done together through
+    precomputed tables, so it gives the same result as fFunction() without working on
+    individual bits. fFunction() is kept as the reference version.
+    @param R 32-bit right half of the block, with bit 1 in the high-order bit.
+    @param K 48-bit subkey in the low-order bits, with bit 1 in bit 47.
+    @return 32-bit result of the f function.
+ */
+uint32_t fFunction32( uint32_t R, uint64_t K );
+
 /**
    This function performs a single block encrypt operation on the byte array in block,
    using the subkeys in the K array. The encrypted result is stored back in the given block. 
@@ -80,6 +166,239 @@ void encryptBlock( byte block[ BLOCK_BYTES ], byte const K[ ROUND_COUNT ][ SUBKE
  */
 void decryptBlock( byte block[ BLOCK_BYTES ], byte const K[ ROUND_COUNT ][ SUBKEY_BYTES ] );
 
+/** Result code when an operation succeeds. */
+#define TDES_OK 0
+
+/** Result code when encrypted data isn't a non-zero multiple of the block size. */
+#define TDES_ERR_LENGTH 1
+
+/** Result code when the padding at the end of decrypted data isn't valid. */
+#define TDES_ERR_PADDING 2
+
+/** Result code when the caller's output buffer is too small for the result. */
+#define TDES_ERR_SPACE 3
+
+/** Result code when a container's header, index or chunks don't fit together. */
+#define TDES_ERR_FORMAT 4
+
+/** Value of singleKey in a TDESContext when the key needs all three passes. */
+#define NO_SINGLE_KEY -1
+
+/** Counts for the memo of repeated ECB blocks, added to by every thread. */
+typedef struct {
+    /** Number of blocks looked up in the memo. */
+    uint64_t lookups;
+    /** Number of those that had been seen before, so the rounds were skipped. */
+    uint64_t hits;
+} TDESMemoStats;
+
+/** Precomputed key schedule for a whole Triple DES key.  It's set up
+    once by tdesInit() and can be used for any number of calls to
+    tdesEncrypt() and tdesDecrypt(), including from several threads. */
+typedef struct {
+    /** Subkeys for K1, K2 and K3, in the order encryption uses them. */
+    TDESSchedule enc[ NUM_KEY_PARTS ];
+    /** The same subkeys in reverse order, so decrypting with a key part
+        runs the rounds forward through this schedule. */
+    TDESSchedule dec[ NUM_KEY_PARTS ];
+    /** When K1 and K2 or K2 and K3 are the same, the first two passes or
+        the last two cancel out, and this is the key part that does the
+        whole job with one pass of DES.  Otherwise, it's NO_SINGLE_KEY. */
+    int singleKey;
+    /** Counts for the memo tdesCryptBlocksParallel() keeps of blocks it has
+        already done, or NULL to do every block.  tdesInit() leaves it NULL,
+        and a caller that expects repeated blocks in ECB can point it at
+        counts of its own. */
+    TDESMemoStats *memo;
+} __attribute__(( aligned( CACHE_LINE_BYTES ) )) TDESContext;
+
+/**
+    This function returns the BLOCK_BYTES bytes of the given array as a 64-bit value,
+    with bit 1 of the block in the high-order bit.
+    @param block 64-bit block stored in BLOCK_BYTES bytes.
+    @return the block packed into a 64-bit value.
+ */
+uint64_t loadBlock( byte const block[ BLOCK_BYTES ] );
+
+/**
+    This function stores a 64-bit value into BLOCK_BYTES bytes of the given array,
+    with the high-order bit of the value in bit 1 of the block.
+    @param block array where the block is stored.
+    @param value the block packed into a 64-bit value.
+ */
+void storeBlock( byte block[ BLOCK_BYTES ], uint64_t value );
+
+/**
+    This function packs the subkeys made by generateSubkeys() into a schedule for the
+    64-bit block engine.
+    @param sched schedule to fill in.
+    @param K subkeys stored in K[ 1 ] through K[ 16 ].
+ */
+void loadSchedule( TDESSchedule *sched, byte const K[ ROUND_COUNT ][ SUBKEY_BYTES ] );
+
+/**
+    This function computes the schedule for one DES key straight from the key, with the
+    same result as generateSubkeys() followed by loadSchedule().  C and D are kept in
+    words and rotated with shifts, and PC-2 is applied through lookup tables, instead
+    of moving one bit at a time.
+    @param sched schedule to fill in.
+    @param key 64-bit key stored in BLOCK_BYTES bytes.
+ */
+void scheduleKey( TDESSchedule *sched, byte const key[ BLOCK_BYTES ] );
+
+/**
+    This function encrypts a single block held in a 64-bit value, keeping the left and
+    right halves in words for all 16 rounds. encryptBlock() is a wrapper around it.
+    @param block 64-bit block to encrypt, with bit 1 in the high-order bit.
+    @param sched subkeys used in the 16 rounds.
+    @return the encrypted block.
+ */
+uint64_t encryptBlock64( uint64_t block, TDESSchedule const *sched );
+
+/**
+    This function decrypts a single block held in a 64-bit value, using the subkeys in
+    reverse order. decryptBlock() is a wrapper around it.
+    @param block 64-bit block to decrypt, with bit 1 in the high-order bit.
+    @param sched subkeys used in the 16 rounds.
+    @return the decrypted block.
+ */
+uint64_t decryptBlock64( uint64_t block, TDESSchedule const *sched );
+
+/**
+    This function computes the key schedule for a 24-byte Triple DES key, so it can
+    be reused for every call that uses the same key. Keys where K1 == K2 or K2 == K3
+    reduce to single DES, so they're noted here and later only take one pass.
+    @param ctx context to fill in.
+    @param key encryption key.
+    @param keyLen length in bytes of the key.
+    @return true if successful, false if the key isn't TDES_KEY_BYTES long.
+ */
+bool tdesInit( TDESContext *ctx, byte const key[], int keyLen );
+
+/**
+    This function encrypts a single block with Triple DES (encrypt with K1, decrypt
+    with K2, encrypt with K3). The initial and final permutations are only applied
+    once, since the ones between the three passes cancel each other out.
+    @param ctx key schedule made by tdesInit().
+    @param block 64-bit block to encrypt, with bit 1 in the high-order bit.
+    @return the encrypted block.
+ */
+uint64_t tdesEncryptBlock64( TDESContext const *ctx, uint64_t block );
+
+/**
+    This function decrypts a single block with Triple DES (decrypt with K3, encrypt
+    with K2, decrypt with K1). Like tdesEncryptBlock64(), it only applies the initial
+    and final permutations once.
+    @param ctx key schedule made by tdesInit().
+    @param block 64-bit block to decrypt, with bit 1 in the high-order bit.
+    @return the decrypted block.
+ */
+uint64_t tdesDecryptBlock64( TDESContext const *ctx, uint64_t block );
+
+/**
+    This function encrypts or decrypts a sequence of blocks with Triple DES, without
+    padding. Whole batches of blocks go through the bitsliced engine, with the widest
+    kernel the CPU supports, and any blocks left over use tdesEncryptBlock64() or
+    tdesDecryptBlock64().
+    @param ctx key schedule made by tdesInit().
+    @param out array where the result blocks are stored.
+    @param in array of blocks to encrypt or decrypt, which may be the same as out.
+    @param blocks number of blocks.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+void tdesCryptBlocks( TDESContext const *ctx, byte out[], byte const in[], size_t blocks, bool decrypt );
+
+/**
+    This function is like tdesCryptBlocks(), but it splits the blocks into chunks that
+    are spread across the threads of a pool. Every thread shares the same key schedule.
+    If the key schedule has memo counts, each chunk remembers the blocks it has done,
+    so only the first copy of a repeated block goes through the rounds.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param out array where the result blocks are stored.
+    @param in array of blocks to encrypt or decrypt, which may be the same as out.
+    @param blocks number of blocks.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+void tdesCryptBlocksParallel( TDESContext const *ctx, Pool *pool, byte out[], byte const in[],
+                              size_t blocks, bool decrypt );
+
+/**
+    This function returns the number of bytes encrypting the given amount of
+    plaintext produces, which is the room tdesEncryptInto() needs for its output.
+    @param len length in bytes of the plaintext.
+    @return length in bytes of the padded ciphertext.
+ */
+size_t tdesPaddedLen( size_t len );
+
+/**
+    This function returns a message describing one of the TDES_ERR_ result codes.
+    @param status result code returned by one of the Triple DES functions.
+    @return message for the code, without a trailing newline.
+ */
+char const *tdesErrorMessage( int status );
+
+/**
+    This function adds padding and encrypts data into a buffer provided by the caller,
+    without allocating any memory. The output may be the same array as the input, so
+    data can be encrypted in place as long as the array has room for the padding.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param out array where the padded ciphertext is stored.
+    @param outCap size in bytes of the out array.
+    @param in plaintext data to encrypt.
+    @param inLen length in bytes of the plaintext.
+    @param outLen pointer to where the length of the ciphertext is stored.
+    @return TDES_OK if successful, or TDES_ERR_SPACE if outCap is less than
+    tdesPaddedLen( inLen ).
+ */
+int tdesEncryptInto( TDESContext const *ctx, Pool *pool, byte out[], size_t outCap,
+                     byte const in[], size_t inLen, size_t *outLen );
+
+/**
+    This function decrypts data and removes its padding, storing the plaintext in a buffer
+    provided by the caller without allocating any memory. The output may be the same array
+    as the input, so data can be decrypted in place.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param out array where the plaintext is stored. It's used for the padding too, so it
+    needs room for inLen bytes.
+    @param outCap size in bytes of the out array.
+    @param in ciphertext data to decrypt.
+    @param inLen length in bytes of the ciphertext.
+    @param outLen pointer to where the length of the plaintext is stored.
+    @return TDES_OK if successful, TDES_ERR_LENGTH if inLen isn't a non-zero multiple of
+    the block size, TDES_ERR_SPACE if outCap is less than inLen, or TDES_ERR_PADDING if
+    the padding isn't valid.
+ */
+int tdesDecryptInto( TDESContext const *ctx, Pool *pool, byte out[], size_t outCap,
+                     byte const in[], size_t inLen, size_t *outLen );
+
+/**
+    This function is like encryptTDES(), but it uses a key schedule made by tdesInit()
+    instead of computing one from the key on every call. Padding is added before the
+    blocks are split up, so it all ends up in the last chunk.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param input plaintext data to encrypt.
+    @param inputLen length in bytes of the plaintext.
+    @param n pointer to an integer that will hold the length of the encrypted output.
+    @return byte* pointer to a dynamically allocated array containing the padded, encrypted data.
+ */
+byte *tdesEncrypt( TDESContext const *ctx, Pool *pool, byte input[], int inputLen, int *n );
+
+/**
+    This function is like decryptTDES(), but it uses a key schedule made by tdesInit()
+    instead of computing one from the key on every call.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param input ciphertext data to decrypt.
+    @param inputLen length in bytes of the ciphertext.
+    @param n pointer to an integer that will hold the length of the decrypted output.
+    @return byte* pointer to a dynamically allocated array containing the decrypted plaintext.
+ */
+byte *tdesDecrypt( TDESContext const *ctx, Pool *pool, byte input[], int inputLen, int *n );
+
 /**
     This function adds padding if needed and encrypts the resulting array using the Triple
     DES algorithm. It returns a pointer to a dynamically allocated array containing the padded,
@@ -104,13 +423,32 @@ byte *encryptTDES( byte input[], int inputLen, byte key[], int keyLen, int *n );
  */
 byte *decryptTDES( byte input[], int inputLen, byte key[], int keyLen, int *n );
 
+/**
+    This function is like encryptTDES(), but the blocks go through the memo of repeated
+    blocks, so only the first copy of each one goes through the rounds.
+    @param input plaintext data to encrypt.
+    @param inputLen length in bytes of the plaintext.
+    @param key encryption key
+    @param keyLen length in bytes of the key.
+    @param n pointer to an integer that will hold the length of the encrypted output.
+    @param memo counts that the lookups and hits are added to, or NULL to leave the memo off.
+    @return byte* pointer to a dynamically allocated array containing the padded, encrypted data.
+ */
+byte *encryptTDESMemo( byte input[], int inputLen, byte key[], int keyLen, int *n,
+                       TDESMemoStats *memo );
 
+/**
+    This function is like decryptTDES(), but the blocks go through the memo of repeated
+    blocks, so only the first copy of each one goes through the rounds.
+    @param input ciphertext data to decrypt.
+    @param inputLen length in bytes of the ciphertext.
+    @param key decryption key.
+    @param keyLen length in bytes of the key.
+    @param n pointer to an integer that will hold the length of the decrypted output.
+    @param memo counts that the lookups and hits are added to, or NULL to leave the memo off.
+    @return byte* pointer to a dynamically allocated array containing the decrypted plaintext.
+ */
+byte *decryptTDESMemo( byte input[], int inputLen, byte key[], int keyLen, int *n,
+                       TDESMemoStats *memo );
 
-
-
-
-
-
-
-
-
+#endif
@@ -7,6 +7,10 @@
     TDES implementation.
 */
 
+#ifndef _TDES_INTERNAL_H_
+#define _TDES_INTERNAL_H_
+
+#include <stdint.h>
 #include "IO.h"
 #include "magic.h"
 
@@ -42,8 +46,10 @@ void generateSubkeys( byte K[ ROUND_COUNT ][ SUBKEY_BYTES ], byte const key[ BLO
 void sBox( byte output[ 1 ], byte const input[ SUBKEY_BYTES ], int idx );
 void fFunction( byte result[ HALF_BLOCK_BYTES ], byte const R[ HALF_BLOCK_BYTES ],
                 byte const K[ SUBKEY_BYTES ] );
+uint32_t fFunction32( uint32_t R, uint64_t K );
 void encryptBlock( byte block[ BLOCK_BYTES ],
                    byte const K[ ROUND_COUNT ][ SUBKEY_BYTES ] );
 void decryptBlock( byte block[ BLOCK_BYTES ],
                    byte const K[ ROUND_COUNT ][ SUBKEY_BYTES ] );
-                   
\ No newline at end of file
+
+#endif
@@ -7,11 +7,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "TDES.h"
 #include "TDESinternal.h"
+#include "bitslice.h"
+#include "engine.h"
+#include "compress.h"
+#include "container.h"
+#include "destables.h"
+#include "modes.h"
+#include "pipeline.h"
+#include "records.h"
+#include "ring.h"
+#include "stream.h"
+#include "uring.h"
 
 /** Number of tests we should have, if they're all turned on. */
-#define EXPECTED_TOTAL 73
+#define EXPECTED_TOTAL 151
 
 /** Total number or tests we tried. */
 static int totalTests = 0;
@@ -39,6 +51,64 @@ bool cmpBytes( byte const A[], byte const B[], int n )
   return true;
 }
 
+/** Return the first n bytes of A as a number, with A[ 0 ] in the
+    high-order position. */
+uint64_t packBytes( byte const A[], int n )
+{
+  uint64_t value = 0;
+  for ( int i = 0; i < n; i++ )
+    value = ( value << 8 ) | A[ i ];
+  return value;
+}
+
+/** Largest number of blocks used when testing the bitsliced engine. */
+#define SLICE_TEST_BLOCKS 300
+
+/** Return true if the given kernel agrees with the one-block-at-a-time
+    functions when encrypting and decrypting the given blocks. */
+bool checkKernel( SliceKernel kernel, int blocks, TDESContext const *ctx, byte const input[] )
+{
+  byte cipher[ SLICE_TEST_BLOCKS * BLOCK_BYTES ];
+  byte plain[ SLICE_TEST_BLOCKS * BLOCK_BYTES ];
+  kernel( ctx, cipher, input, false );
+  kernel( ctx, plain, cipher, true );
+  for ( int i = 0; i < blocks; i++ ) {
+    if ( loadBlock( cipher + i * BLOCK_BYTES ) !=
+         tdesEncryptBlock64( ctx, loadBlock( input + i * BLOCK_BYTES ) ) )
+      return false;
+  }
+  return cmpBytes( plain, input, blocks * BLOCK_BYTES );
+}
+
+/** Return the next value from a simple pseudo-random sequence, so
+    tests can compare two implementations on lots of inputs. */
+uint64_t nextRandom( uint64_t *state )
+{
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return *state ^ ( *state >> 29 );
+}
+
+/** Return true if the given kernel with a key for each block agrees with
+    tdesInit() and the one-block-at-a-time functions, for the given keys. */
+bool checkKeysKernel( SliceKeysKernel kernel, int blocks, byte const keys[], byte const input[] )
+{
+  byte const *lanes[ SLICE_TEST_BLOCKS ];
+  for ( int i = 0; i < SLICE_TEST_BLOCKS; i++ )
+    lanes[ i ] = keys + i * TDES_KEY_BYTES;
+  byte cipher[ SLICE_TEST_BLOCKS * BLOCK_BYTES ];
+  byte plain[ SLICE_TEST_BLOCKS * BLOCK_BYTES ];
+  kernel( lanes, cipher, input, false );
+  kernel( lanes, plain, cipher, true );
+  for ( int i = 0; i < blocks; i++ ) {
+    TDESContext ctx;
+    tdesInit( &ctx, lanes[ i ], TDES_KEY_BYTES );
+    if ( loadBlock( cipher + i * BLOCK_BYTES ) !=
+         tdesEncryptBlock64( &ctx, loadBlock( input + i * BLOCK_BYTES ) ) )
+      return false;
+  }
+  return cmpBytes( plain, input, blocks * BLOCK_BYTES );
+}
+
 int main()
 {
   // As you finish parts of your implementation, move this directive
@@ -122,6 +192,51 @@ int main()
     TestCase( output[ 1 ] == 0xC0 );
   }
 
+  ////////////////////////////////////////////////////////////////////////
+  // Test compilePerm() and applyPerm()
+
+  {
+    // Same permutation as the first permute() test.
+    int perm[ 16 ] = { 7, 14, 12, 13, 1, 6, 11, 8, 4, 16, 15, 10, 3, 5, 9, 2 };
+    static CompiledPerm cp;
+
+    compilePerm( &cp, perm, 16 );
+    TestCase( applyPerm( &cp, 0xBCD6ULL << 48 ) == 0x6CBE );
+  }
+
+  {
+    // The compiled final permutation and subkey permutation should agree
+    // with permute() on lots of inputs.
+    static CompiledPerm finalCp, subkeyCp;
+    compilePerm( &finalCp, finalPerm, BLOCK_BITS );
+    compilePerm( &subkeyCp, subkeyPerm, SUBKEY_BITS );
+
+    uint64_t state = 2;
+    bool finalSame = true, subkeySame = true;
+    for ( int i = 0; i < 10000; i++ ) {
+      byte input[ 8 ], output[ 8 ];
+      uint64_t r = nextRandom( &state );
+      for ( int j = 0; j < 8; j++ )
+        input[ j ] = r >> ( j * 8 );
+
+      permute( output, input, finalPerm, BLOCK_BITS );
+      if ( applyPerm( &finalCp, packBytes( input, 8 ) ) != packBytes( output, 8 ) )
+        finalSame = false;
+      permute( output, input, subkeyPerm, SUBKEY_BITS );
+      if ( applyPerm( &subkeyCp, packBytes( input, 8 ) ) != packBytes( output, 6 ) )
+        subkeySame = false;
+    }
+    TestCase( finalSame );
+    TestCase( subkeySame );
+
+    // The tables written by gentables should be the same as compiling them here.
+    TestCase( memcmp( &finalCp, &finalPermTable, sizeof( finalCp ) ) == 0 &&
+              memcmp( &subkeyCp, &subkeyPermTable, sizeof( subkeyCp ) ) == 0 );
+
+    // C and D go all the way around by the last round.
+    TestCase( subkeyRotation[ 1 ] == 1 && subkeyRotation[ ROUND_COUNT - 1 ] == HALF_SUBKEY_BITS );
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // Test generateSubkeys()
 
@@ -213,6 +328,34 @@ int main()
     TestCase( cmpBytes( result, (byte []){ 0x23, 0x4A, 0xA9, 0xBB }, 4 ) );
   }
 
+  ////////////////////////////////////////////////////////////////////////
+  // Test fFunction32()
+
+  {
+    // Same example as above, using words instead of byte arrays.
+    TestCase( fFunction32( 0xF0AAF0AA, 0x1B02EFFC7072ULL ) == 0x234AA9BB );
+  }
+
+  {
+    // The table-driven version should agree with the reference
+    // fFunction() on lots of inputs.
+    uint64_t state = 1;
+    bool same = true;
+    for ( int i = 0; i < 10000; i++ ) {
+      byte R[ 4 ], subkey[ 6 ], result[ 4 ];
+      uint64_t r = nextRandom( &state );
+      for ( int j = 0; j < 4; j++ )
+        R[ j ] = r >> ( j * 8 );
+      for ( int j = 0; j < 6; j++ )
+        subkey[ j ] = r >> ( 32 + j * 5 );
+
+      fFunction( result, R, subkey );
+      if ( fFunction32( packBytes( R, 4 ), packBytes( subkey, 6 ) ) != packBytes( result, 4 ) )
+        same = false;
+    }
+    TestCase( same );
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // Test encryptBlock()
 
@@ -387,6 +530,50 @@ int main()
     TestCase( cmpBytes( block, expected, sizeof( block ) ) );
   }
 
+  ////////////////////////////////////////////////////////////////////////
+  // Test encryptBlock64() and decryptBlock64()
+
+  {
+    // Same example shown in the DES Algorithm Illustrated article.
+    byte key[ BLOCK_BYTES ] = { 0x13, 0x34, 0x57, 0x79, 0x9B, 0xBC, 0xDF, 0xF1 };
+
+    byte K[ ROUND_COUNT ][ SUBKEY_BYTES ];
+    generateSubkeys( K, key );
+    TDESSchedule sched;
+    loadSchedule( &sched, K );
+
+    TestCase( encryptBlock64( 0x0123456789ABCDEFULL, &sched ) == 0x85E813540F0AB405ULL );
+    TestCase( decryptBlock64( 0x85E813540F0AB405ULL, &sched ) == 0x0123456789ABCDEFULL );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test scheduleKey()
+
+  {
+    // K_1 from the DES Algorithm Illustrated article, split into its groups.
+    byte key[ BLOCK_BYTES ] = { 0x13, 0x34, 0x57, 0x79, 0x9B, 0xBC, 0xDF, 0xF1 };
+    TDESSchedule sched;
+    scheduleKey( &sched, key );
+    TestCase( sched.K[ 1 ] == 0x1B02EFFC7072ULL && sched.split[ 1 ][ 0 ] == 0x060B3F01 &&
+              sched.split[ 1 ][ 1 ] == 0x302F0732 );
+
+    // The same schedule as the reference version, for any key.
+    bool same = true;
+    uint64_t state = 11;
+    for ( int i = 0; i < 100; i++ ) {
+      for ( int j = 0; j < BLOCK_BYTES; j++ )
+        key[ j ] = nextRandom( &state );
+      byte K[ ROUND_COUNT ][ SUBKEY_BYTES ];
+      generateSubkeys( K, key );
+      TDESSchedule expected;
+      loadSchedule( &expected, K );
+      scheduleKey( &sched, key );
+      if ( memcmp( &sched, &expected, sizeof( sched ) ) != 0 )
+        same = false;
+    }
+    TestCase( same );
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // Test encryptTDES()
 
@@ -489,6 +676,816 @@ int main()
     free( result );
   }
   
+  ////////////////////////////////////////////////////////////////////////
+  // Test tdesInit(), tdesEncrypt() and tdesDecrypt()
+
+  {
+    // Same key as test 01, used for several calls.
+    byte key[] = { 0x54, 0x68, 0x69, 0x73, 0x20, 0x6B, 0x65, 0x79,
+      0x20, 0x69, 0x73, 0x20, 0x6A, 0x75, 0x73, 0x74,
+      0x20, 0x61, 0x73, 0x63, 0x69, 0x69, 0x2E, 0x0A };
+    byte buffer[] = { 0x73, 0x69, 0x6D, 0x70, 0x6C, 0x65, 0x0A };
+    byte expected[] = { 0x35, 0x80, 0x10, 0x52, 0x02, 0x61, 0x46, 0x5E };
+
+    TDESContext ctx;
+    TestCase( !tdesInit( &ctx, key, sizeof( key ) - 1 ) );
+    TestCase( tdesInit( &ctx, key, sizeof( key ) ) );
+
+    int n;
+    byte *result = tdesEncrypt( &ctx, NULL, buffer, sizeof( buffer ), &n );
+    TestCase( n == sizeof( expected ) && cmpBytes( result, expected, sizeof( expected ) ) );
+    free( result );
+
+    result = tdesEncrypt( &ctx, NULL, buffer, sizeof( buffer ), &n );
+    TestCase( n == sizeof( expected ) && cmpBytes( result, expected, sizeof( expected ) ) );
+    free( result );
+
+    result = tdesDecrypt( &ctx, NULL, expected, sizeof( expected ), &n );
+    TestCase( n == sizeof( buffer ) && cmpBytes( result, buffer, sizeof( buffer ) ) );
+    free( result );
+
+    // The fused block functions should match three separate DES passes.
+    byte K1[ ROUND_COUNT ][ SUBKEY_BYTES ], K2[ ROUND_COUNT ][ SUBKEY_BYTES ],
+      K3[ ROUND_COUNT ][ SUBKEY_BYTES ];
+    generateSubkeys( K1, key );
+    generateSubkeys( K2, key + 8 );
+    generateSubkeys( K3, key + 16 );
+    uint64_t state = 3;
+    bool same = true;
+    for ( int i = 0; i < 1000; i++ ) {
+      byte block[ 8 ];
+      uint64_t r = nextRandom( &state );
+      for ( int j = 0; j < 8; j++ )
+        block[ j ] = r >> ( j * 8 );
+
+      uint64_t value = packBytes( block, 8 );
+      encryptBlock( block, K1 );
+      decryptBlock( block, K2 );
+      encryptBlock( block, K3 );
+      uint64_t cipher = tdesEncryptBlock64( &ctx, value );
+      if ( cipher != packBytes( block, 8 ) || tdesDecryptBlock64( &ctx, cipher ) != value )
+        same = false;
+    }
+    TestCase( same );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the bitsliced engine and tdesCryptBlocks()
+
+  {
+    byte key[] = { 0x73, 0x75, 0x70, 0x65, 0x72, 0x0A, 0x73, 0x65,
+      0x63, 0x72, 0x65, 0x74, 0x0A, 0x63, 0x72, 0x79,
+      0x70, 0x74, 0x6F, 0x0A, 0x6B, 0x65, 0x79, 0x0A };
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+
+    byte input[ SLICE_TEST_BLOCKS * BLOCK_BYTES ];
+    uint64_t state = 4;
+    for ( int i = 0; i < sizeof( input ); i++ )
+      input[ i ] = nextRandom( &state );
+
+    // The 64 and 128-block kernels run on any x86-64 CPU, and the
+    // selected one is whatever passed its self-test at startup.
+    TestCase( checkKernel( bitsliceTDES64, 64, &ctx, input ) );
+    TestCase( checkKernel( bitsliceTDES128, 128, &ctx, input ) );
+    TestCase( checkKernel( engineCrypt, engineBlocks(), &ctx, input ) );
+
+    // A count that isn't a whole number of batches uses both engines.
+    byte output[ SLICE_TEST_BLOCKS * BLOCK_BYTES ];
+    bool same = true;
+    tdesCryptBlocks( &ctx, output, input, SLICE_TEST_BLOCKS, false );
+    for ( int i = 0; i < SLICE_TEST_BLOCKS; i++ )
+      if ( loadBlock( output + i * BLOCK_BYTES ) !=
+           tdesEncryptBlock64( &ctx, loadBlock( input + i * BLOCK_BYTES ) ) )
+        same = false;
+    TestCase( same );
+  }
+
+  {
+    // Encrypting with a pool of threads should give the same result as
+    // one thread, for a buffer that's several chunks long.
+    byte key[] = { 0x54, 0x68, 0x69, 0x73, 0x20, 0x6B, 0x65, 0x79,
+      0x20, 0x69, 0x73, 0x20, 0x6A, 0x75, 0x73, 0x74,
+      0x20, 0x61, 0x73, 0x63, 0x69, 0x69, 0x2E, 0x0A };
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+
+    int len = 200000;
+    byte *input = malloc( len );
+    uint64_t state = 5;
+    for ( int i = 0; i < len; i++ )
+      input[ i ] = nextRandom( &state );
+
+    Pool *pool = poolCreate( 3 );
+    int n1, n2, n3;
+    byte *serial = tdesEncrypt( &ctx, NULL, input, len, &n1 );
+    byte *parallel = tdesEncrypt( &ctx, pool, input, len, &n2 );
+    byte *plain = tdesDecrypt( &ctx, pool, parallel, n2, &n3 );
+    TestCase( n1 == n2 && cmpBytes( serial, parallel, n1 ) &&
+              n3 == len && cmpBytes( plain, input, len ) );
+    poolDestroy( pool );
+    free( input );
+    free( serial );
+    free( parallel );
+    free( plain );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the streaming functions
+
+  {
+    byte key[] = { 0x54, 0x68, 0x69, 0x73, 0x20, 0x6B, 0x65, 0x79,
+      0x20, 0x69, 0x73, 0x20, 0x6A, 0x75, 0x73, 0x74,
+      0x20, 0x61, 0x73, 0x63, 0x69, 0x69, 0x2E, 0x0A };
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+
+    int len = 5000;
+    byte input[ 5000 ];
+    uint64_t state = 6;
+    for ( int i = 0; i < len; i++ )
+      input[ i ] = nextRandom( &state );
+
+    int n;
+    byte *expected = tdesEncrypt( &ctx, NULL, input, len, &n );
+
+    // Feed the input in pieces of different sizes.
+    byte cipher[ 5000 + 2 * BLOCK_BYTES ];
+    size_t outLen = 0, finalLen;
+    TDESStream stream;
+    streamInit( &stream, &ctx, NULL, false, MODE_ECB, NULL );
+    for ( int pos = 0, piece = 1; pos < len; pos += piece, piece = piece % 37 + 1 ) {
+      if ( piece > len - pos )
+        piece = len - pos;
+      outLen += streamUpdate( &stream, cipher + outLen, input + pos, piece );
+    }
+    streamFinal( &stream, cipher + outLen, &finalLen );
+    outLen += finalLen;
+    TestCase( outLen == n && cmpBytes( cipher, expected, n ) );
+
+    // Decrypt it the same way.
+    byte plain[ 5000 + 2 * BLOCK_BYTES ];
+    outLen = 0;
+    streamInit( &stream, &ctx, NULL, true, MODE_ECB, NULL );
+    for ( int pos = 0, piece = 8; pos < n; pos += piece, piece = piece % 29 + 1 ) {
+      if ( piece > n - pos )
+        piece = n - pos;
+      outLen += streamUpdate( &stream, plain + outLen, cipher + pos, piece );
+    }
+    int status = streamFinal( &stream, plain + outLen, &finalLen );
+    outLen += finalLen;
+    TestCase( status == TDES_OK && outLen == len && cmpBytes( plain, input, len ) );
+
+    // Data that isn't a whole number of blocks.
+    streamInit( &stream, &ctx, NULL, true, MODE_ECB, NULL );
+    streamUpdate( &stream, plain, cipher, n - 1 );
+    TestCase( streamFinal( &stream, plain, &finalLen ) == TDES_ERR_LENGTH );
+
+    // Data that doesn't end with valid padding.
+    byte bad[ BLOCK_BYTES ] = { 0 };
+    tdesCryptBlocks( &ctx, bad, bad, 1, false );
+    streamInit( &stream, &ctx, NULL, true, MODE_ECB, NULL );
+    streamUpdate( &stream, plain, bad, BLOCK_BYTES );
+    TestCase( streamFinal( &stream, plain, &finalLen ) == TDES_ERR_PADDING );
+    free( expected );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test tdesEncryptInto() and tdesDecryptInto()
+
+  {
+    byte key[] = { 0x54, 0x68, 0x69, 0x73, 0x20, 0x6B, 0x65, 0x79,
+      0x20, 0x69, 0x73, 0x20, 0x6A, 0x75, 0x73, 0x74,
+      0x20, 0x61, 0x73, 0x63, 0x69, 0x69, 0x2E, 0x0A };
+    byte expected[] = { 0x35, 0x80, 0x10, 0x52, 0x02, 0x61, 0x46, 0x5E };
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+
+    // Encrypt in place, with room left for the padding.
+    byte buffer[ 16 ] = { 0x73, 0x69, 0x6D, 0x70, 0x6C, 0x65, 0x0A };
+    size_t outLen;
+    TestCase( tdesEncryptInto( &ctx, NULL, buffer, sizeof( buffer ), buffer, 7, &outLen )
+              == TDES_OK && outLen == 8 && cmpBytes( buffer, expected, 8 ) );
+
+    // Decrypt in place.
+    TestCase( tdesDecryptInto( &ctx, NULL, buffer, sizeof( buffer ), buffer, 8, &outLen )
+              == TDES_OK && outLen == 7 && cmpBytes( buffer, (byte *) "simple\n", 7 ) );
+
+    // Not enough room for the padding.
+    TestCase( tdesEncryptInto( &ctx, NULL, buffer, 8, buffer, 8, &outLen ) == TDES_ERR_SPACE );
+    TestCase( tdesDecryptInto( &ctx, NULL, buffer, 7, expected, 8, &outLen ) == TDES_ERR_SPACE );
+
+    // Bad ciphertext.
+    TestCase( tdesDecryptInto( &ctx, NULL, buffer, sizeof( buffer ), expected, 7, &outLen )
+              == TDES_ERR_LENGTH );
+    byte bad[ BLOCK_BYTES ] = { 0 };
+    tdesCryptBlocks( &ctx, bad, bad, 1, false );
+    TestCase( tdesDecryptInto( &ctx, NULL, buffer, sizeof( buffer ), bad, 8, &outLen )
+              == TDES_ERR_PADDING );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the CBC and CTR modes
+
+  {
+    byte key[] = { 0x54, 0x68, 0x69, 0x73, 0x20, 0x6B, 0x65, 0x79,
+      0x20, 0x69, 0x73, 0x20, 0x6A, 0x75, 0x73, 0x74,
+      0x20, 0x61, 0x73, 0x63, 0x69, 0x69, 0x2E, 0x0A };
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+    Pool *pool = poolCreate( 3 );
+
+    TestCase( modeParse( "cbc" ) == MODE_CBC && modeParse( "ctr" ) == MODE_CTR &&
+              modeParse( "ecb" ) == MODE_ECB && modeParse( "xts" ) == -1 );
+
+    // Enough blocks for several chunks, and not a whole number of them.
+    size_t blocks = 2 * CHUNK_BLOCKS + 77;
+    byte *input = malloc( blocks * BLOCK_BYTES );
+    byte *cipher = malloc( blocks * BLOCK_BYTES );
+    byte *plain = malloc( blocks * BLOCK_BYTES );
+    uint64_t state = 7;
+    for ( size_t i = 0; i < blocks * BLOCK_BYTES; i++ )
+      input[ i ] = nextRandom( &state );
+
+    // CBC encryption, checked against chaining one block at a time.
+    uint64_t iv = 0x0123456789ABCDEFULL;
+    uint64_t last = cbcEncrypt( &ctx, cipher, input, blocks, iv );
+    bool same = true;
+    uint64_t chain = iv;
+    for ( size_t i = 0; i < blocks; i++ ) {
+      chain = tdesEncryptBlock64( &ctx, loadBlock( input + i * BLOCK_BYTES ) ^ chain );
+      if ( loadBlock( cipher + i * BLOCK_BYTES ) != chain )
+        same = false;
+    }
+    TestCase( same && last == chain );
+
+    // CBC decryption with threads, in two calls and then in place.
+    uint64_t next = cbcDecrypt( &ctx, pool, plain, cipher, 100, iv );
+    cbcDecrypt( &ctx, pool, plain + 100 * BLOCK_BYTES, cipher + 100 * BLOCK_BYTES,
+                blocks - 100, next );
+    TestCase( cmpBytes( plain, input, blocks * BLOCK_BYTES ) );
+    memcpy( plain, cipher, blocks * BLOCK_BYTES );
+    TestCase( cbcDecrypt( &ctx, pool, plain, plain, blocks, iv ) == last &&
+              cmpBytes( plain, input, blocks * BLOCK_BYTES ) );
+
+    // CTR, with a piece from the middle matching the whole thing.
+    size_t len = blocks * BLOCK_BYTES - 3;
+    ctrCrypt( &ctx, pool, cipher, input, len, iv, 0 );
+    TestCase( loadBlock( cipher ) == ( loadBlock( input ) ^ tdesEncryptBlock64( &ctx, iv ) ) );
+    ctrCrypt( &ctx, NULL, plain, cipher + 1001, len - 2000, iv, 1001 );
+    TestCase( cmpBytes( plain, input + 1001, len - 2000 ) );
+
+    // Streams in both modes, a piece at a time.
+    same = true;
+    for ( int mode = MODE_CBC; mode <= MODE_CTR; mode++ ) {
+      byte ivBytes[ BLOCK_BYTES ] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+      size_t total = 0, finalLen;
+      TDESStream stream;
+      streamInit( &stream, &ctx, pool, false, mode, ivBytes );
+      for ( size_t pos = 0, piece = 5; pos < 3000; pos += piece, piece = piece * 3 % 97 ) {
+        if ( piece > 3000 - pos )
+          piece = 3000 - pos;
+        total += streamUpdate( &stream, cipher + total, input + pos, piece );
+      }
+      streamFinal( &stream, cipher + total, &finalLen );
+      total += finalLen;
+      if ( total != modeOutputLen( mode, false, 3000 ) || !cmpBytes( cipher, ivBytes, BLOCK_BYTES ) )
+        same = false;
+
+      size_t plainLen = 0;
+      streamInit( &stream, &ctx, NULL, true, mode, NULL );
+      for ( size_t pos = 0, piece = 3; pos < total; pos += piece, piece = piece * 5 % 89 ) {
+        if ( piece > total - pos )
+          piece = total - pos;
+        plainLen += streamUpdate( &stream, plain + plainLen, cipher + pos, piece );
+      }
+      if ( streamFinal( &stream, plain + plainLen, &finalLen ) != TDES_OK ||
+           plainLen + finalLen != 3000 || !cmpBytes( plain, input, 3000 ) )
+        same = false;
+    }
+    TestCase( same );
+
+    // Blocks from the middle, decrypted on their own in each mode.
+    same = true;
+    for ( int mode = MODE_ECB; mode <= MODE_CTR; mode++ ) {
+      if ( mode == MODE_CBC )
+        cbcEncrypt( &ctx, cipher, input, blocks, iv );
+      else if ( mode == MODE_CTR )
+        ctrCrypt( &ctx, NULL, cipher, input, blocks * BLOCK_BYTES, iv, 0 );
+      else
+        tdesCryptBlocks( &ctx, cipher, input, blocks, false );
+      uint64_t chain = mode == MODE_CBC ? loadBlock( cipher + 4999 * BLOCK_BYTES ) : iv;
+      modeDecryptAt( &ctx, pool, mode, plain, cipher + 5000 * BLOCK_BYTES, 9000, 5000, chain );
+      if ( !cmpBytes( plain, input + 5000 * BLOCK_BYTES, 9000 * BLOCK_BYTES ) )
+        same = false;
+    }
+    TestCase( same );
+
+    free( input );
+    free( cipher );
+    free( plain );
+    poolDestroy( pool );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test containerWrite() and containerRead()
+
+  {
+    byte key[] = { 0x54, 0x68, 0x69, 0x73, 0x20, 0x6B, 0x65, 0x79,
+      0x20, 0x69, 0x73, 0x20, 0x6A, 0x75, 0x73, 0x74,
+      0x20, 0x61, 0x73, 0x63, 0x69, 0x69, 0x2E, 0x0A };
+    byte iv[ BLOCK_BYTES ] = { 9, 8, 7, 6, 5, 4, 3, 2 };
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+    Pool *pool = poolCreate( 3 );
+
+    // A few chunks, with a short one at the end.
+    size_t len = 3 * CONTAINER_CHUNK_BYTES + 1234;
+    byte *input = malloc( len );
+    byte *output = malloc( len );
+    uint64_t state = 8;
+    for ( size_t i = 0; i < len; i++ )
+      input[ i ] = nextRandom( &state );
+    FILE *plain = tmpfile();
+    fwrite( input, 1, len, plain );
+
+    // Every mode, all of it and then a piece across a chunk boundary.
+    bool same = true;
+    for ( int mode = MODE_ECB; mode <= MODE_CTR; mode++ ) {
+      FILE *sealed = tmpfile();
+      FILE *opened = tmpfile();
+      rewind( plain );
+      if ( containerWrite( plain, sealed, &ctx, pool, mode, iv, CONTAINER_UNKNOWN_LEN, false ) != TDES_OK ||
+           containerRead( sealed, opened, &ctx, pool, 0, UINT64_MAX ) != TDES_OK ||
+           !readAt( opened, 0, output, len ) || !cmpBytes( output, input, len ) )
+        same = false;
+      fclose( opened );
+
+      opened = tmpfile();
+      if ( containerRead( sealed, opened, &ctx, NULL, CONTAINER_CHUNK_BYTES - 5, 100 ) != TDES_OK ||
+           !readAt( opened, 0, output, 100 ) ||
+           !cmpBytes( output, input + CONTAINER_CHUNK_BYTES - 5, 100 ) )
+        same = false;
+      fclose( opened );
+      fclose( sealed );
+    }
+    TestCase( same );
+
+    // Plain ciphertext isn't a container.
+    TestCase( containerRead( plain, stdout, &ctx, NULL, 0, UINT64_MAX ) == TDES_ERR_FORMAT );
+
+    // The last chunk with its last block, and so its padding, replaced.
+    FILE *sealed = tmpfile();
+    rewind( plain );
+    containerWrite( plain, sealed, &ctx, NULL, MODE_ECB, NULL, len, false );
+    byte zero[ BLOCK_BYTES ] = { 0 };
+    fseek( sealed, 32 + 3 * ( CONTAINER_CHUNK_BYTES + BLOCK_BYTES ) + 1232, SEEK_SET );
+    fwrite( zero, 1, BLOCK_BYTES, sealed );
+    FILE *opened = tmpfile();
+    TestCase( containerRead( sealed, opened, &ctx, NULL, 0, UINT64_MAX ) == TDES_ERR_PADDING );
+    fclose( opened );
+    fclose( sealed );
+
+    fclose( plain );
+    free( input );
+    free( output );
+    poolDestroy( pool );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test keys that reduce to single DES
+
+  {
+    byte key[ TDES_KEY_BYTES ];
+    byte input[ SLICE_TEST_BLOCKS * BLOCK_BYTES ];
+    uint64_t state = 9;
+    for ( int i = 0; i < SLICE_TEST_BLOCKS * BLOCK_BYTES; i++ )
+      input[ i ] = nextRandom( &state );
+
+    // K1 == K2 leaves K3, and K2 == K3 leaves K1.  Both should match three passes.
+    bool same = true;
+    for ( int copy = 0; copy < 2; copy++ ) {
+      // K1 copied over K2 the first time, and K2 over K3 the second
+      for ( int i = 0; i < TDES_KEY_BYTES; i++ )
+        key[ i ] = nextRandom( &state );
+      memcpy( key + ( copy + 1 ) * BLOCK_BYTES, key + copy * BLOCK_BYTES, BLOCK_BYTES );
+      TDESContext ctx;
+      tdesInit( &ctx, key, sizeof( key ) );
+      if ( ctx.singleKey != ( copy == 0 ? 2 : 0 ) )
+        same = false;
+      for ( int i = 0; i < SLICE_TEST_BLOCKS; i++ ) {
+        uint64_t block = loadBlock( input + i * BLOCK_BYTES );
+        uint64_t expected = encryptBlock64( decryptBlock64( encryptBlock64( block, &ctx.enc[ 0 ] ),
+                                            &ctx.enc[ 1 ] ), &ctx.enc[ 2 ] );
+        if ( tdesEncryptBlock64( &ctx, block ) != expected ||
+             tdesDecryptBlock64( &ctx, expected ) != block )
+          same = false;
+      }
+      if ( !checkKernel( engineCrypt, engineBlocks(), &ctx, input ) )
+        same = false;
+    }
+    TestCase( same );
+
+    // Keys that only differ in their parity bits are the same DES key.
+    for ( int i = 0; i < TDES_KEY_BYTES; i++ )
+      key[ i ] = nextRandom( &state );
+    memcpy( key + BLOCK_BYTES, key, BLOCK_BYTES );
+    key[ BLOCK_BYTES ] ^= 1;
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+    TestCase( ctx.singleKey == 2 );
+
+    // A key with three different parts takes all three passes.
+    key[ BLOCK_BYTES ] ^= 2;
+    tdesInit( &ctx, key, sizeof( key ) );
+    TestCase( ctx.singleKey == NO_SINGLE_KEY );
+
+    // Single DES known answer, with the same key three times.
+    byte desKey[] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF };
+    for ( int part = 0; part < NUM_KEY_PARTS; part++ )
+      memcpy( key + part * BLOCK_BYTES, desKey, BLOCK_BYTES );
+    tdesInit( &ctx, key, sizeof( key ) );
+    TestCase( tdesEncryptBlock64( &ctx, 0x4E6F772069732074ULL ) == 0x3FA40E8A984D4815ULL );
+
+    // Through the bitsliced kernel too.
+    byte block[ SLICE_TEST_BLOCKS * BLOCK_BYTES ];
+    for ( int i = 0; i < SLICE_TEST_BLOCKS; i++ )
+      storeBlock( block + i * BLOCK_BYTES, 0x4E6F772069732074ULL );
+    tdesCryptBlocks( &ctx, block, block, SLICE_TEST_BLOCKS, false );
+    TestCase( loadBlock( block ) == 0x3FA40E8A984D4815ULL &&
+              loadBlock( block + ( SLICE_TEST_BLOCKS - 1 ) * BLOCK_BYTES ) == 0x3FA40E8A984D4815ULL );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the kernels with a key for each block, and batches of records
+
+  {
+    static byte keys[ SLICE_TEST_BLOCKS * TDES_KEY_BYTES ];
+    byte input[ SLICE_TEST_BLOCKS * BLOCK_BYTES ];
+    uint64_t state = 21;
+    for ( int i = 0; i < SLICE_TEST_BLOCKS * TDES_KEY_BYTES; i++ )
+      keys[ i ] = nextRandom( &state );
+    for ( int i = 0; i < SLICE_TEST_BLOCKS * BLOCK_BYTES; i++ )
+      input[ i ] = nextRandom( &state );
+    // one key that reduces to single DES, which still takes three passes here
+    memcpy( keys + 5 * TDES_KEY_BYTES + BLOCK_BYTES, keys + 5 * TDES_KEY_BYTES, BLOCK_BYTES );
+
+    TestCase( checkKeysKernel( bitsliceKeysTDES64, 64, keys, input ) );
+    TestCase( checkKeysKernel( bitsliceKeysTDES128, 128, keys, input ) );
+    TestCase( checkKeysKernel( engineCryptKeys, engineBlocks(), keys, input ) );
+
+    // More records than one thread gets at a time, each with its own key
+    // and length, and every other one done in place.
+    #define RECORD_TEST_COUNT 2500
+    #define RECORD_TEST_BYTES 40
+    static TDESRecord records[ RECORD_TEST_COUNT ];
+    static byte data[ RECORD_TEST_COUNT ][ RECORD_TEST_BYTES ];
+    static byte cipher[ RECORD_TEST_COUNT ][ RECORD_TEST_BYTES + BLOCK_BYTES ];
+    static byte recordKeys[ RECORD_TEST_COUNT ][ TDES_KEY_BYTES ];
+    static size_t lengths[ RECORD_TEST_COUNT ];
+    for ( int r = 0; r < RECORD_TEST_COUNT; r++ ) {
+      for ( int i = 0; i < TDES_KEY_BYTES; i++ )
+        recordKeys[ r ][ i ] = nextRandom( &state );
+      for ( int i = 0; i < RECORD_TEST_BYTES; i++ )
+        data[ r ][ i ] = nextRandom( &state );
+      size_t len = lengths[ r ] = nextRandom( &state ) % ( RECORD_TEST_BYTES + 1 );
+      if ( r % 2 == 1 )
+        memcpy( cipher[ r ], data[ r ], len );
+      records[ r ] = ( TDESRecord ){ recordKeys[ r ], r % 2 == 1 ? cipher[ r ] : data[ r ], len,
+                                     cipher[ r ], sizeof( cipher[ r ] ), 0, -1 };
+    }
+    Pool *pool = poolCreate( 3 );
+    tdesEncryptRecords( pool, records, RECORD_TEST_COUNT );
+    bool same = true;
+    for ( int r = 0; r < RECORD_TEST_COUNT; r++ ) {
+      TDESContext ctx;
+      tdesInit( &ctx, recordKeys[ r ], TDES_KEY_BYTES );
+      byte expected[ RECORD_TEST_BYTES + BLOCK_BYTES ];
+      size_t len;
+      tdesEncryptInto( &ctx, NULL, expected, sizeof( expected ), data[ r ], lengths[ r ], &len );
+      if ( records[ r ].status != TDES_OK || records[ r ].outLen != len ||
+           !cmpBytes( cipher[ r ], expected, len ) )
+        same = false;
+    }
+    TestCase( same );
+
+    // Decrypting them in place, without a pool, gives the records back.
+    for ( int r = 0; r < RECORD_TEST_COUNT; r++ ) {
+      records[ r ].in = cipher[ r ];
+      records[ r ].inLen = records[ r ].outLen;
+    }
+    tdesDecryptRecords( NULL, records, RECORD_TEST_COUNT );
+    same = true;
+    for ( int r = 0; r < RECORD_TEST_COUNT; r++ ) {
+      if ( records[ r ].status != TDES_OK || records[ r ].outLen != lengths[ r ] ||
+           !cmpBytes( cipher[ r ], data[ r ], records[ r ].outLen ) )
+        same = false;
+    }
+    TestCase( same );
+
+    // Bad records get their own status without stopping the others.
+    byte text[] = "Good record";
+    byte encrypted[ 2 * BLOCK_BYTES ];
+    TDESRecord good = { recordKeys[ 0 ], text, 11, encrypted, sizeof( encrypted ), 0, -1 };
+    tdesEncryptRecords( NULL, &good, 1 );
+    // a block that decrypts to one ending in zero, which isn't valid padding
+    TDESContext ctx;
+    tdesInit( &ctx, recordKeys[ 1 ], TDES_KEY_BYTES );
+    byte badPad[ BLOCK_BYTES ];
+    storeBlock( badPad, tdesEncryptBlock64( &ctx, 0x0102030405060700ULL ) );
+    byte plain[ 4 ][ RECORD_TEST_BYTES ];
+    TDESRecord bad[ 4 ] = {
+      { recordKeys[ 0 ], encrypted, 5, plain[ 0 ], RECORD_TEST_BYTES, 0, -1 },
+      { recordKeys[ 0 ], encrypted, 16, plain[ 1 ], BLOCK_BYTES, 0, -1 },
+      { recordKeys[ 0 ], encrypted, 16, plain[ 2 ], RECORD_TEST_BYTES, 0, -1 },
+      { recordKeys[ 1 ], badPad, BLOCK_BYTES, plain[ 3 ], RECORD_TEST_BYTES, 0, -1 },
+    };
+    tdesDecryptRecords( pool, bad, 4 );
+    TestCase( bad[ 0 ].status == TDES_ERR_LENGTH && bad[ 1 ].status == TDES_ERR_SPACE &&
+              bad[ 2 ].status == TDES_OK && bad[ 2 ].outLen == 11 &&
+              cmpBytes( plain[ 2 ], text, 11 ) && bad[ 3 ].status == TDES_ERR_PADDING );
+    poolDestroy( pool );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the ring and the pipeline
+
+  {
+    // Items come out in the order they went in, around the ring more than once.
+    Ring ring;
+    TestCase( ringInit( &ring ) );
+    int items[ RING_SLOTS ];
+    bool same = true;
+    for ( int pass = 0; pass < 3; pass++ ) {
+      for ( int i = 0; i < RING_SLOTS; i++ )
+        ringPush( &ring, &items[ i ] );
+      for ( int i = 0; i < RING_SLOTS; i++ )
+        if ( ringPop( &ring ) != &items[ i ] )
+          same = false;
+    }
+    ringPush( &ring, NULL );
+    TestCase( same && ringPop( &ring ) == NULL );
+    ringDestroy( &ring );
+  }
+
+  {
+    byte key[] = { 0x54, 0x68, 0x69, 0x73, 0x20, 0x6B, 0x65, 0x79,
+      0x20, 0x69, 0x73, 0x20, 0x6A, 0x75, 0x73, 0x74,
+      0x20, 0x61, 0x73, 0x63, 0x69, 0x69, 0x2E, 0x0A };
+    byte iv[ BLOCK_BYTES ] = { 1, 3, 5, 7, 9, 11, 13, 15 };
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+    Pool *pool = poolCreate( 2 );
+
+    // More buffers than the pipeline has, with a short one at the end.
+    size_t len = ( 2 * PIPELINE_BUFFERS + 1 ) * PIPELINE_BYTES + 1234;
+    size_t cap = tdesPaddedLen( len );
+    byte *input = malloc( len );
+    byte *expected = malloc( cap );
+    byte *output = malloc( cap );
+    uint64_t state = 10;
+    for ( size_t i = 0; i < len; i++ )
+      input[ i ] = nextRandom( &state );
+    FILE *plain = tmpfile();
+    fwrite( input, 1, len, plain );
+    rewind( plain );
+
+    // The same as encrypting it all at once.
+    FILE *cipher = tmpfile();
+    TDESStream stream;
+    streamInit( &stream, &ctx, pool, false, MODE_ECB, NULL );
+    size_t expectedLen;
+    tdesEncryptInto( &ctx, NULL, expected, cap, input, len, &expectedLen );
+    TestCase( pipelineRun( plain, cipher, &stream ) == TDES_OK && ftell( cipher ) == expectedLen &&
+              readAt( cipher, 0, output, expectedLen ) && cmpBytes( output, expected, expectedLen ) );
+    fclose( cipher );
+
+    // CBC there and back.
+    cipher = tmpfile();
+    rewind( plain );
+    streamInit( &stream, &ctx, pool, false, MODE_CBC, iv );
+    bool ok = pipelineRun( plain, cipher, &stream ) == TDES_OK;
+    FILE *opened = tmpfile();
+    rewind( cipher );
+    streamInit( &stream, &ctx, NULL, true, MODE_CBC, iv );
+    TestCase( ok && pipelineRun( cipher, opened, &stream ) == TDES_OK && ftell( opened ) == len &&
+              readAt( opened, 0, output, len ) && cmpBytes( output, input, len ) );
+    fclose( opened );
+
+    // Ciphertext that isn't a whole number of blocks.
+    opened = tmpfile();
+    rewind( plain );
+    streamInit( &stream, &ctx, pool, true, MODE_ECB, NULL );
+    TestCase( pipelineRun( plain, opened, &stream ) == TDES_ERR_LENGTH );
+    fclose( opened );
+
+    // io_uring gives the same ciphertext, and it comes back through O_DIRECT, unless
+    // the kernel doesn't have it.
+    FILE *sealed = tmpfile();
+    streamInit( &stream, &ctx, pool, false, MODE_ECB, NULL );
+    int status = uringRun( plain, sealed, &stream, false );
+    TestCase( status == URING_UNAVAILABLE ||
+              ( status == TDES_OK && readAt( sealed, 0, output, expectedLen ) &&
+                cmpBytes( output, expected, expectedLen ) ) );
+    opened = tmpfile();
+    streamInit( &stream, &ctx, pool, true, MODE_ECB, NULL );
+    status = uringRun( sealed, opened, &stream, true );
+    TestCase( status == URING_UNAVAILABLE ||
+              ( status == TDES_OK && readAt( opened, 0, output, len ) &&
+                cmpBytes( output, input, len ) ) );
+    fclose( opened );
+    fclose( sealed );
+
+    fclose( cipher );
+    fclose( plain );
+    free( input );
+    free( expected );
+    free( output );
+    poolDestroy( pool );
+  }
+
+////////////////////////////////////////////////////////////////////////
+  // Test the engine registry
+
+  {
+    // Every engine this CPU can run gives the known answers.
+    bool pass = true;
+    for ( int i = 0; i < engineCount(); i++ )
+      if ( engineSupported( engineAt( i ) ) && !engineSelfTest( engineAt( i ) ) )
+        pass = false;
+    TestCase( pass );
+
+    TestCase( engineFind( "slice64" ) != NULL && engineFind( "nope" ) == NULL );
+
+    // Picking by name, with a name that isn't there.
+    TestCase( engineChoose( "scalar" ) == engineFind( "scalar" ) );
+    TestCase( engineChoose( "bogus" ) == NULL );
+
+    // Picking the widest or the fastest always finds one.
+    Engine const *widest = engineChoose( NULL );
+    Engine const *fastest = engineChoose( ENGINE_FASTEST );
+    TestCase( widest != NULL && engineSupported( widest ) &&
+              fastest != NULL && engineSupported( fastest ) );
+
+    TestCase( engineSupported( engineSelected() ) &&
+              engineBlocks() == engineSelected()->blocks );
+  }
+
+////////////////////////////////////////////////////////////////////////
+  // Test lzCompress(), lzDecompress() and compressed containers
+
+  {
+    // Log lines that repeat with a few changes, across a few chunks.
+    size_t len = 2 * CONTAINER_CHUNK_BYTES + 777;
+    byte *input = malloc( len );
+    byte *packed = malloc( len );
+    byte *output = malloc( len );
+    char const *line = "2026-01-01 00:00:00 INFO request served in 12 ms\n";
+    size_t lineLen = strlen( line );
+    for ( size_t i = 0; i < len; i++ )
+      input[ i ] = line[ i % lineLen ] + ( i % 997 == 0 );
+    size_t packedLen = lzCompress( packed, len, input, len );
+    TestCase( packedLen > 0 && packedLen < len / 4 &&
+              lzDecompress( output, len, packed, packedLen ) &&
+              cmpBytes( output, input, len ) );
+
+    // Random bytes don't get any shorter.
+    uint64_t state = 17;
+    for ( size_t i = 0; i < CONTAINER_CHUNK_BYTES; i++ )
+      input[ CONTAINER_CHUNK_BYTES + i ] = nextRandom( &state );
+    TestCase( lzCompress( packed, CONTAINER_CHUNK_BYTES - 1, input + CONTAINER_CHUNK_BYTES,
+                          CONTAINER_CHUNK_BYTES ) == 0 );
+
+    // A match before the start, data cut short, and the wrong length are all caught.
+    byte early[] = { 0x10, 'a', 0x00, 0x05 };
+    TestCase( !lzDecompress( output, 10, early, sizeof( early ) ) &&
+              !lzDecompress( output, len, packed, packedLen - 1 ) &&
+              !lzDecompress( output, len - 1, packed, packedLen ) );
+
+    // The middle chunk is random, so it's stored as it is between two compressed ones.
+    byte key[] = { 0x54, 0x68, 0x69, 0x73, 0x20, 0x6B, 0x65, 0x79,
+      0x20, 0x69, 0x73, 0x20, 0x6A, 0x75, 0x73, 0x74,
+      0x20, 0x61, 0x73, 0x63, 0x69, 0x69, 0x2E, 0x0A };
+    byte iv[ BLOCK_BYTES ] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+    Pool *pool = poolCreate( 2 );
+    FILE *plain = tmpfile();
+    fwrite( input, 1, len, plain );
+
+    // Every mode, all of it and then a piece across a chunk boundary.
+    bool same = true;
+    bool smaller = true;
+    for ( int mode = MODE_ECB; mode <= MODE_CTR; mode++ ) {
+      FILE *sealed = tmpfile();
+      FILE *opened = tmpfile();
+      rewind( plain );
+      if ( containerWrite( plain, sealed, &ctx, pool, mode, iv, len, true ) != TDES_OK ||
+           containerRead( sealed, opened, &ctx, pool, 0, UINT64_MAX ) != TDES_OK ||
+           !readAt( opened, 0, output, len ) || !cmpBytes( output, input, len ) )
+        same = false;
+      fclose( opened );
+      if ( ftell( sealed ) > CONTAINER_CHUNK_BYTES + len / 4 )
+        smaller = false;
+
+      opened = tmpfile();
+      if ( containerRead( sealed, opened, &ctx, NULL, 2 * CONTAINER_CHUNK_BYTES - 5, 100 ) != TDES_OK ||
+           !readAt( opened, 0, output, 100 ) ||
+           !cmpBytes( output, input + 2 * CONTAINER_CHUNK_BYTES - 5, 100 ) )
+        same = false;
+      fclose( opened );
+      fclose( sealed );
+    }
+    TestCase( same );
+    TestCase( smaller );
+
+    // The wrong key can't get a compressed chunk through.
+    FILE *sealed = tmpfile();
+    rewind( plain );
+    containerWrite( plain, sealed, &ctx, NULL, MODE_CTR, iv, len, true );
+    key[ 0 ] ^= 0x02;
+    tdesInit( &ctx, key, sizeof( key ) );
+    FILE *opened = tmpfile();
+    TestCase( containerRead( sealed, opened, &ctx, NULL, 0, CONTAINER_CHUNK_BYTES ) != TDES_OK );
+    fclose( opened );
+    fclose( sealed );
+
+    fclose( plain );
+    poolDestroy( pool );
+    free( input );
+    free( packed );
+    free( output );
+  }
+
+////////////////////////////////////////////////////////////////////////
+  // Test the memo of repeated ECB blocks
+
+  {
+    // Zeros, seven blocks that keep coming back and random ones, over a few chunks.
+    size_t blocks = 3 * CHUNK_BLOCKS + 100;
+    byte *input = malloc( blocks * BLOCK_BYTES );
+    byte *expected = malloc( blocks * BLOCK_BYTES );
+    byte *output = malloc( blocks * BLOCK_BYTES );
+    uint64_t state = 25;
+    for ( size_t i = 0; i < blocks; i++ ) {
+      uint64_t block = 0;
+      if ( i % 4 == 1 )
+        block = 0x0101010101010101ULL * ( i / 4 % 7 + 1 );
+      else if ( i % 4 == 3 )
+        block = nextRandom( &state );
+      storeBlock( input + i * BLOCK_BYTES, block );
+    }
+
+    byte key[] = { 0x73, 0x75, 0x70, 0x65, 0x72, 0x0A, 0x73, 0x65,
+      0x63, 0x72, 0x65, 0x74, 0x0A, 0x63, 0x72, 0x79,
+      0x70, 0x74, 0x6F, 0x0A, 0x6B, 0x65, 0x79, 0x0A };
+    TDESContext ctx;
+    tdesInit( &ctx, key, sizeof( key ) );
+    Pool *pool = poolCreate( 3 );
+    tdesCryptBlocksParallel( &ctx, pool, expected, input, blocks, false );
+
+    TDESMemoStats memo = { 0, 0 };
+    ctx.memo = &memo;
+    tdesCryptBlocksParallel( &ctx, pool, output, input, blocks, false );
+    TestCase( cmpBytes( output, expected, blocks * BLOCK_BYTES ) );
+
+    // Every chunk does its first zero and first copy of each of the seven.
+    size_t chunks = ( blocks + CHUNK_BLOCKS - 1 ) / CHUNK_BLOCKS;
+    TestCase( memo.lookups == blocks &&
+              memo.hits == blocks / 2 + blocks / 4 - chunks * 8 );
+
+    // Decrypting in place gives the blocks back.
+    tdesCryptBlocksParallel( &ctx, pool, output, output, blocks, true );
+    TestCase( cmpBytes( output, input, blocks * BLOCK_BYTES ) && memo.lookups == 2 * blocks );
+
+    poolDestroy( pool );
+    free( input );
+    free( expected );
+    free( output );
+  }
+
+  {
+    // encryptTDESMemo() and decryptTDESMemo() match the functions without the memo.
+    byte buffer[ 40 * BLOCK_BYTES ] = { 0 };
+    for ( size_t i = 0; i < sizeof( buffer ); i += 2 * BLOCK_BYTES )
+      buffer[ i ] = 'a';
+    byte key[] = { 0x73, 0x75, 0x70, 0x65, 0x72, 0x0A, 0x73, 0x65,
+      0x63, 0x72, 0x65, 0x74, 0x0A, 0x63, 0x72, 0x79,
+      0x70, 0x74, 0x6F, 0x0A, 0x6B, 0x65, 0x79, 0x0A };
+    int n, m, k;
+    byte *expected = encryptTDES( buffer, sizeof( buffer ), key, sizeof( key ), &n );
+    TDESMemoStats memo = { 0, 0 };
+    byte *result = encryptTDESMemo( buffer, sizeof( buffer ), key, sizeof( key ), &m, &memo );
+    TestCase( m == n && cmpBytes( result, expected, n ) &&
+              memo.lookups == 41 && memo.hits == 38 );
+
+    byte *plain = decryptTDESMemo( result, m, key, sizeof( key ), &k, &memo );
+    TestCase( k == sizeof( buffer ) && cmpBytes( plain, buffer, k ) && memo.lookups == 82 );
+    free( expected );
+    free( result );
+    free( plain );
+  }
+
 #ifdef DISABLE_TESTS
   // Once you move the #ifdef DISABLE_TESTS to here, you've enabled
   // all the tests.
@@ -0,0 +1,26 @@
+/** 
+    @file bitslice.c
+    @author Jayani Sivakumar
+    Checks which bitsliced kernel widths the CPU can run.
+*/
+
+#include "bitslice.h"
+
+/** Number of bits in a block handled by each kernel width. */
+#define SLICE_64 64
+#define SLICE_128 128
+#define SLICE_256 256
+
+bool bitsliceSupports( int blocks )
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+    __builtin_cpu_init();
+    if ( blocks == SLICE_256 ) {
+        return __builtin_cpu_supports( "avx2" );
+    }
+    if ( blocks == SLICE_128 ) {
+        return __builtin_cpu_supports( "sse2" );
+    }
+#endif
+    return blocks == SLICE_64;
+}
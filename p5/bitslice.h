@@ -0,0 +1,84 @@
+/** 
+    @file bitslice.h
+    @author Jayani Sivakumar
+    Bitsliced Triple DES engine.  It transposes a batch of blocks so each
+    variable holds the same bit of every block, then evaluates the S-Boxes
+    as boolean circuits, so one pass through the rounds encrypts the whole
+    batch.  The kernel is built for several vector widths, and each width is
+    an engine in the registry in engine.h.
+*/
+
+#ifndef _BITSLICE_H_
+#define _BITSLICE_H_
+
+#include <stdbool.h>
+#include "TDES.h"
+
+/** Number of S-Box input bits used to choose a group of outputs.  The
+    other two input bits choose an output within the group. */
+#define SLICE_GROUP_BITS 4
+
+/** Number of groups of S-Box outputs. */
+#define SLICE_GROUPS ( 1 << SLICE_GROUP_BITS )
+
+/** Number of S-Box outputs in each group, one for each value of the
+    last two input bits. */
+#define PAIR_INPUTS ( 1 << ( SBOX_INPUT_BITS - SLICE_GROUP_BITS ) )
+
+/** Number of different boolean functions of two inputs. */
+#define PAIR_FUNCTIONS ( 1 << PAIR_INPUTS )
+
+/** Largest number of blocks handled by any kernel width. */
+#define SLICE_MAX_BLOCKS 256
+
+/** Tables derived from magic.c that are used by every kernel width.  They're
+    written to destables.h by gentables when the program is built. */
+typedef struct {
+    /** code[ i ][ j ][ g ] is the truth table of output bit j of S-Box i
+        when its first four input bits have the value g, as a function of
+        the last two input bits.  Bit ( 2 * b5 + b6 ) of the code is the
+        output for input bits b5 and b6. */
+    byte code[ SBOX_COUNT ][ SBOX_OUTPUT_BITS ][ SLICE_GROUPS ];
+    /** outputBit[ k ] is the index in the f function result (from zero)
+        where bit k of the S-Box outputs ends up after the P permutation. */
+    int outputBit[ HALF_BLOCK_BITS ];
+    /** keyBit[ r ][ j ] is the index in a DES key (from zero) of the bit
+        that becomes bit j + 1 of subkey K_r, so subkeys for a batch of
+        different keys can be picked straight from the key's bit planes. */
+    byte keyBit[ ROUND_COUNT ][ SUBKEY_BITS ];
+} SliceTables;
+
+/** Kernel for one vector width.  It encrypts or decrypts exactly as many
+    blocks as the width has bits, reading from in and writing to out.  The
+    two may be the same array. */
+typedef void (*SliceKernel)( TDESContext const *ctx, byte out[], byte const in[], bool decrypt );
+
+//
+// Kernels built from slicekernel.c, one for each width.  They're
+// documented in that file.
+//
+void bitsliceTDES64( TDESContext const *ctx, byte out[], byte const in[], bool decrypt );
+void bitsliceTDES128( TDESContext const *ctx, byte out[], byte const in[], bool decrypt );
+void bitsliceTDES256( TDESContext const *ctx, byte out[], byte const in[], bool decrypt );
+
+/** Kernel for one vector width that uses a different key for every
+    block.  Block i is encrypted or decrypted with the TDES_KEY_BYTES key
+    that keys[ i ] points to.  The subkeys are computed in the kernel for
+    the whole batch at once, so nothing has to be set up with tdesInit(). */
+typedef void (*SliceKeysKernel)( byte const *const keys[], byte out[], byte const in[], bool decrypt );
+
+//
+// Kernels with a key for each block, also built from slicekernel.c.
+//
+void bitsliceKeysTDES64( byte const *const keys[], byte out[], byte const in[], bool decrypt );
+void bitsliceKeysTDES128( byte const *const keys[], byte out[], byte const in[], bool decrypt );
+void bitsliceKeysTDES256( byte const *const keys[], byte out[], byte const in[], bool decrypt );
+
+/**
+    This function reports whether this CPU can run the kernel for the given width.
+    @param blocks number of blocks the kernel handles, 64, 128 or 256.
+    @return true if the kernel for that width can be used.
+ */
+bool bitsliceSupports( int blocks );
+
+#endif
@@ -0,0 +1,243 @@
+/**
+    @file compress.c
+    @author Jayani Sivakumar
+    Implementation of the LZ77 compressor.  The compressed data is a list of
+    sequences, each made of:
+        token, with the number of literals in the high four bits and the
+            match length minus MIN_MATCH in the low four
+        more bytes of the literal count if the high bits are all ones
+        the literals
+        distance back to the match, OFFSET_BYTES most significant byte first
+        more bytes of the match length if the low bits are all ones
+    A count goes on into extra bytes by adding each one until a byte isn't
+    COUNT_MORE.  The last sequence stops after its literals.
+*/
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include "compress.h"
+
+/** Shortest match worth replacing with a distance and length. */
+#define MIN_MATCH 4
+
+/** Number of bytes in a match's distance. */
+#define OFFSET_BYTES 2
+
+/** Farthest back a match can be, the largest distance that fits in OFFSET_BYTES. */
+#define MAX_OFFSET 65535
+
+/** Number of bits in the count of literals and the match length in a token. */
+#define TOKEN_SHIFT 4
+
+/** Largest count that fits in a token, meaning more bytes of the count follow. */
+#define TOKEN_MAX 15
+
+/** Value of an extra count byte that says another one follows. */
+#define COUNT_MORE 255
+
+/** Number of bits in the hash of MIN_MATCH bytes. */
+#define HASH_BITS 13
+
+/** Number of entries in the table of recent positions. */
+#define HASH_SIZE ( 1 << HASH_BITS )
+
+/** Odd multiplier that spreads MIN_MATCH bytes over the hash bits. */
+#define HASH_MULTIPLIER 2654435761U
+
+/** Shift for the number of bytes since the last match, which makes the
+    search step further through data that doesn't compress. */
+#define SKIP_SHIFT 6
+
+/**
+    Helper method that hashes the MIN_MATCH bytes at a position.
+    @param data where the bytes start.
+    @return index into the table of recent positions.
+ */
+static uint32_t hashBytes( byte const data[] );
+
+/**
+    Helper method that stores one sequence.
+    @param out array where the compressed data is stored.
+    @param cap number of bytes there's room for in out.
+    @param pos number of bytes already in out, which is advanced past the sequence.
+    @param literals bytes to store as they are.
+    @param litCount number of literals.
+    @param offset distance back to the match, or 0 for the last sequence, which has no match.
+    @param matchLen number of bytes in the match.
+    @return true if the sequence fit, else false.
+ */
+static bool putSequence( byte out[], size_t cap, size_t *pos, byte const literals[],
+                         size_t litCount, size_t offset, size_t matchLen );
+
+/**
+    Helper method that stores the extra bytes of a count too big for its token.
+    @param out array where the compressed data is stored.
+    @param cap number of bytes there's room for in out.
+    @param pos number of bytes already in out, which is advanced past the count.
+    @param count the count, at least TOKEN_MAX.
+    @return true if the count fit, else false.
+ */
+static bool putCount( byte out[], size_t cap, size_t *pos, size_t count );
+
+/**
+    Helper method that reads the extra bytes of a count, if its token says there are any.
+    @param in compressed data.
+    @param inLen number of bytes of compressed data.
+    @param pos position of the next byte in the compressed data, which is advanced
+    past the count.
+    @param count the part of the count from the token, which the extra bytes are added to.
+    @return true if the count was all there, else false.
+ */
+static bool getCount( byte const in[], size_t inLen, size_t *pos, size_t *count );
+
+static uint32_t hashBytes( byte const data[] )
+{
+    uint32_t value;
+    memcpy( &value, data, MIN_MATCH );
+    return ( value * HASH_MULTIPLIER ) >> ( 32 - HASH_BITS );
+}
+
+static bool putCount( byte out[], size_t cap, size_t *pos, size_t count )
+{
+    for ( count -= TOKEN_MAX; ; count -= COUNT_MORE ) {
+        if ( *pos >= cap ) {
+            return false;
+        }
+        byte part = count < COUNT_MORE ? count : COUNT_MORE;
+        out[ ( *pos )++ ] = part;
+        if ( part < COUNT_MORE ) {
+            return true;
+        }
+    }
+}
+
+static bool putSequence( byte out[], size_t cap, size_t *pos, byte const literals[],
+                         size_t litCount, size_t offset, size_t matchLen )
+{
+    size_t matchCount = offset == 0 ? 0 : matchLen - MIN_MATCH;
+    if ( *pos >= cap ) {
+        return false;
+    }
+    out[ ( *pos )++ ] = ( litCount < TOKEN_MAX ? litCount : TOKEN_MAX ) << TOKEN_SHIFT |
+                        ( matchCount < TOKEN_MAX ? matchCount : TOKEN_MAX );
+    if ( litCount >= TOKEN_MAX && !putCount( out, cap, pos, litCount ) ) {
+        return false;
+    }
+    if ( litCount > cap - *pos ) {
+        return false;
+    }
+    memcpy( out + *pos, literals, litCount );
+    *pos += litCount;
+    if ( offset == 0 ) {
+        return true;
+    }
+
+    if ( OFFSET_BYTES > cap - *pos ) {
+        return false;
+    }
+    out[ *pos ] = offset >> CHAR_BIT;
+    out[ *pos + 1 ] = ( byte ) offset;
+    *pos += OFFSET_BYTES;
+    return matchCount < TOKEN_MAX || putCount( out, cap, pos, matchCount );
+}
+
+size_t lzCompress( byte out[], size_t cap, byte const in[], size_t len )
+{
+    // positions that haven't been filled in yet point at the start, and fail the check
+    uint32_t recent[ HASH_SIZE ];
+    memset( recent, 0, sizeof( recent ) );
+
+    size_t pos = 0;
+    size_t anchor = 0;
+    size_t used = 0;
+    while ( pos + MIN_MATCH <= len ) {
+        uint32_t hash = hashBytes( in + pos );
+        size_t match = recent[ hash ];
+        recent[ hash ] = pos;
+        if ( match >= pos || pos - match > MAX_OFFSET ||
+             memcmp( in + match, in + pos, MIN_MATCH ) != 0 ) {
+            pos += 1 + ( ( pos - anchor ) >> SKIP_SHIFT );
+            continue;
+        }
+
+        size_t matchLen = MIN_MATCH;
+        while ( pos + matchLen < len && in[ match + matchLen ] == in[ pos + matchLen ] ) {
+            matchLen++;
+        }
+        if ( !putSequence( out, cap, &used, in + anchor, pos - anchor, pos - match, matchLen ) ) {
+            return 0;
+        }
+        pos += matchLen;
+        anchor = pos;
+    }
+
+    // whatever is left after the last match
+    if ( !putSequence( out, cap, &used, in + anchor, len - anchor, 0, 0 ) ) {
+        return 0;
+    }
+    return used;
+}
+
+static bool getCount( byte const in[], size_t inLen, size_t *pos, size_t *count )
+{
+    if ( *count < TOKEN_MAX ) {
+        return true;
+    }
+    for ( ;; ) {
+        if ( *pos >= inLen ) {
+            return false;
+        }
+        byte part = in[ ( *pos )++ ];
+        *count += part;
+        if ( part < COUNT_MORE ) {
+            return true;
+        }
+    }
+}
+
+bool lzDecompress( byte out[], size_t outLen, byte const in[], size_t inLen )
+{
+    size_t pos = 0;
+    size_t done = 0;
+    while ( pos < inLen ) {
+        byte token = in[ pos++ ];
+        size_t litCount = token >> TOKEN_SHIFT;
+        if ( !getCount( in, inLen, &pos, &litCount ) || litCount > inLen - pos ||
+             litCount > outLen - done ) {
+            return false;
+        }
+        memcpy( out + done, in + pos, litCount );
+        pos += litCount;
+        done += litCount;
+
+        // only the last sequence ends with the data
+        if ( pos == inLen ) {
+            break;
+        }
+        if ( OFFSET_BYTES > inLen - pos ) {
+            return false;
+        }
+        size_t offset = ( size_t ) in[ pos ] << CHAR_BIT | in[ pos + 1 ];
+        pos += OFFSET_BYTES;
+        size_t matchLen = token & TOKEN_MAX;
+        if ( !getCount( in, inLen, &pos, &matchLen ) ) {
+            return false;
+        }
+        matchLen += MIN_MATCH;
+        if ( offset == 0 || offset > done || matchLen > outLen - done ) {
+            return false;
+        }
+
+        // a match that overlaps itself repeats the bytes it starts with
+        if ( offset >= matchLen ) {
+            memcpy( out + done, out + done - offset, matchLen );
+        } else {
+            for ( size_t i = 0; i < matchLen; i++ ) {
+                out[ done + i ] = out[ done + i - offset ];
+            }
+        }
+        done += matchLen;
+    }
+    return done == outLen;
+}
@@ -0,0 +1,39 @@
+/**
+    @file compress.h
+    @author Jayani Sivakumar
+    Small LZ77 compressor for the chunks of a container.  Repeated runs of
+    bytes are replaced with a distance back to an earlier copy and a length,
+    so redundant input like log text takes fewer blocks to encrypt and fewer
+    bytes to store.  Every call stands on its own, so chunks can be
+    compressed and decompressed by different threads at the same time.
+*/
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "IO.h"
+
+/**
+    This function compresses data, giving up as soon as the result won't fit.
+    @param out array where the compressed data is stored.
+    @param cap number of bytes there's room for in out.
+    @param in data to compress, which can't overlap out.
+    @param len number of bytes of data.
+    @return number of bytes of compressed data, or 0 if it needs more than cap bytes.
+ */
+size_t lzCompress( byte out[], size_t cap, byte const in[], size_t len );
+
+/**
+    This function decompresses data made by lzCompress(), checking every length
+    and distance so bad input can't reach outside either array.
+    @param out array where the data is stored.
+    @param outLen number of bytes the data should come to.
+    @param in compressed data, which can't overlap out.
+    @param inLen number of bytes of compressed data.
+    @return true if the compressed data was well formed and came to exactly outLen bytes.
+ */
+bool lzDecompress( byte out[], size_t outLen, byte const in[], size_t inLen );
+
+#endif
@@ -0,0 +1,554 @@
+/**
+    @file container.c
+    @author Jayani Sivakumar
+    Implementation of the container format.  Everything in it is stored
+    most significant byte first, like the blocks themselves.
+
+    Header, HEADER_BYTES long:
+        0   magic, "TDSC"
+        4   version
+        5   mode
+        6   flags, FLAG_COMPRESSED or zero
+        8   chunk size in bytes of plaintext
+        12  plaintext length
+        20  IV, zero for ECB
+        28  reserved, zero
+    then the chunks, then an index entry for each chunk:
+        0   position of the chunk in the file
+        8   number of bytes stored for the chunk
+        12  number of bytes of plaintext in the chunk
+    and last, the position of the index.
+
+    With FLAG_COMPRESSED, each chunk is compressed with lzCompress() before
+    it's padded and encrypted, unless that wouldn't make it any shorter.  A
+    chunk that decrypts to fewer bytes than its plaintext length was
+    compressed, and one that decrypts to just as many was stored as it is.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "container.h"
+#include "compress.h"
+#include "modes.h"
+#include "stats.h"
+
+/** Characters every container starts with. */
+#define MAGIC "TDSC"
+
+/** Number of characters in MAGIC. */
+#define MAGIC_BYTES 4
+
+/** Version of the format this code writes and reads. */
+#define VERSION 1
+
+/** Number of bytes in the header. */
+#define HEADER_BYTES 32
+
+/** Position of the version in the header. */
+#define VERSION_POS 4
+
+/** Position of the mode in the header. */
+#define MODE_POS 5
+
+/** Position of the flags in the header. */
+#define FLAGS_POS 6
+
+/** Position of the chunk size in the header. */
+#define CHUNK_POS 8
+
+/** Position of the plaintext length in the header. */
+#define LENGTH_POS 12
+
+/** Position of the IV in the header. */
+#define IV_POS 20
+
+/** Flag for chunks that are compressed before they're encrypted. */
+#define FLAG_COMPRESSED 0x0001
+
+/** Every flag this code knows how to read. */
+#define KNOWN_FLAGS FLAG_COMPRESSED
+
+/** Number of bytes in each index entry. */
+#define ENTRY_BYTES 16
+
+/** Position of the stored length in an index entry. */
+#define STORED_POS 8
+
+/** Position of the plaintext length in an index entry. */
+#define PLAIN_POS 12
+
+/** Number of bytes in the flags. */
+#define FLAGS_BYTES 2
+
+/** Number of bytes in the 32-bit fields. */
+#define WORD_BYTES 4
+
+/** Number of bytes in the trailer, which holds the position of the index. */
+#define TRAILER_BYTES 8
+
+/** Largest chunk size accepted when reading, so a bad header can't
+    ask for huge buffers. */
+#define MAX_CHUNK_BYTES ( 16 * 1024 * 1024 )
+
+/** Number of bytes of plaintext handed to the pool at a time. */
+#define BATCH_BYTES ( 1024 * 1024 )
+
+/** Fields from a container's header. */
+typedef struct {
+    /** MODE_ECB, MODE_CBC or MODE_CTR. */
+    int mode;
+    /** FLAG_COMPRESSED or zero. */
+    int flags;
+    /** Number of bytes of plaintext in every chunk but the last. */
+    uint32_t chunkBytes;
+    /** Total number of bytes of plaintext. */
+    uint64_t plainLen;
+    /** IV for CBC and CTR. */
+    uint64_t iv;
+} Header;
+
+/** A batch of chunks the pool's threads encrypt or decrypt in place. */
+typedef struct {
+    /** Key schedule shared by every thread. */
+    TDESContext const *ctx;
+    /** Fields from the container's header. */
+    Header const *header;
+    /** Number of the chunk in the first slot. */
+    uint64_t firstChunk;
+    /** One slot of chunkBytes + BLOCK_BYTES bytes for each chunk. */
+    byte *slots;
+    /** Another slot for each chunk to compress or decompress it into, or NULL
+        if the chunks aren't compressed. */
+    byte *packed;
+    /** Number of bytes of plaintext in each chunk. */
+    uint32_t *plainLens;
+    /** Number of bytes stored for each chunk. */
+    uint32_t *storedLens;
+    /** Result for each chunk when decrypting. */
+    int *status;
+} ChunkBatch;
+
+/**
+    Helper method that gets a number stored most significant byte first.
+    @param data where the number is stored.
+    @param bytes number of bytes in the number.
+    @return the number.
+ */
+static uint64_t loadField( byte const data[], int bytes );
+
+/**
+    Helper method that stores a number most significant byte first.
+    @param data where the number is stored.
+    @param value the number.
+    @param bytes number of bytes to store.
+ */
+static void storeField( byte data[], uint64_t value, int bytes );
+
+/**
+    Helper method that writes a container's header at the current position.
+    @param out file to write.
+    @param header fields to write.
+    @return true if successful, else false.
+ */
+static bool writeHeader( FILE *out, Header const *header );
+
+/**
+    Helper method that reads and checks a container's header.
+    @param in file to read.
+    @param header where the fields are returned.
+    @return TDES_OK if successful, TDES_ERR_FORMAT or READ_ERROR.
+ */
+static int readHeader( FILE *in, Header *header );
+
+/**
+    Helper method that returns the number of chunks in a batch, enough for
+    BATCH_BYTES and at least one for every thread.
+    @param pool pool of threads, or NULL.
+    @param chunkBytes number of bytes of plaintext in a chunk.
+    @return number of chunks.
+ */
+static size_t batchChunks( Pool *pool, uint32_t chunkBytes );
+
+/**
+    Helper method that returns the IV for one CBC chunk.
+    @param ctx key schedule made by tdesInit().
+    @param iv IV from the header.
+    @param chunk number of the chunk.
+    @return IV for the chunk.
+ */
+static uint64_t chunkIV( TDESContext const *ctx, uint64_t iv, uint64_t chunk );
+
+/**
+    Helper method run by the pool to encrypt each chunk of a ChunkBatch.
+    @param arg pointer to the ChunkBatch.
+    @param job number of the slot.
+ */
+static void encryptChunk( void *arg, size_t job );
+
+/**
+    Helper method run by the pool to decrypt each chunk of a ChunkBatch.
+    @param arg pointer to the ChunkBatch.
+    @param job number of the slot.
+ */
+static void decryptChunk( void *arg, size_t job );
+
+static uint64_t loadField( byte const data[], int bytes )
+{
+    uint64_t value = 0;
+    for ( int i = 0; i < bytes; i++ ) {
+        value = ( value << BYTE_SIZE ) | data[ i ];
+    }
+    return value;
+}
+
+static void storeField( byte data[], uint64_t value, int bytes )
+{
+    for ( int i = bytes - 1; i >= 0; i-- ) {
+        data[ i ] = ( byte ) value;
+        value >>= BYTE_SIZE;
+    }
+}
+
+static bool writeHeader( FILE *out, Header const *header )
+{
+    byte data[ HEADER_BYTES ] = { 0 };
+    memcpy( data, MAGIC, MAGIC_BYTES );
+    data[ VERSION_POS ] = VERSION;
+    data[ MODE_POS ] = header->mode;
+    storeField( data + FLAGS_POS, header->flags, FLAGS_BYTES );
+    storeField( data + CHUNK_POS, header->chunkBytes, WORD_BYTES );
+    storeField( data + LENGTH_POS, header->plainLen, BLOCK_BYTES );
+    storeField( data + IV_POS, header->iv, BLOCK_BYTES );
+    return writeBytes( out, data, HEADER_BYTES );
+}
+
+static int readHeader( FILE *in, Header *header )
+{
+    byte data[ HEADER_BYTES ];
+    if ( !readAt( in, 0, data, HEADER_BYTES ) ) {
+        return ferror( in ) ? READ_ERROR : TDES_ERR_FORMAT;
+    }
+    header->mode = data[ MODE_POS ];
+    header->flags = loadField( data + FLAGS_POS, FLAGS_BYTES );
+    header->chunkBytes = loadField( data + CHUNK_POS, WORD_BYTES );
+    header->plainLen = loadField( data + LENGTH_POS, BLOCK_BYTES );
+    header->iv = loadField( data + IV_POS, BLOCK_BYTES );
+    if ( memcmp( data, MAGIC, MAGIC_BYTES ) != 0 || data[ VERSION_POS ] != VERSION ||
+         header->mode > MODE_CTR || ( header->flags & ~KNOWN_FLAGS ) != 0 ||
+         header->chunkBytes == 0 || header->chunkBytes % BLOCK_BYTES != 0 ||
+         header->chunkBytes > MAX_CHUNK_BYTES ) {
+        return TDES_ERR_FORMAT;
+    }
+    return TDES_OK;
+}
+
+static size_t batchChunks( Pool *pool, uint32_t chunkBytes )
+{
+    size_t count = BATCH_BYTES / chunkBytes;
+    if ( count < ( size_t ) poolThreads( pool ) ) {
+        count = poolThreads( pool );
+    }
+    return count > 0 ? count : 1;
+}
+
+static uint64_t chunkIV( TDESContext const *ctx, uint64_t iv, uint64_t chunk )
+{
+    return tdesEncryptBlock64( ctx, iv + chunk );
+}
+
+static void encryptChunk( void *arg, size_t job )
+{
+    ChunkBatch const *batch = arg;
+    Header const *header = batch->header;
+    size_t slotBytes = header->chunkBytes + BLOCK_BYTES;
+    byte *slot = batch->slots + job * slotBytes;
+    uint32_t len = batch->plainLens[ job ];
+    uint64_t chunk = batch->firstChunk + job;
+
+    // the compressed copy is encrypted back into the slot, if it's any shorter
+    byte *data = slot;
+    if ( batch->packed != NULL ) {
+        byte *packed = batch->packed + job * slotBytes;
+        STATS_BEGIN( STAGE_COMPRESS );
+        size_t packedLen = lzCompress( packed, len - 1, slot, len );
+        STATS_END( STAGE_COMPRESS, len );
+        if ( packedLen > 0 ) {
+            data = packed;
+            len = packedLen;
+        }
+    }
+
+    if ( header->mode == MODE_CTR ) {
+        ctrCrypt( batch->ctx, NULL, slot, data, len, header->iv, chunk * header->chunkBytes );
+        batch->storedLens[ job ] = len;
+        return;
+    }
+
+    // a whole block of padding if the chunk ends on a block boundary
+    int padCount = BLOCK_BYTES - len % BLOCK_BYTES;
+    memset( data + len, padCount, padCount );
+    size_t stored = len + padCount;
+    if ( header->mode == MODE_CBC ) {
+        cbcEncrypt( batch->ctx, slot, data, stored / BLOCK_BYTES,
+                    chunkIV( batch->ctx, header->iv, chunk ) );
+    } else {
+        tdesCryptBlocks( batch->ctx, slot, data, stored / BLOCK_BYTES, false );
+    }
+    batch->storedLens[ job ] = stored;
+}
+
+static void decryptChunk( void *arg, size_t job )
+{
+    ChunkBatch const *batch = arg;
+    Header const *header = batch->header;
+    size_t slotBytes = header->chunkBytes + BLOCK_BYTES;
+    byte *slot = batch->slots + job * slotBytes;
+    uint32_t stored = batch->storedLens[ job ];
+    uint64_t chunk = batch->firstChunk + job;
+
+    uint32_t plain = batch->plainLens[ job ];
+
+    batch->status[ job ] = TDES_OK;
+    size_t len = stored;
+    if ( header->mode == MODE_CTR ) {
+        ctrCrypt( batch->ctx, NULL, slot, slot, stored, header->iv, chunk * header->chunkBytes );
+    } else {
+        if ( header->mode == MODE_CBC ) {
+            cbcDecrypt( batch->ctx, NULL, slot, slot, stored / BLOCK_BYTES,
+                        chunkIV( batch->ctx, header->iv, chunk ) );
+        } else {
+            tdesCryptBlocks( batch->ctx, slot, slot, stored / BLOCK_BYTES, true );
+        }
+
+        // every chunk has its own padding, which has to agree with the index
+        int padValue = slot[ stored - 1 ];
+        len = stored - padValue;
+        if ( padValue < 1 || padValue > BLOCK_BYTES || len > plain ||
+             ( batch->packed == NULL && len != plain ) ) {
+            batch->status[ job ] = TDES_ERR_PADDING;
+            return;
+        }
+    }
+
+    // a chunk that's shorter than its plaintext was compressed
+    if ( len < plain ) {
+        byte *packed = batch->packed + job * slotBytes;
+        STATS_BEGIN( STAGE_COMPRESS );
+        bool unpacked = lzDecompress( packed, plain, slot, len );
+        STATS_END( STAGE_COMPRESS, plain );
+        if ( !unpacked ) {
+            batch->status[ job ] = TDES_ERR_FORMAT;
+            return;
+        }
+        memcpy( slot, packed, plain );
+    }
+}
+
+int containerWrite( FILE *in, FILE *out, TDESContext const *ctx, Pool *pool, int mode,
+                    byte const iv[], uint64_t len, bool compress )
+{
+    Header header = { mode, compress ? FLAG_COMPRESSED : 0, CONTAINER_CHUNK_BYTES, len,
+                      iv != NULL ? loadBlock( iv ) : 0 };
+    if ( !writeHeader( out, &header ) ) {
+        return WRITE_ERROR;
+    }
+
+    size_t count = batchChunks( pool, header.chunkBytes );
+    size_t slotBytes = header.chunkBytes + BLOCK_BYTES;
+    byte *slots = malloc( count * slotBytes );
+    byte *packed = compress ? malloc( count * slotBytes ) : NULL;
+    uint32_t *plainLens = malloc( count * sizeof( uint32_t ) );
+    uint32_t *storedLens = malloc( count * sizeof( uint32_t ) );
+    if ( slots == NULL || ( compress && packed == NULL ) || plainLens == NULL ||
+         storedLens == NULL ) {
+        exit( EXIT_FAILURE );
+    }
+    ChunkBatch batch = { ctx, &header, 0, slots, packed, plainLens, storedLens, NULL };
+
+    // the index grows as the chunks are written
+    byte *index = NULL;
+    size_t indexCap = 0;
+    uint64_t chunks = 0;
+    uint64_t pos = HEADER_BYTES;
+    uint64_t total = 0;
+    int status = TDES_OK;
+    bool more = true;
+    while ( status == TDES_OK && more ) {
+        size_t filled = 0;
+        while ( filled < count ) {
+            size_t got = readBytes( in, slots + filled * slotBytes, header.chunkBytes );
+            if ( got > 0 ) {
+                plainLens[ filled++ ] = got;
+            }
+            if ( got < header.chunkBytes ) {
+                more = false;
+                break;
+            }
+        }
+        if ( ferror( in ) ) {
+            status = READ_ERROR;
+            break;
+        }
+
+        batch.firstChunk = chunks;
+        poolRun( pool, filled, encryptChunk, &batch );
+
+        if ( ( chunks + filled ) * ENTRY_BYTES > indexCap ) {
+            indexCap = indexCap * 2 + filled * ENTRY_BYTES;
+            index = realloc( index, indexCap );
+            if ( index == NULL ) {
+                exit( EXIT_FAILURE );
+            }
+        }
+        for ( size_t j = 0; j < filled; j++ ) {
+            byte *entry = index + ( chunks + j ) * ENTRY_BYTES;
+            storeField( entry, pos, BLOCK_BYTES );
+            storeField( entry + STORED_POS, storedLens[ j ], WORD_BYTES );
+            storeField( entry + PLAIN_POS, plainLens[ j ], WORD_BYTES );
+            if ( !writeBytes( out, slots + j * slotBytes, storedLens[ j ] ) ) {
+                status = WRITE_ERROR;
+            }
+            pos += storedLens[ j ];
+            total += plainLens[ j ];
+        }
+        chunks += filled;
+    }
+
+    // the index, then where to find it
+    if ( status == TDES_OK ) {
+        byte trailer[ TRAILER_BYTES ];
+        storeField( trailer, pos, TRAILER_BYTES );
+        if ( !writeBytes( out, index, chunks * ENTRY_BYTES ) ||
+             !writeBytes( out, trailer, TRAILER_BYTES ) ) {
+            status = WRITE_ERROR;
+        }
+    }
+
+    // filling in the length if it wasn't known at the start
+    if ( status == TDES_OK && total != header.plainLen ) {
+        header.plainLen = total;
+        if ( fseek( out, 0, SEEK_SET ) != 0 || !writeHeader( out, &header ) ) {
+            status = WRITE_ERROR;
+        }
+    }
+
+    free( index );
+    free( slots );
+    free( packed );
+    free( plainLens );
+    free( storedLens );
+    return status;
+}
+
+int containerRead( FILE *in, FILE *out, TDESContext const *ctx, Pool *pool,
+                   uint64_t offset, uint64_t len )
+{
+    Header header;
+    int status = readHeader( in, &header );
+    if ( status != TDES_OK ) {
+        return status;
+    }
+    if ( fseek( in, 0, SEEK_END ) != 0 ) {
+        return READ_ERROR;
+    }
+    uint64_t fileLen = ftell( in );
+
+    // the index has to sit between the chunks and the trailer
+    byte trailer[ TRAILER_BYTES ];
+    if ( fileLen < HEADER_BYTES + TRAILER_BYTES ||
+         !readAt( in, fileLen - TRAILER_BYTES, trailer, TRAILER_BYTES ) ) {
+        return TDES_ERR_FORMAT;
+    }
+    uint64_t indexPos = loadField( trailer, TRAILER_BYTES );
+    uint64_t chunks = header.plainLen / header.chunkBytes +
+                      ( header.plainLen % header.chunkBytes != 0 );
+    if ( chunks > ( fileLen - HEADER_BYTES - TRAILER_BYTES ) / ENTRY_BYTES ||
+         indexPos != fileLen - TRAILER_BYTES - chunks * ENTRY_BYTES ) {
+        return TDES_ERR_FORMAT;
+    }
+
+    uint64_t end = offset;
+    if ( offset < header.plainLen ) {
+        end = len < header.plainLen - offset ? offset + len : header.plainLen;
+    }
+    if ( end == offset ) {
+        return TDES_OK;
+    }
+    uint64_t firstChunk = offset / header.chunkBytes;
+    uint64_t lastChunk = ( end - 1 ) / header.chunkBytes;
+
+    size_t count = batchChunks( pool, header.chunkBytes );
+    size_t slotBytes = header.chunkBytes + BLOCK_BYTES;
+    bool compressed = ( header.flags & FLAG_COMPRESSED ) != 0;
+    byte *slots = malloc( count * slotBytes );
+    byte *packed = compressed ? malloc( count * slotBytes ) : NULL;
+    byte *entries = malloc( count * ENTRY_BYTES );
+    uint32_t *plainLens = malloc( count * sizeof( uint32_t ) );
+    uint32_t *storedLens = malloc( count * sizeof( uint32_t ) );
+    int *results = malloc( count * sizeof( int ) );
+    if ( slots == NULL || ( compressed && packed == NULL ) || entries == NULL ||
+         plainLens == NULL || storedLens == NULL || results == NULL ) {
+        exit( EXIT_FAILURE );
+    }
+    ChunkBatch batch = { ctx, &header, 0, slots, packed, plainLens, storedLens, results };
+
+    for ( uint64_t chunk = firstChunk; status == TDES_OK && chunk <= lastChunk; chunk += count ) {
+        size_t filled = lastChunk + 1 - chunk < count ? lastChunk + 1 - chunk : count;
+        if ( !readAt( in, indexPos + chunk * ENTRY_BYTES, entries, filled * ENTRY_BYTES ) ) {
+            status = READ_ERROR;
+            break;
+        }
+
+        // only the chunks the range needs are read
+        for ( size_t j = 0; status == TDES_OK && j < filled; j++ ) {
+            byte const *entry = entries + j * ENTRY_BYTES;
+            uint64_t pos = loadField( entry, BLOCK_BYTES );
+            uint32_t stored = loadField( entry + STORED_POS, WORD_BYTES );
+            uint32_t plain = loadField( entry + PLAIN_POS, WORD_BYTES );
+            uint64_t expected = header.plainLen - ( chunk + j ) * header.chunkBytes;
+            if ( expected > header.chunkBytes ) {
+                expected = header.chunkBytes;
+            }
+            uint64_t expectedStored = header.mode == MODE_CTR ? expected : tdesPaddedLen( expected );
+
+            // a compressed chunk can be anything up to its full size, in whole blocks if padded
+            bool storedFits = stored == expectedStored;
+            if ( compressed ) {
+                storedFits = stored > 0 && stored <= expectedStored &&
+                             ( header.mode == MODE_CTR || stored % BLOCK_BYTES == 0 );
+            }
+            if ( plain != expected || !storedFits || pos < HEADER_BYTES ||
+                 pos > indexPos || stored > indexPos - pos ) {
+                status = TDES_ERR_FORMAT;
+            } else if ( !readAt( in, pos, slots + j * slotBytes, stored ) ) {
+                status = READ_ERROR;
+            }
+            plainLens[ j ] = plain;
+            storedLens[ j ] = stored;
+        }
+        if ( status != TDES_OK ) {
+            break;
+        }
+
+        batch.firstChunk = chunk;
+        poolRun( pool, filled, decryptChunk, &batch );
+
+        for ( size_t j = 0; status == TDES_OK && j < filled; j++ ) {
+            status = results[ j ];
+            uint64_t start = ( chunk + j ) * header.chunkBytes;
+            uint64_t from = offset > start ? offset - start : 0;
+            uint64_t to = end - start < plainLens[ j ] ? end - start : plainLens[ j ];
+            if ( status == TDES_OK && !writeBytes( out, slots + j * slotBytes + from, to - from ) ) {
+                status = WRITE_ERROR;
+            }
+        }
+    }
+
+    free( slots );
+    free( packed );
+    free( entries );
+    free( plainLens );
+    free( storedLens );
+    free( results );
+    return status;
+}
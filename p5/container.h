@@ -0,0 +1,65 @@
+/** 
+    @file container.h
+    @author Jayani Sivakumar
+    Container format for Triple DES data.  A header gives the version, mode,
+    chunk size and plaintext length, then each chunk of plaintext is
+    encrypted on its own, and an index at the end says where every chunk
+    is.  The chunks can also be compressed before they're encrypted, which
+    a flag in the header records.  The chunks can be encrypted and
+    decrypted in parallel, and part of the data can be read by going
+    straight to the chunks that hold it.
+*/
+
+#ifndef _CONTAINER_H_
+#define _CONTAINER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "TDES.h"
+
+/** Number of bytes of plaintext in every chunk but the last. */
+#define CONTAINER_CHUNK_BYTES ( CHUNK_BLOCKS * BLOCK_BYTES )
+
+/** Plaintext length to give containerWrite() when it isn't known ahead of time. */
+#define CONTAINER_UNKNOWN_LEN UINT64_MAX
+
+/**
+    This function encrypts everything in the input file into a container. ECB and CBC
+    chunks are padded on their own. Each CBC chunk's IV is the encryption of the
+    container's IV plus the chunk number, and CTR chunks carry on with the counter
+    from the chunk before, with no padding.  With compression, each chunk is
+    compressed by the thread that encrypts it, and kept as it is if that
+    doesn't make it any shorter.
+    @param in file to read.
+    @param out file to write. If the input's length isn't known, it has to be
+    seekable, so the header can be filled in at the end.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param mode MODE_ECB, MODE_CBC or MODE_CTR.
+    @param iv random IV for CBC and CTR, or NULL for ECB.
+    @param len length in bytes of the input, or CONTAINER_UNKNOWN_LEN.
+    @param compress true to compress the chunks before they're encrypted.
+    @return TDES_OK if successful, READ_ERROR or WRITE_ERROR.
+ */
+int containerWrite( FILE *in, FILE *out, TDESContext const *ctx, Pool *pool, int mode,
+                    byte const iv[], uint64_t len, bool compress );
+
+/**
+    This function decrypts part or all of the plaintext from a container, only
+    reading the chunks that hold it.  Compressed chunks are decompressed after
+    they're decrypted.
+    @param in container file to read, which has to be seekable.
+    @param out file to write.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param offset position of the first byte of plaintext to write.
+    @param len number of bytes of plaintext to write, or UINT64_MAX for all of it.
+    The range stops where the plaintext does.
+    @return TDES_OK if successful, TDES_ERR_FORMAT, TDES_ERR_PADDING, READ_ERROR or
+    WRITE_ERROR.
+ */
+int containerRead( FILE *in, FILE *out, TDESContext const *ctx, Pool *pool,
+                   uint64_t offset, uint64_t len );
+
+#endif
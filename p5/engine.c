@@ -0,0 +1,282 @@
+/** 
+    @file engine.c
+    @author Jayani Sivakumar
+    Implementation of the engine registry.  The engines are listed in one
+    table, widest first, and the selection is made once before main() so
+    every thread sees the same engine without any locking.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "engine.h"
+#include "stats.h"
+
+/** Number of blocks each engine encrypts when they're timed, a whole
+    number of batches for every engine. */
+#define BENCH_BLOCKS 1024
+
+/** Number of times each engine is timed, keeping the best. */
+#define BENCH_TRIES 3
+
+/** Number of nanoseconds in a second. */
+#define NANOS_PER_SECOND 1000000000LL
+
+/** A known answer: a key, a block and what the block encrypts to. */
+typedef struct {
+    /** The Triple DES key. */
+    byte key[ TDES_KEY_BYTES ];
+    /** The plaintext block. */
+    uint64_t plain;
+    /** The ciphertext block. */
+    uint64_t cipher;
+} KnownAnswer;
+
+/**
+    Helper method for the scalar engine, which handles one block at a time with
+    the 64-bit block functions.
+    @param ctx key schedule made by tdesInit().
+    @param out array where the result block is stored.
+    @param in block to encrypt or decrypt.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+static void scalarCrypt( TDESContext const *ctx, byte out[], byte const in[], bool decrypt );
+
+/**
+    Helper method for the scalar engine with its own key, which sets up the key
+    schedule for the block.
+    @param keys pointer to the TDES_KEY_BYTES key for the block.
+    @param out array where the result block is stored.
+    @param in block to encrypt or decrypt.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+static void scalarCryptKeys( byte const *const keys[], byte out[], byte const in[], bool decrypt );
+
+/**
+    Helper method that times an engine.
+    @param engine the engine, which has passed its self-test.
+    @return the best time for BENCH_BLOCKS blocks, in nanoseconds.
+ */
+static long long timeEngine( Engine const *engine );
+
+/**
+    Helper method that makes the selection when the program is loaded, before main(), then
+    clears the stage counters its self-tests and timing runs added to.
+ */
+static void selectEngine( void ) __attribute__(( constructor ));
+
+/** Every engine, widest first. */
+static Engine const engines[] = {
+    { "slice256", 256, bitsliceTDES256, bitsliceKeysTDES256 },
+    { "slice128", 128, bitsliceTDES128, bitsliceKeysTDES128 },
+    { "slice64", 64, bitsliceTDES64, bitsliceKeysTDES64 },
+    { "scalar", 1, scalarCrypt, scalarCryptKeys },
+};
+
+/** Number of engines in the registry. */
+#define ENGINE_COUNT ( ( int ) ( sizeof( engines ) / sizeof( engines[ 0 ] ) ) )
+
+/** Known answers from the unit tests. */
+static KnownAnswer const knownAnswers[] = {
+    // the key and padded plaintext from test 01
+    { { 0x54, 0x68, 0x69, 0x73, 0x20, 0x6B, 0x65, 0x79,
+        0x20, 0x69, 0x73, 0x20, 0x6A, 0x75, 0x73, 0x74,
+        0x20, 0x61, 0x73, 0x63, 0x69, 0x69, 0x2E, 0x0A },
+      0x73696D706C650A01ULL, 0x358010520261465EULL },
+    // the DES Algorithm Illustrated example, with the key repeated for single DES
+    { { 0x13, 0x34, 0x57, 0x79, 0x9B, 0xBC, 0xDF, 0xF1,
+        0x13, 0x34, 0x57, 0x79, 0x9B, 0xBC, 0xDF, 0xF1,
+        0x13, 0x34, 0x57, 0x79, 0x9B, 0xBC, 0xDF, 0xF1 },
+      0x0123456789ABCDEFULL, 0x85E813540F0AB405ULL },
+};
+
+/** Number of known answers. */
+#define ANSWER_COUNT ( ( int ) ( sizeof( knownAnswers ) / sizeof( knownAnswers[ 0 ] ) ) )
+
+/** Engine picked when the program started. */
+static Engine const *selected = &engines[ ENGINE_COUNT - 1 ];
+
+static void scalarCrypt( TDESContext const *ctx, byte out[], byte const in[], bool decrypt )
+{
+    uint64_t block = loadBlock( in );
+    storeBlock( out, decrypt ? tdesDecryptBlock64( ctx, block ) : tdesEncryptBlock64( ctx, block ) );
+}
+
+static void scalarCryptKeys( byte const *const keys[], byte out[], byte const in[], bool decrypt )
+{
+    TDESContext ctx;
+    tdesInit( &ctx, keys[ 0 ], TDES_KEY_BYTES );
+    scalarCrypt( &ctx, out, in, decrypt );
+}
+
+int engineCount( void )
+{
+    return ENGINE_COUNT;
+}
+
+Engine const *engineAt( int idx )
+{
+    return &engines[ idx ];
+}
+
+Engine const *engineFind( char const *name )
+{
+    for ( int i = 0; i < ENGINE_COUNT; i++ ) {
+        if ( strcmp( engines[ i ].name, name ) == 0 ) {
+            return &engines[ i ];
+        }
+    }
+    return NULL;
+}
+
+bool engineSupported( Engine const *engine )
+{
+    // the scalar engine runs anywhere
+    return engine->blocks == 1 || bitsliceSupports( engine->blocks );
+}
+
+bool engineSelfTest( Engine const *engine )
+{
+    int lanes = engine->blocks;
+    byte blocks[ SLICE_MAX_BLOCKS * BLOCK_BYTES ];
+    byte const *keys[ SLICE_MAX_BLOCKS ];
+    bool pass = true;
+
+    // every lane with the same key and block, through the shared schedule
+    for ( int a = 0; a < ANSWER_COUNT; a++ ) {
+        TDESContext ctx;
+        tdesInit( &ctx, knownAnswers[ a ].key, TDES_KEY_BYTES );
+        for ( int i = 0; i < lanes; i++ ) {
+            storeBlock( blocks + i * BLOCK_BYTES, knownAnswers[ a ].plain );
+        }
+        engine->crypt( &ctx, blocks, blocks, false );
+        for ( int i = 0; i < lanes; i++ ) {
+            pass = pass && loadBlock( blocks + i * BLOCK_BYTES ) == knownAnswers[ a ].cipher;
+        }
+        engine->crypt( &ctx, blocks, blocks, true );
+        for ( int i = 0; i < lanes; i++ ) {
+            pass = pass && loadBlock( blocks + i * BLOCK_BYTES ) == knownAnswers[ a ].plain;
+        }
+    }
+
+    // the answers taking turns across the lanes, each with its own key
+    for ( int i = 0; i < lanes; i++ ) {
+        keys[ i ] = knownAnswers[ i % ANSWER_COUNT ].key;
+        storeBlock( blocks + i * BLOCK_BYTES, knownAnswers[ i % ANSWER_COUNT ].plain );
+    }
+    engine->cryptKeys( keys, blocks, blocks, false );
+    for ( int i = 0; i < lanes; i++ ) {
+        pass = pass && loadBlock( blocks + i * BLOCK_BYTES ) == knownAnswers[ i % ANSWER_COUNT ].cipher;
+    }
+    engine->cryptKeys( keys, blocks, blocks, true );
+    for ( int i = 0; i < lanes; i++ ) {
+        pass = pass && loadBlock( blocks + i * BLOCK_BYTES ) == knownAnswers[ i % ANSWER_COUNT ].plain;
+    }
+
+    // a different block in every lane, so lanes that get mixed up are caught
+    TDESContext ctx;
+    tdesInit( &ctx, knownAnswers[ 0 ].key, TDES_KEY_BYTES );
+    for ( int i = 0; i < lanes; i++ ) {
+        storeBlock( blocks + i * BLOCK_BYTES, knownAnswers[ 0 ].plain + i );
+    }
+    engine->crypt( &ctx, blocks, blocks, false );
+    for ( int i = 0; i < lanes; i++ ) {
+        pass = pass && loadBlock( blocks + i * BLOCK_BYTES ) ==
+                       tdesEncryptBlock64( &ctx, knownAnswers[ 0 ].plain + i );
+    }
+    return pass;
+}
+
+static long long timeEngine( Engine const *engine )
+{
+    static byte blocks[ BENCH_BLOCKS * BLOCK_BYTES ];
+    TDESContext ctx;
+    tdesInit( &ctx, knownAnswers[ 0 ].key, TDES_KEY_BYTES );
+
+    long long best = 0;
+    for ( int t = 0; t < BENCH_TRIES; t++ ) {
+        struct timespec start, end;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        for ( int i = 0; i < BENCH_BLOCKS; i += engine->blocks ) {
+            engine->crypt( &ctx, blocks + i * BLOCK_BYTES, blocks + i * BLOCK_BYTES, false );
+        }
+        clock_gettime( CLOCK_MONOTONIC, &end );
+        long long nanos = ( end.tv_sec - start.tv_sec ) * NANOS_PER_SECOND + end.tv_nsec - start.tv_nsec;
+        if ( t == 0 || nanos < best ) {
+            best = nanos;
+        }
+    }
+    return best;
+}
+
+Engine const *engineChoose( char const *request )
+{
+    bool fastest = request != NULL && strcmp( request, ENGINE_FASTEST ) == 0;
+    if ( request != NULL && request[ 0 ] != '\0' && !fastest ) {
+        Engine const *engine = engineFind( request );
+        if ( engine == NULL || !engineSupported( engine ) || !engineSelfTest( engine ) ) {
+            return NULL;
+        }
+        return engine;
+    }
+
+    Engine const *choice = NULL;
+    long long best = 0;
+    for ( int i = 0; i < ENGINE_COUNT; i++ ) {
+        Engine const *engine = &engines[ i ];
+        if ( !engineSupported( engine ) || !engineSelfTest( engine ) ) {
+            continue;
+        }
+        if ( !fastest ) {
+            return engine;
+        }
+        long long nanos = timeEngine( engine );
+        if ( choice == NULL || nanos < best ) {
+            choice = engine;
+            best = nanos;
+        }
+    }
+    return choice;
+}
+
+static void selectEngine( void )
+{
+    char const *request = getenv( ENGINE_VARIABLE );
+    Engine const *engine = engineChoose( request );
+    if ( engine == NULL && request != NULL ) {
+        fprintf( stderr, "%s=%s can't be used here, picking an engine instead\n",
+                 ENGINE_VARIABLE, request );
+        engine = engineChoose( NULL );
+    }
+
+    // even if nothing passes, the scalar engine is the one to trust
+    if ( engine != NULL ) {
+        selected = engine;
+    }
+
+    // the self-tests and timing runs aren't part of what --stats measures
+    statsReset();
+}
+
+Engine const *engineSelected( void )
+{
+    return selected;
+}
+
+int engineBlocks( void )
+{
+    return selected->blocks;
+}
+
+void engineCrypt( TDESContext const *ctx, byte out[], byte const in[], bool decrypt )
+{
+    selected->crypt( ctx, out, in, decrypt );
+}
+
+void engineCryptKeys( byte const *const keys[], byte out[], byte const in[], bool decrypt )
+{
+    selected->cryptKeys( keys, out, in, decrypt );
+}
@@ -0,0 +1,115 @@
+/** 
+    @file engine.h
+    @author Jayani Sivakumar
+    Registry of the engines that can encrypt and decrypt batches of blocks.
+    When the program starts, every engine this CPU can run is checked against
+    known answers, and the widest one that passes is used.  The choice can be
+    made by name, or by timing every engine, with the TCRYPT_ENGINE
+    environment variable.
+*/
+
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include <stdbool.h>
+#include "TDES.h"
+#include "bitslice.h"
+
+/** Environment variable that picks an engine by name. */
+#define ENGINE_VARIABLE "TCRYPT_ENGINE"
+
+/** Value of ENGINE_VARIABLE that times every engine and picks the fastest. */
+#define ENGINE_FASTEST "fastest"
+
+/** An engine and its entry points. */
+typedef struct {
+    /** Name used to pick the engine with ENGINE_VARIABLE. */
+    char const *name;
+    /** Number of blocks handled by each call. */
+    int blocks;
+    /** Encrypts or decrypts one batch of blocks with a key schedule. */
+    SliceKernel crypt;
+    /** Encrypts or decrypts one batch of blocks, each with its own key. */
+    SliceKeysKernel cryptKeys;
+} Engine;
+
+/**
+    This function returns the number of engines in the registry.
+    @return number of engines.
+ */
+int engineCount( void );
+
+/**
+    This function returns an engine from the registry, widest first.
+    @param idx index of the engine, from 0 to engineCount() - 1.
+    @return the engine.
+ */
+Engine const *engineAt( int idx );
+
+/**
+    This function finds an engine by name.
+    @param name name of the engine.
+    @return the engine, or NULL if there isn't one with that name.
+ */
+Engine const *engineFind( char const *name );
+
+/**
+    This function reports whether this CPU can run an engine.
+    @param engine the engine.
+    @return true if the engine can be used.
+ */
+bool engineSupported( Engine const *engine );
+
+/**
+    This function checks an engine against the known answers from the unit
+    tests, encrypting and decrypting with both of its entry points, and against
+    the 64-bit reference engine on a batch of different blocks.
+    @param engine the engine, which this CPU has to support.
+    @return true if every answer was right.
+ */
+bool engineSelfTest( Engine const *engine );
+
+/**
+    This function picks an engine the way the program does when it starts.
+    @param request NULL or empty for the widest engine that passes its self-test,
+    ENGINE_FASTEST to time every engine that passes and take the fastest, or the
+    name of an engine.
+    @return the engine, or NULL if the named engine doesn't exist, isn't supported
+    by this CPU or fails its self-test.
+ */
+Engine const *engineChoose( char const *request );
+
+/**
+    This function returns the engine picked when the program started.
+    @return the selected engine.
+ */
+Engine const *engineSelected( void );
+
+/**
+    This function returns the number of blocks handled by each call to engineCrypt()
+    and engineCryptKeys().
+    @return number of blocks in a batch for the selected engine.
+ */
+int engineBlocks( void );
+
+/**
+    This function encrypts or decrypts one batch of engineBlocks() blocks with the
+    selected engine.
+    @param ctx key schedule made by tdesInit().
+    @param out array where the result blocks are stored.
+    @param in array of blocks to encrypt or decrypt, which may be the same as out.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+void engineCrypt( TDESContext const *ctx, byte out[], byte const in[], bool decrypt );
+
+/**
+    This function encrypts or decrypts one batch of engineBlocks() blocks, each with
+    its own key, using the selected engine.
+    @param keys pointer to the TDES_KEY_BYTES key for each block.
+    @param out array where the result blocks are stored.
+    @param in array of blocks to encrypt or decrypt, which may be the same as out.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+void engineCryptKeys( byte const *const keys[], byte out[], byte const in[], bool decrypt );
+
+#endif
@@ -0,0 +1,290 @@
+/**
+    @file gentables.c
+    @author Jayani Sivakumar
+    Generates destables.h, the lookup tables the fast engines derive from
+    the canonical tables in magic.c.  The Makefile runs this before
+    building anything that uses them, so the tables are compiled in as
+    static const data that needs no setup when a program starts and can
+    sit in read-only pages.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "TDES.h"
+#include "bitslice.h"
+#include "magic.h"
+
+/** Number of halves in the input to the subkey permutations, C and D. */
+#define NUM_HALVES 2
+
+/** Number of values printed on each line of a table. */
+#define PER_LINE 4
+
+/**
+    This function compiles a permutation into a lookup table for each input
+    byte, the same way compilePerm() in TDES.c does.
+    @param cp compiled permutation to fill in.
+    @param perm permutation array that specifies which bits to copy.
+    @param n number of bits to permute, at most 64.
+ */
+static void compileTable( CompiledPerm *cp, int const perm[], int n )
+{
+    memset( cp, 0, sizeof( *cp ) );
+    for ( int i = 0; i < n; i++ ) {
+        int bytIndex = ( perm[ i ] - 1 ) / BYTE_SIZE;
+        int bitIndex = ( BYTE_SIZE - 1 ) - ( ( perm[ i ] - 1 ) % BYTE_SIZE );
+        uint64_t outBit = ( uint64_t ) 1 << ( n - 1 - i );
+        for ( int v = 0; v < BYTE_VALUES; v++ ) {
+            if ( ( v >> bitIndex ) & 1 ) {
+                cp->lut[ bytIndex ][ v ] |= outBit;
+            }
+        }
+        if ( bytIndex >= cp->inBytes ) {
+            cp->inBytes = bytIndex + 1;
+        }
+    }
+}
+
+/**
+    This function splits a 48-bit subkey into the two words used for the S-Box
+    lookups, the same way splitSubkey() in TDES.c does.
+    @param K 48-bit subkey in the low-order bits, with bit 1 in bit 47.
+    @return the word for the odd-numbered S-Boxes in the high-order 32 bits and
+    the word for the even-numbered ones in the low-order 32 bits.
+ */
+static uint64_t splitSubkey( uint64_t K )
+{
+    uint64_t split = 0;
+    for ( int i = 0; i < SBOX_COUNT; i++ ) {
+        uint64_t group = ( K >> ( SUBKEY_BITS - SBOX_INPUT_BITS - i * SBOX_INPUT_BITS ) ) &
+                         ( SBOX_INPUTS - 1 );
+        int word = ( SPLIT_WORDS - 1 ) - i % SPLIT_WORDS;
+        int byt = ( GROUPS_PER_WORD - 1 ) - i / SPLIT_WORDS;
+        split |= group << ( word * HALF_BLOCK_BITS + byt * BYTE_SIZE );
+    }
+    return split;
+}
+
+/**
+    This function prints a compiled permutation as a static const definition.
+    @param name name of the table.
+    @param doc doc comment for the table.
+    @param cp compiled permutation to print.
+ */
+static void printCompiled( char const *name, char const *doc, CompiledPerm const *cp )
+{
+    printf( "/** %s */\n", doc );
+    printf( "static const CompiledPerm %s = {\n    %d,\n    {\n", name, cp->inBytes );
+    for ( int i = 0; i < BLOCK_BYTES; i++ ) {
+        printf( "        {" );
+        for ( int v = 0; v < BYTE_VALUES; v++ ) {
+            printf( "%s0x%016llXULL,", v % PER_LINE == 0 ? "\n            " : " ",
+                    ( unsigned long long ) cp->lut[ i ][ v ] );
+        }
+        printf( "\n        },\n" );
+    }
+    printf( "    }\n};\n\n" );
+}
+
+/**
+    This function compiles a permutation and prints it as a static const definition.
+    @param name name of the table.
+    @param doc doc comment for the table.
+    @param perm permutation array to compile.
+    @param n number of bits to permute.
+ */
+static void printPerm( char const *name, char const *doc, int const perm[], int n )
+{
+    static CompiledPerm cp;
+    compileTable( &cp, perm, n );
+    printCompiled( name, doc, &cp );
+}
+
+/**
+    This function prints PC-2 with its output already split into the words used
+    for the S-Box lookups.  Splitting only moves bits, so it can be done to each
+    entry of the compiled table.
+ */
+static void printSplitPerm( void )
+{
+    static CompiledPerm cp;
+    compileTable( &cp, subkeyPerm, SUBKEY_BITS );
+    for ( int i = 0; i < BLOCK_BYTES; i++ ) {
+        for ( int v = 0; v < BYTE_VALUES; v++ ) {
+            cp.lut[ i ][ v ] = splitSubkey( cp.lut[ i ][ v ] );
+        }
+    }
+    printCompiled( "subkeySplitTable",
+                   "The PC-2 permutation, with each subkey split for the S-Box lookups like\n"
+                   "    TDESSchedule.split, the word for S-Boxes 1, 3, 5 and 7 in the high-order\n"
+                   "    32 bits.",
+                   &cp );
+}
+
+/**
+    This function prints the combined S-Box and P permutation tables.
+ */
+static void printSpTable( void )
+{
+    // where each S-Box output bit ends up after P, from zero
+    int outputBit[ HALF_BLOCK_BITS ];
+    for ( int k = 0; k < HALF_BLOCK_BITS; k++ ) {
+        outputBit[ fFunctionPerm[ k ] - 1 ] = k;
+    }
+
+    printf( "/** Combined S-Box and P permutation tables.  Entry spTable[ i ][ v ]\n"
+            "    is the output of S-Box i for input v, already moved to its place in\n"
+            "    the 32-bit result of the f function. */\n" );
+    printf( "static const uint32_t spTable[ SBOX_COUNT ][ SBOX_INPUTS ] = {\n" );
+    for ( int i = 0; i < SBOX_COUNT; i++ ) {
+        printf( "    {" );
+        for ( int v = 0; v < SBOX_INPUTS; v++ ) {
+            int row = ( ( v >> ( SBOX_INPUT_BITS - 1 ) ) << 1 ) | ( v & 1 );
+            int col = ( v >> 1 ) & ( SBOX_COLS - 1 );
+            int value = sBoxTable[ i ][ row ][ col ];
+            uint32_t word = 0;
+            for ( int j = 0; j < SBOX_OUTPUT_BITS; j++ ) {
+                if ( ( value >> ( SBOX_OUTPUT_BITS - 1 - j ) ) & 1 ) {
+                    word |= 1U << ( HALF_BLOCK_BITS - 1 - outputBit[ i * SBOX_OUTPUT_BITS + j ] );
+                }
+            }
+            printf( "%s0x%08XU,", v % PER_LINE == 0 ? "\n        " : " ", word );
+        }
+        printf( "\n    },\n" );
+    }
+    printf( "};\n\n" );
+}
+
+/**
+    This function prints how far C and D have been rotated left when each
+    round's subkey is selected, so a round's halves can be found from C_0
+    and D_0 with one rotation.
+ */
+static void printRotations( void )
+{
+    printf( "/** subkeyRotation[ r ] is the total number of places C_0 and D_0 are\n"
+            "    rotated left to give C_r and D_r.  subkeyRotation[ 0 ] is unused. */\n" );
+    printf( "static const int subkeyRotation[ ROUND_COUNT ] = {" );
+    int total = 0;
+    for ( int round = 0; round < ROUND_COUNT; round++ ) {
+        total += subkeyShiftSchedule[ round ];
+        printf( "%s %d", round == 0 ? "" : ",", total );
+    }
+    printf( " };\n\n" );
+}
+
+/**
+    This function prints the tables for the bitsliced kernels.
+ */
+static void printSliceTables( void )
+{
+    printf( "/** Tables used by the bitsliced kernels. */\n" );
+    printf( "static const SliceTables sliceTables = {\n    {\n" );
+    for ( int i = 0; i < SBOX_COUNT; i++ ) {
+        printf( "        {\n" );
+        for ( int j = 0; j < SBOX_OUTPUT_BITS; j++ ) {
+            printf( "            {" );
+            for ( int g = 0; g < SLICE_GROUPS; g++ ) {
+                // the four inputs that share the first four bits
+                int code = 0;
+                for ( int low = 0; low < PAIR_INPUTS; low++ ) {
+                    int bits = ( g << ( SBOX_INPUT_BITS - SLICE_GROUP_BITS ) ) | low;
+                    int row = ( ( bits >> ( SBOX_INPUT_BITS - 1 ) ) << 1 ) | ( bits & 1 );
+                    int col = ( bits >> 1 ) & ( SBOX_COLS - 1 );
+                    int value = sBoxTable[ i ][ row ][ col ];
+                    if ( ( value >> ( SBOX_OUTPUT_BITS - 1 - j ) ) & 1 ) {
+                        code |= 1 << low;
+                    }
+                }
+                printf( "%s%d", g == 0 ? " " : ", ", code );
+            }
+            printf( " },\n" );
+        }
+        printf( "        },\n" );
+    }
+    printf( "    },\n" );
+
+    // where each S-Box output bit goes in the P permutation
+    int outputBit[ HALF_BLOCK_BITS ];
+    for ( int k = 0; k < HALF_BLOCK_BITS; k++ ) {
+        outputBit[ fFunctionPerm[ k ] - 1 ] = k;
+    }
+    printf( "    {" );
+    for ( int k = 0; k < HALF_BLOCK_BITS; k++ ) {
+        printf( "%s%d", k == 0 ? " " : ", ", outputBit[ k ] );
+    }
+    printf( " },\n    {\n" );
+
+    // following key bit indices through the rotations instead of bit values
+    int C[ HALF_SUBKEY_BITS ];
+    int D[ HALF_SUBKEY_BITS ];
+    for ( int i = 0; i < HALF_SUBKEY_BITS; i++ ) {
+        C[ i ] = leftSubkeyPerm[ i ] - 1;
+        D[ i ] = rightSubkeyPerm[ i ] - 1;
+    }
+    printf( "        { 0 },\n" );
+    for ( int round = 1; round < ROUND_COUNT; round++ ) {
+        for ( int s = 0; s < subkeyShiftSchedule[ round ]; s++ ) {
+            int firstC = C[ 0 ];
+            int firstD = D[ 0 ];
+            for ( int i = 1; i < HALF_SUBKEY_BITS; i++ ) {
+                C[ i - 1 ] = C[ i ];
+                D[ i - 1 ] = D[ i ];
+            }
+            C[ HALF_SUBKEY_BITS - 1 ] = firstC;
+            D[ HALF_SUBKEY_BITS - 1 ] = firstD;
+        }
+        printf( "        {" );
+        for ( int j = 0; j < SUBKEY_BITS; j++ ) {
+            int from = subkeyPerm[ j ] - 1;
+            int bit = from < HALF_SUBKEY_BITS ? C[ from ] : D[ from - HALF_SUBKEY_BITS ];
+            printf( "%s%d", j == 0 ? " " : ", ", bit );
+        }
+        printf( " },\n" );
+    }
+    printf( "    }\n};\n\n" );
+}
+
+/**
+    Program starting point.  It writes destables.h to standard output.
+    @return EXIT_SUCCESS, or EXIT_FAILURE if the output can't be written.
+*/
+int main( void )
+{
+    printf( "/**\n"
+            "    @file destables.h\n"
+            "    Lookup tables derived from magic.c, written by gentables.  Don't\n"
+            "    edit this file, it's made again by the Makefile whenever magic.c\n"
+            "    or gentables.c changes.\n"
+            "*/\n\n" );
+    printf( "#ifndef _DESTABLES_H_\n#define _DESTABLES_H_\n\n" );
+    printf( "#include <stdint.h>\n#include \"TDES.h\"\n#include \"bitslice.h\"\n\n" );
+
+    printSpTable();
+
+    // IP and PC-1 are stored as two halves in magic.c
+    int initial[ BLOCK_BITS ];
+    memcpy( initial, leftInitialPerm, sizeof( leftInitialPerm ) );
+    memcpy( initial + HALF_BLOCK_BITS, rightInitialPerm, sizeof( rightInitialPerm ) );
+    printPerm( "initialPermTable",
+               "The initial permutation (IP), with leftInitialPerm and rightInitialPerm together.",
+               initial, BLOCK_BITS );
+    printPerm( "finalPermTable", "The final permutation (IP^-1).", finalPerm, BLOCK_BITS );
+
+    int subkeyInput[ NUM_HALVES * HALF_SUBKEY_BITS ];
+    memcpy( subkeyInput, leftSubkeyPerm, sizeof( leftSubkeyPerm ) );
+    memcpy( subkeyInput + HALF_SUBKEY_BITS, rightSubkeyPerm, sizeof( rightSubkeyPerm ) );
+    printPerm( "subkeyInputTable",
+               "The PC-1 permutation, with leftSubkeyPerm and rightSubkeyPerm together.",
+               subkeyInput, NUM_HALVES * HALF_SUBKEY_BITS );
+    printPerm( "subkeyPermTable", "The PC-2 permutation used to select each subkey from C and D.",
+               subkeyPerm, SUBKEY_BITS );
+    printSplitPerm();
+
+    printRotations();
+    printSliceTables();
+
+    printf( "#endif\n" );
+    return fflush( stdout ) == 0 && !ferror( stdout ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
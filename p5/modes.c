@@ -0,0 +1,252 @@
+/**
+    @file modes.c
+    @author Jayani Sivakumar
+    Implementation of the ECB, CBC and CTR modes.  CBC decryption and CTR
+    are split into chunks for the pool, while CBC encryption has to go
+    one block at a time.
+*/
+
+#include <string.h>
+#include "modes.h"
+#include "stats.h"
+
+/** Number of blocks handled with each call to tdesCryptBlocks() inside a
+    chunk, so the temporary blocks fit on the stack. */
+#define PIECE_BLOCKS 256
+
+/** Most CBC chunks started with one call to poolRun(), so the ciphertext
+    block before each one can be saved first on the stack. */
+#define BATCH_CHUNKS 256
+
+/** Names of the modes, indexed by mode number. */
+static char const *modeNames[] = { "ecb", "cbc", "ctr" };
+
+/** Everything the threads need to decrypt one batch of CBC chunks. */
+typedef struct {
+    /** Key schedule shared by every thread. */
+    TDESContext const *ctx;
+    /** Array where the plaintext blocks are stored. */
+    byte *out;
+    /** Array of ciphertext blocks. */
+    byte const *in;
+    /** Total number of blocks. */
+    size_t blocks;
+    /** Number of the first chunk in this batch. */
+    size_t firstChunk;
+    /** Ciphertext block before each chunk in the batch, saved before any
+        of them could be overwritten. */
+    uint64_t const *prev;
+} CbcJob;
+
+/** Everything the threads need to encrypt or decrypt data in CTR mode. */
+typedef struct {
+    /** Key schedule shared by every thread. */
+    TDESContext const *ctx;
+    /** Array where the result is stored. */
+    byte *out;
+    /** Data to encrypt or decrypt, starting on a block boundary. */
+    byte const *in;
+    /** Number of bytes of data. */
+    size_t len;
+    /** Counter value for the first block. */
+    uint64_t counter;
+} CtrJob;
+
+/**
+    Helper method run by the pool for each chunk of a CbcJob. The chunk is handled
+    a piece at a time from its end, so when it's decrypted in place, every ciphertext
+    block is read before it's overwritten.
+    @param arg pointer to the CbcJob.
+    @param job number of the chunk within the batch.
+ */
+static void cbcChunk( void *arg, size_t job );
+
+/**
+    Helper method that XORs data with the CTR key stream, starting on a block boundary.
+    @param ctx key schedule made by tdesInit().
+    @param out array where the result is stored.
+    @param in data to encrypt or decrypt.
+    @param len number of bytes of data.
+    @param counter counter value for the first block.
+ */
+static void ctrRun( TDESContext const *ctx, byte out[], byte const in[], size_t len,
+                    uint64_t counter );
+
+/**
+    Helper method run by the pool for each chunk of a CtrJob.
+    @param arg pointer to the CtrJob.
+    @param job number of the chunk.
+ */
+static void ctrChunk( void *arg, size_t job );
+
+int modeParse( const char *name )
+{
+    for ( int mode = MODE_ECB; mode <= MODE_CTR; mode++ ) {
+        if ( strcmp( name, modeNames[ mode ] ) == 0 ) {
+            return mode;
+        }
+    }
+    return -1;
+}
+
+bool modeHasIV( int mode )
+{
+    return mode != MODE_ECB;
+}
+
+bool modeValidLength( int mode, uint64_t len )
+{
+    uint64_t header = modeHasIV( mode ) ? BLOCK_BYTES : 0;
+    if ( mode == MODE_CTR ) {
+        return len >= header;
+    }
+    return len > header && len % BLOCK_BYTES == 0;
+}
+
+uint64_t modeOutputLen( int mode, bool decrypt, uint64_t len )
+{
+    uint64_t header = modeHasIV( mode ) ? BLOCK_BYTES : 0;
+    if ( decrypt ) {
+        return len < header ? 0 : len - header;
+    }
+    if ( mode == MODE_CTR ) {
+        return header + len;
+    }
+    return header + tdesPaddedLen( len );
+}
+
+uint64_t cbcEncrypt( TDESContext const *ctx, byte out[], byte const in[], size_t blocks,
+                     uint64_t chain )
+{
+    STATS_BEGIN( STAGE_SCALAR );
+    for ( size_t i = 0; i < blocks; i++ ) {
+        chain = tdesEncryptBlock64( ctx, loadBlock( in + i * BLOCK_BYTES ) ^ chain );
+        storeBlock( out + i * BLOCK_BYTES, chain );
+    }
+    STATS_END( STAGE_SCALAR, blocks * BLOCK_BYTES );
+    return chain;
+}
+
+static void cbcChunk( void *arg, size_t job )
+{
+    CbcJob const *work = arg;
+    size_t start = ( work->firstChunk + job ) * CHUNK_BLOCKS;
+    size_t end = work->blocks - start < CHUNK_BLOCKS ? work->blocks : start + CHUNK_BLOCKS;
+
+    byte plain[ PIECE_BLOCKS * BLOCK_BYTES ];
+    for ( size_t b = end; b > start; ) {
+        size_t a = b - start < PIECE_BLOCKS ? start : b - PIECE_BLOCKS;
+        tdesCryptBlocks( work->ctx, plain, work->in + a * BLOCK_BYTES, b - a, true );
+
+        // going backward, the block before this one is still ciphertext
+        for ( size_t i = b; i-- > a; ) {
+            uint64_t prev = work->prev[ job ];
+            if ( i > start ) {
+                prev = loadBlock( work->in + ( i - 1 ) * BLOCK_BYTES );
+            }
+            storeBlock( work->out + i * BLOCK_BYTES, loadBlock( plain + ( i - a ) * BLOCK_BYTES ) ^ prev );
+        }
+        b = a;
+    }
+}
+
+uint64_t cbcDecrypt( TDESContext const *ctx, Pool *pool, byte out[], byte const in[],
+                     size_t blocks, uint64_t chain )
+{
+    if ( blocks == 0 ) {
+        return chain;
+    }
+    uint64_t last = loadBlock( in + ( blocks - 1 ) * BLOCK_BYTES );
+
+    size_t chunks = ( blocks + CHUNK_BLOCKS - 1 ) / CHUNK_BLOCKS;
+    for ( size_t first = 0; first < chunks; first += BATCH_CHUNKS ) {
+        size_t count = chunks - first < BATCH_CHUNKS ? chunks - first : BATCH_CHUNKS;
+
+        // the block before each chunk, read before any thread can replace it
+        uint64_t prev[ BATCH_CHUNKS ];
+        prev[ 0 ] = chain;
+        for ( size_t j = 1; j < count; j++ ) {
+            prev[ j ] = loadBlock( in + ( ( first + j ) * CHUNK_BLOCKS - 1 ) * BLOCK_BYTES );
+        }
+        size_t end = ( first + count ) * CHUNK_BLOCKS;
+        if ( end < blocks ) {
+            chain = loadBlock( in + ( end - 1 ) * BLOCK_BYTES );
+        }
+
+        CbcJob work = { ctx, out, in, blocks, first, prev };
+        poolRun( pool, count, cbcChunk, &work );
+    }
+    return last;
+}
+
+static void ctrRun( TDESContext const *ctx, byte out[], byte const in[], size_t len,
+                    uint64_t counter )
+{
+    byte stream[ PIECE_BLOCKS * BLOCK_BYTES ];
+    while ( len > 0 ) {
+        size_t count = ( len + BLOCK_BYTES - 1 ) / BLOCK_BYTES;
+        if ( count > PIECE_BLOCKS ) {
+            count = PIECE_BLOCKS;
+        }
+        for ( size_t i = 0; i < count; i++ ) {
+            storeBlock( stream + i * BLOCK_BYTES, counter + i );
+        }
+        tdesCryptBlocks( ctx, stream, stream, count, false );
+
+        size_t bytes = count * BLOCK_BYTES < len ? count * BLOCK_BYTES : len;
+        for ( size_t i = 0; i < bytes; i++ ) {
+            out[ i ] = in[ i ] ^ stream[ i ];
+        }
+        out += bytes;
+        in += bytes;
+        len -= bytes;
+        counter += count;
+    }
+}
+
+static void ctrChunk( void *arg, size_t job )
+{
+    CtrJob const *work = arg;
+    size_t start = job * CHUNK_BLOCKS * BLOCK_BYTES;
+    size_t len = work->len - start < CHUNK_BLOCKS * BLOCK_BYTES ? work->len - start
+                                                                : CHUNK_BLOCKS * BLOCK_BYTES;
+    ctrRun( work->ctx, work->out + start, work->in + start, len,
+            work->counter + job * CHUNK_BLOCKS );
+}
+
+void ctrCrypt( TDESContext const *ctx, Pool *pool, byte out[], byte const in[], size_t len,
+               uint64_t iv, uint64_t offset )
+{
+    uint64_t counter = iv + offset / BLOCK_BYTES;
+
+    // finishing a block that was started before offset
+    size_t skip = offset % BLOCK_BYTES;
+    if ( skip > 0 && len > 0 ) {
+        byte stream[ BLOCK_BYTES ];
+        storeBlock( stream, tdesEncryptBlock64( ctx, counter ) );
+        size_t take = BLOCK_BYTES - skip < len ? BLOCK_BYTES - skip : len;
+        for ( size_t i = 0; i < take; i++ ) {
+            out[ i ] = in[ i ] ^ stream[ skip + i ];
+        }
+        out += take;
+        in += take;
+        len -= take;
+        counter++;
+    }
+
+    CtrJob work = { ctx, out, in, len, counter };
+    size_t chunkBytes = CHUNK_BLOCKS * BLOCK_BYTES;
+    poolRun( pool, ( len + chunkBytes - 1 ) / chunkBytes, ctrChunk, &work );
+}
+
+void modeDecryptAt( TDESContext const *ctx, Pool *pool, int mode, byte out[], byte const in[],
+                    size_t blocks, uint64_t first, uint64_t chain )
+{
+    if ( mode == MODE_CBC ) {
+        cbcDecrypt( ctx, pool, out, in, blocks, chain );
+    } else if ( mode == MODE_CTR ) {
+        ctrCrypt( ctx, pool, out, in, blocks * BLOCK_BYTES, chain, first * BLOCK_BYTES );
+    } else {
+        tdesCryptBlocksParallel( ctx, pool, out, in, blocks, true );
+    }
+}
@@ -0,0 +1,122 @@
+/** 
+    @file modes.h
+    @author Jayani Sivakumar
+    Block cipher modes of operation built on the Triple DES engine.  ECB
+    encrypts each block on its own, CBC chains every block to the one
+    before it, and CTR encrypts a counter to get a key stream that's
+    XORed with the data.
+*/
+
+#ifndef _MODES_H_
+#define _MODES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "TDES.h"
+
+/** Electronic codebook mode, with no IV. */
+#define MODE_ECB 0
+
+/** Cipher block chaining mode, with padding and a random IV in front of the ciphertext. */
+#define MODE_CBC 1
+
+/** Counter mode, with no padding and a random IV in front of the ciphertext. */
+#define MODE_CTR 2
+
+/**
+    This function looks up a mode by the name used on the command line.
+    @param name name of the mode, ecb, cbc or ctr.
+    @return MODE_ECB, MODE_CBC or MODE_CTR, or -1 if the name isn't a mode.
+ */
+int modeParse( const char *name );
+
+/**
+    This function reports whether the given mode puts an IV in front of the ciphertext.
+    @param mode MODE_ECB, MODE_CBC or MODE_CTR.
+    @return true if the ciphertext starts with an IV, else false.
+ */
+bool modeHasIV( int mode );
+
+/**
+    This function reports whether data of the given length could be a whole ciphertext
+    for the given mode.
+    @param mode MODE_ECB, MODE_CBC or MODE_CTR.
+    @param len length in bytes of the ciphertext.
+    @return true if the length is valid, else false.
+ */
+bool modeValidLength( int mode, uint64_t len );
+
+/**
+    This function returns the most bytes encrypting or decrypting data of the given
+    length can produce, IV and padding included.
+    @param mode MODE_ECB, MODE_CBC or MODE_CTR.
+    @param decrypt true for decryption, false for encryption.
+    @param len length in bytes of the input.
+    @return upper bound on the length of the output.
+ */
+uint64_t modeOutputLen( int mode, bool decrypt, uint64_t len );
+
+/**
+    This function encrypts blocks in CBC mode. Each block depends on the one before it,
+    so this runs in the calling thread.
+    @param ctx key schedule made by tdesInit().
+    @param out array where the ciphertext blocks are stored, which may be the same as in.
+    @param in array of plaintext blocks.
+    @param blocks number of blocks.
+    @param chain the IV, or the last ciphertext block from the previous call.
+    @return the last ciphertext block, to chain into the next call.
+ */
+uint64_t cbcEncrypt( TDESContext const *ctx, byte out[], byte const in[], size_t blocks,
+                     uint64_t chain );
+
+/**
+    This function decrypts blocks in CBC mode. Every block only needs its own ciphertext
+    and the one before it, so the blocks are split into chunks that the pool's threads
+    decrypt at the same time.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param out array where the plaintext blocks are stored. It may be the same as in,
+    but it must not overlap it any other way.
+    @param in array of ciphertext blocks.
+    @param blocks number of blocks.
+    @param chain the IV, or the last ciphertext block from the previous call.
+    @return the last ciphertext block, to chain into the next call.
+ */
+uint64_t cbcDecrypt( TDESContext const *ctx, Pool *pool, byte out[], byte const in[],
+                     size_t blocks, uint64_t chain );
+
+/**
+    This function encrypts or decrypts data in CTR mode, which are the same operation.
+    The key stream block for block i of the data is the encryption of iv + i, so any
+    part of the data can be handled on its own, and the chunks are split up among the
+    pool's threads.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param out array where the result is stored, which may be the same as in.
+    @param in data to encrypt or decrypt.
+    @param len number of bytes of data.
+    @param iv initial counter value.
+    @param offset position of in[ 0 ] from the start of the data, in bytes.
+ */
+void ctrCrypt( TDESContext const *ctx, Pool *pool, byte out[], byte const in[], size_t len,
+               uint64_t iv, uint64_t offset );
+
+/**
+    This function decrypts a run of whole blocks from anywhere in the ciphertext, for
+    reading part of the data without decrypting everything before it. It doesn't
+    remove any padding.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param mode MODE_ECB, MODE_CBC or MODE_CTR.
+    @param out array where the plaintext blocks are stored, which may be the same as in.
+    @param in array of ciphertext blocks, not counting the IV.
+    @param blocks number of blocks.
+    @param first number of the first block in the ciphertext, from zero after the IV.
+    @param chain for CBC, the ciphertext block before the first one, or the IV if
+    first is zero. For CTR, the IV. It's not used for ECB.
+ */
+void modeDecryptAt( TDESContext const *ctx, Pool *pool, int mode, byte out[], byte const in[],
+                    size_t blocks, uint64_t first, uint64_t chain );
+
+#endif
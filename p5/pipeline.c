@@ -0,0 +1,216 @@
+/** 
+    @file pipeline.c
+    @author Jayani Sivakumar
+    Implementation of the reader, crypto and writer pipeline.  Buffers go
+    around two loops of rings: input buffers from the reader to the crypto
+    stage and back, and output buffers from the crypto stage to the writer
+    and back.  Each ring has one thread at each end.
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "pipeline.h"
+#include "ring.h"
+
+/** One buffer passed between the stages. */
+typedef struct {
+    /** Contents of the buffer. */
+    byte *data;
+    /** Number of bytes in use. */
+    size_t len;
+} PipeBuffer;
+
+/** State shared by the stages of the pipeline. */
+typedef struct {
+    /** File being read. */
+    FILE *in;
+    /** File being written. */
+    FILE *out;
+    /** Input buffers ready to be filled, from the crypto stage to the reader. */
+    Ring emptyIn;
+    /** Input buffers that have been filled, from the reader to the crypto stage.
+        An empty one means the reader is done. */
+    Ring fullIn;
+    /** Output buffers ready to be filled, from the writer to the crypto stage. */
+    Ring emptyOut;
+    /** Output buffers to write, from the crypto stage to the writer.  NULL
+        means there's nothing more. */
+    Ring fullOut;
+    /** True if the input couldn't be read, set by the reader before it's done. */
+    bool readFailed;
+    /** True if the output couldn't be written, set by the writer. */
+    bool writeFailed;
+    /** Set by the writer when there's no point reading any more. */
+    bool stop;
+} Pipeline;
+
+/**
+    Start routine for the reader thread.
+    @param arg pointer to the Pipeline.
+    @return NULL.
+ */
+static void *readerMain( void *arg );
+
+/**
+    Start routine for the writer thread.
+    @param arg pointer to the Pipeline.
+    @return NULL.
+ */
+static void *writerMain( void *arg );
+
+/**
+    Helper method that does all of the work in the calling thread, one buffer at a time.
+    @param in file to read.
+    @param out file to write.
+    @param stream stream set up for encryption or decryption.
+    @param inBuffer buffer of PIPELINE_BYTES for the input.
+    @param outBuffer buffer of PIPELINE_BYTES + STREAM_SLACK for the output.
+    @return same as pipelineRun().
+ */
+static int runSerial( FILE *in, FILE *out, TDESStream *stream, byte inBuffer[], byte outBuffer[] );
+
+/**
+    Helper method that runs the crypto stage in the calling thread, once the reader
+    and writer have been started.
+    @param pipe the pipeline.
+    @param stream stream set up for encryption or decryption.
+    @return status from streamFinal(), or TDES_OK if the input ended early.
+ */
+static int runCrypto( Pipeline *pipe, TDESStream *stream );
+
+static void *readerMain( void *arg )
+{
+    Pipeline *pipe = arg;
+    size_t len;
+    do {
+        PipeBuffer *buffer = ringPop( &pipe->emptyIn );
+        len = 0;
+        if ( !__atomic_load_n( &pipe->stop, __ATOMIC_ACQUIRE ) ) {
+            len = readBytes( pipe->in, buffer->data, PIPELINE_BYTES );
+        }
+        if ( len == 0 && ferror( pipe->in ) ) {
+            pipe->readFailed = true;
+        }
+        buffer->len = len;
+        ringPush( &pipe->fullIn, buffer );
+    } while ( len > 0 );
+    return NULL;
+}
+
+static void *writerMain( void *arg )
+{
+    Pipeline *pipe = arg;
+    PipeBuffer *buffer;
+    while ( ( buffer = ringPop( &pipe->fullOut ) ) != NULL ) {
+        // after a failure, buffers still go back so the crypto stage can finish
+        if ( !pipe->writeFailed && !writeBytes( pipe->out, buffer->data, buffer->len ) ) {
+            pipe->writeFailed = true;
+            __atomic_store_n( &pipe->stop, true, __ATOMIC_RELEASE );
+        }
+        ringPush( &pipe->emptyOut, buffer );
+    }
+    return NULL;
+}
+
+static int runSerial( FILE *in, FILE *out, TDESStream *stream, byte inBuffer[], byte outBuffer[] )
+{
+    int status = TDES_OK;
+    size_t len;
+    while ( status == TDES_OK && ( len = readBytes( in, inBuffer, PIPELINE_BYTES ) ) > 0 ) {
+        size_t produced = streamUpdate( stream, outBuffer, inBuffer, len );
+        if ( !writeBytes( out, outBuffer, produced ) ) {
+            status = WRITE_ERROR;
+        }
+    }
+    if ( status == TDES_OK && ferror( in ) ) {
+        status = READ_ERROR;
+    }
+    
+    // the last block has the padding
+    if ( status == TDES_OK ) {
+        status = streamFinal( stream, outBuffer, &len );
+    }
+    if ( status == TDES_OK && !writeBytes( out, outBuffer, len ) ) {
+        status = WRITE_ERROR;
+    }
+    return status;
+}
+
+static int runCrypto( Pipeline *pipe, TDESStream *stream )
+{
+    PipeBuffer *in;
+    while ( ( in = ringPop( &pipe->fullIn ) )->len > 0 ) {
+        PipeBuffer *out = ringPop( &pipe->emptyOut );
+        out->len = streamUpdate( stream, out->data, in->data, in->len );
+        ringPush( &pipe->emptyIn, in );
+        ringPush( &pipe->fullOut, out );
+    }
+    
+    // the last block has the padding, unless the input was cut short
+    int status = TDES_OK;
+    if ( !pipe->readFailed && !__atomic_load_n( &pipe->stop, __ATOMIC_ACQUIRE ) ) {
+        PipeBuffer *out = ringPop( &pipe->emptyOut );
+        status = streamFinal( stream, out->data, &out->len );
+        if ( status != TDES_OK ) {
+            out->len = 0;
+        }
+        ringPush( &pipe->fullOut, out );
+    }
+    ringPush( &pipe->fullOut, NULL );
+    return status;
+}
+
+int pipelineRun( FILE *in, FILE *out, TDESStream *stream )
+{
+    size_t outBytes = PIPELINE_BYTES + STREAM_SLACK;
+    byte *memory = malloc( PIPELINE_BUFFERS * ( PIPELINE_BYTES + outBytes ) );
+    if ( memory == NULL ) {
+        exit( EXIT_FAILURE );
+    }
+    PipeBuffer inBuffers[ PIPELINE_BUFFERS ];
+    PipeBuffer outBuffers[ PIPELINE_BUFFERS ];
+    for ( int i = 0; i < PIPELINE_BUFFERS; i++ ) {
+        inBuffers[ i ].data = memory + i * PIPELINE_BYTES;
+        outBuffers[ i ].data = memory + PIPELINE_BUFFERS * PIPELINE_BYTES + i * outBytes;
+    }
+    
+    Pipeline pipe = { in, out };
+    int rings = 0;
+    Ring *all[] = { &pipe.emptyIn, &pipe.fullIn, &pipe.emptyOut, &pipe.fullOut };
+    int ringCount = sizeof( all ) / sizeof( all[ 0 ] );
+    while ( rings < ringCount && ringInit( all[ rings ] ) ) {
+        rings++;
+    }
+    
+    // every buffer starts out empty, before the threads that will pass them back start
+    pthread_t reader, writer;
+    int status;
+    if ( rings == ringCount && pthread_create( &writer, NULL, writerMain, &pipe ) == 0 ) {
+        for ( int i = 0; i < PIPELINE_BUFFERS; i++ ) {
+            ringPush( &pipe.emptyIn, &inBuffers[ i ] );
+            ringPush( &pipe.emptyOut, &outBuffers[ i ] );
+        }
+        if ( pthread_create( &reader, NULL, readerMain, &pipe ) == 0 ) {
+            status = runCrypto( &pipe, stream );
+            pthread_join( reader, NULL );
+            pthread_join( writer, NULL );
+            if ( pipe.readFailed ) {
+                status = READ_ERROR;
+            } else if ( pipe.writeFailed ) {
+                status = WRITE_ERROR;
+            }
+        } else {
+            ringPush( &pipe.fullOut, NULL );
+            pthread_join( writer, NULL );
+            status = runSerial( in, out, stream, inBuffers[ 0 ].data, outBuffers[ 0 ].data );
+        }
+    } else {
+        status = runSerial( in, out, stream, inBuffers[ 0 ].data, outBuffers[ 0 ].data );
+    }
+    
+    while ( rings > 0 ) {
+        ringDestroy( all[ --rings ] );
+    }
+    free( memory );
+    return status;
+}
@@ -0,0 +1,37 @@
+/** 
+    @file pipeline.h
+    @author Jayani Sivakumar
+    Pipelined encryption or decryption of a whole file.  A reader thread
+    fills buffers from the input and a writer thread empties them to the
+    output, while the calling thread runs the stream on the buffers in
+    between, so reading and writing overlap with the crypto.
+*/
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdio.h>
+#include "stream.h"
+
+/** Number of bytes read from the input at a time.  It's a whole number
+    of chunks for the thread pool. */
+#define PIPELINE_BYTES ( 1024 * 1024 )
+
+/** Number of buffers on each side of the crypto stage, so one can be read
+    or written while the other is being encrypted or decrypted. */
+#define PIPELINE_BUFFERS 2
+
+/**
+    This function encrypts or decrypts everything in the input file and writes the
+    result to the output file, a buffer at a time so memory use doesn't depend on the
+    size of the file.  If the reader and writer threads can't be started, the same
+    work is done one step at a time in the calling thread.
+    @param in file to read.
+    @param out file to write.
+    @param stream stream set up for encryption or decryption.
+    @return TDES_OK if successful, an error code from streamFinal(), READ_ERROR
+    or WRITE_ERROR.
+ */
+int pipelineRun( FILE *in, FILE *out, TDESStream *stream );
+
+#endif
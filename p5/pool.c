@@ -0,0 +1,174 @@
+/** 
+    @file pool.c
+    @author Jayani Sivakumar
+    A pool of worker threads that run numbered jobs in parallel.  The
+    workers wait on a condition variable between calls to poolRun(), and
+    take jobs from a shared counter while a call is running.
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+/** Representation of a pool of worker threads. */
+struct PoolStruct {
+    /** Worker threads started for the pool. */
+    pthread_t *workers;
+    /** Number of worker threads, not counting the thread calling poolRun(). */
+    int workerCount;
+    
+    /** Lock for all the fields below. */
+    pthread_mutex_t lock;
+    /** Signaled when a new call to poolRun() starts or the pool is destroyed. */
+    pthread_cond_t start;
+    /** Signaled when the last job of a call to poolRun() is done. */
+    pthread_cond_t done;
+    
+    /** Task for the current call to poolRun(). */
+    PoolTask task;
+    /** Argument for the current task. */
+    void *arg;
+    /** Number of jobs in the current call. */
+    size_t jobs;
+    /** Next job to hand out. */
+    size_t next;
+    /** Number of jobs that are done. */
+    size_t finished;
+    /** Counts calls to poolRun(), so workers can tell when a new one starts. */
+    unsigned long generation;
+    /** True when the workers should exit. */
+    bool quit;
+};
+
+/**
+    Helper method that runs jobs from the current call to poolRun() until
+    there are none left to hand out.  The caller must hold the pool's lock,
+    and it's held again when this returns.
+    @param pool the pool.
+ */
+static void runJobs( Pool *pool );
+
+/**
+    Start routine for the worker threads.
+    @param arg pointer to the pool.
+    @return NULL.
+ */
+static void *workerMain( void *arg );
+
+static void runJobs( Pool *pool )
+{
+    while ( pool->next < pool->jobs ) {
+        size_t job = pool->next++;
+        pthread_mutex_unlock( &pool->lock );
+        pool->task( pool->arg, job );
+        pthread_mutex_lock( &pool->lock );
+        
+        pool->finished++;
+        if ( pool->finished == pool->jobs ) {
+            pthread_cond_signal( &pool->done );
+        }
+    }
+}
+
+static void *workerMain( void *arg )
+{
+    Pool *pool = arg;
+    unsigned long seen = 0;
+    
+    pthread_mutex_lock( &pool->lock );
+    while ( true ) {
+        // waiting for a new call to poolRun()
+        while ( !pool->quit && pool->generation == seen ) {
+            pthread_cond_wait( &pool->start, &pool->lock );
+        }
+        if ( pool->quit ) {
+            break;
+        }
+        seen = pool->generation;
+        runJobs( pool );
+    }
+    pthread_mutex_unlock( &pool->lock );
+    return NULL;
+}
+
+Pool *poolCreate( int threads )
+{
+    Pool *pool = malloc( sizeof( Pool ) );
+    if ( pool == NULL ) {
+        return NULL;
+    }
+    pool->workerCount = threads > 1 ? threads - 1 : 0;
+    pool->workers = malloc( ( pool->workerCount + 1 ) * sizeof( pthread_t ) );
+    if ( pool->workers == NULL ) {
+        free( pool );
+        return NULL;
+    }
+    pthread_mutex_init( &pool->lock, NULL );
+    pthread_cond_init( &pool->start, NULL );
+    pthread_cond_init( &pool->done, NULL );
+    pool->jobs = pool->next = pool->finished = 0;
+    pool->generation = 0;
+    pool->quit = false;
+    
+    for ( int i = 0; i < pool->workerCount; i++ ) {
+        if ( pthread_create( &pool->workers[ i ], NULL, workerMain, pool ) != 0 ) {
+            // keeping the threads that did start
+            pool->workerCount = i;
+            poolDestroy( pool );
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+int poolThreads( Pool const *pool )
+{
+    return pool ? pool->workerCount + 1 : 1;
+}
+
+void poolRun( Pool *pool, size_t jobs, PoolTask task, void *arg )
+{
+    if ( pool == NULL ) {
+        for ( size_t job = 0; job < jobs; job++ ) {
+            task( arg, job );
+        }
+        return;
+    }
+    
+    pthread_mutex_lock( &pool->lock );
+    pool->task = task;
+    pool->arg = arg;
+    pool->jobs = jobs;
+    pool->next = 0;
+    pool->finished = 0;
+    pool->generation++;
+    pthread_cond_broadcast( &pool->start );
+    
+    // this thread works on the jobs too, then waits for the others
+    runJobs( pool );
+    while ( pool->finished < pool->jobs ) {
+        pthread_cond_wait( &pool->done, &pool->lock );
+    }
+    pthread_mutex_unlock( &pool->lock );
+}
+
+void poolDestroy( Pool *pool )
+{
+    if ( pool == NULL ) {
+        return;
+    }
+    pthread_mutex_lock( &pool->lock );
+    pool->quit = true;
+    pthread_cond_broadcast( &pool->start );
+    pthread_mutex_unlock( &pool->lock );
+    
+    for ( int i = 0; i < pool->workerCount; i++ ) {
+        pthread_join( pool->workers[ i ], NULL );
+    }
+    pthread_mutex_destroy( &pool->lock );
+    pthread_cond_destroy( &pool->start );
+    pthread_cond_destroy( &pool->done );
+    free( pool->workers );
+    free( pool );
+}
@@ -0,0 +1,51 @@
+/** 
+    @file pool.h
+    @author Jayani Sivakumar
+    A pool of worker threads that run numbered jobs in parallel.
+*/
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+
+/** Function run for each job.  It's given the argument passed to
+    poolRun() and the number of the job, from zero. */
+typedef void (*PoolTask)( void *arg, size_t job );
+
+/** Opaque type for a pool of worker threads. */
+typedef struct PoolStruct Pool;
+
+/**
+    This function starts a pool of worker threads. The thread that calls poolRun()
+    also works on the jobs, so a pool for n threads only starts n - 1 of them.
+    @param threads number of threads that should work on each call to poolRun().
+    @return pointer to the new pool, or NULL if the threads can't be started.
+ */
+Pool *poolCreate( int threads );
+
+/**
+    This function returns the number of threads that work on each call to poolRun().
+    @param pool the pool, or NULL for a single thread.
+    @return number of threads.
+ */
+int poolThreads( Pool const *pool );
+
+/**
+    This function runs task for every job number from 0 up to jobs - 1, spread across
+    the threads of the pool, and returns once all of them are done. Jobs are handed out
+    in order, one at a time, as threads become free.
+    @param pool the pool, or NULL to run every job in the calling thread.
+    @param jobs number of jobs to run.
+    @param task function to run for each job.
+    @param arg argument passed to every call to task.
+ */
+void poolRun( Pool *pool, size_t jobs, PoolTask task, void *arg );
+
+/**
+    This function stops the worker threads and frees the pool.
+    @param pool the pool to free, or NULL.
+ */
+void poolDestroy( Pool *pool );
+
+#endif
@@ -0,0 +1,179 @@
+/** 
+    @file records.c
+    @author Jayani Sivakumar
+    Implementation of batched Triple DES for records with their own keys.
+    Each thread checks and pads its records right in their output buffers,
+    then feeds their blocks through the selected engine a batch at a time,
+    whichever records they come from.
+*/
+
+#include <string.h>
+#include "records.h"
+#include "engine.h"
+
+/** Number of records handed to a thread at a time. */
+#define RECORD_JOB_COUNT 1024
+
+/** Everything the threads need to work on an array of records. */
+typedef struct {
+    /** Array of records. */
+    TDESRecord *records;
+    /** Number of records. */
+    size_t count;
+    /** True to decrypt, false to encrypt. */
+    bool decrypt;
+} RecordJob;
+
+/** Blocks gathered from the records for one call to the kernel. */
+typedef struct {
+    /** Number of blocks gathered so far. */
+    int used;
+    /** Blocks to encrypt or decrypt. */
+    byte blocks[ SLICE_MAX_BLOCKS * BLOCK_BYTES ];
+    /** Key for each block. */
+    byte const *keys[ SLICE_MAX_BLOCKS ];
+    /** Where each block goes back to once it's done. */
+    byte *where[ SLICE_MAX_BLOCKS ];
+} RecordBatch;
+
+/**
+    Helper method that checks a record and copies its data to the output
+    buffer, padded if it's being encrypted, so its blocks can be done in place.
+    @param rec record to prepare, with status set if it can't be done.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+static void prepareRecord( TDESRecord *rec, bool decrypt );
+
+/**
+    Helper method that runs the kernel on the blocks gathered in a batch and
+    copies them back to their records.  Empty lanes at the end are filled
+    in with a copy of the first block.
+    @param batch blocks to run, which is left empty.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+static void flushBatch( RecordBatch *batch, bool decrypt );
+
+/**
+    Helper method run by the pool for each group of RECORD_JOB_COUNT records.
+    @param arg pointer to the RecordJob.
+    @param job number of the group.
+ */
+static void recordChunk( void *arg, size_t job );
+
+/**
+    Helper method that hands the records to the pool in groups.
+    @param pool threads to share the work, or NULL.
+    @param records array of records.
+    @param count number of records.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+static void runRecords( Pool *pool, TDESRecord records[], size_t count, bool decrypt );
+
+static void prepareRecord( TDESRecord *rec, bool decrypt )
+{
+    rec->outLen = 0;
+    size_t len = rec->inLen;
+    if ( decrypt ) {
+        if ( len == 0 || len % BLOCK_BYTES != 0 ) {
+            rec->status = TDES_ERR_LENGTH;
+            return;
+        }
+    } else {
+        len = tdesPaddedLen( rec->inLen );
+    }
+    if ( rec->outCap < len ) {
+        rec->status = TDES_ERR_SPACE;
+        return;
+    }
+    
+    if ( rec->out != rec->in ) {
+        memmove( rec->out, rec->in, rec->inLen );
+    }
+    if ( !decrypt ) {
+        byte padCount = len - rec->inLen;
+        memset( rec->out + rec->inLen, padCount, padCount );
+    }
+    rec->outLen = len;
+    rec->status = TDES_OK;
+}
+
+static void flushBatch( RecordBatch *batch, bool decrypt )
+{
+    int lanes = engineBlocks();
+    for ( int i = batch->used; i < lanes; i++ ) {
+        memcpy( batch->blocks + i * BLOCK_BYTES, batch->blocks, BLOCK_BYTES );
+        batch->keys[ i ] = batch->keys[ 0 ];
+    }
+    engineCryptKeys( batch->keys, batch->blocks, batch->blocks, decrypt );
+    
+    for ( int i = 0; i < batch->used; i++ ) {
+        memcpy( batch->where[ i ], batch->blocks + i * BLOCK_BYTES, BLOCK_BYTES );
+    }
+    batch->used = 0;
+}
+
+static void recordChunk( void *arg, size_t job )
+{
+    RecordJob const *work = arg;
+    size_t start = job * RECORD_JOB_COUNT;
+    size_t end = work->count - start < RECORD_JOB_COUNT ? work->count : start + RECORD_JOB_COUNT;
+    
+    RecordBatch batch;
+    batch.used = 0;
+    int lanes = engineBlocks();
+    for ( size_t r = start; r < end; r++ ) {
+        TDESRecord *rec = &work->records[ r ];
+        prepareRecord( rec, work->decrypt );
+        if ( rec->status != TDES_OK ) {
+            continue;
+        }
+        
+        // the record's blocks take the next free lanes
+        for ( size_t pos = 0; pos < rec->outLen; pos += BLOCK_BYTES ) {
+            memcpy( batch.blocks + batch.used * BLOCK_BYTES, rec->out + pos, BLOCK_BYTES );
+            batch.keys[ batch.used ] = rec->key;
+            batch.where[ batch.used ] = rec->out + pos;
+            if ( ++batch.used == lanes ) {
+                flushBatch( &batch, work->decrypt );
+            }
+        }
+    }
+    if ( batch.used > 0 ) {
+        flushBatch( &batch, work->decrypt );
+    }
+    
+    if ( !work->decrypt ) {
+        return;
+    }
+    
+    // the padding can only be checked once every block is decrypted
+    for ( size_t r = start; r < end; r++ ) {
+        TDESRecord *rec = &work->records[ r ];
+        if ( rec->status != TDES_OK ) {
+            continue;
+        }
+        int padValue = rec->out[ rec->outLen - 1 ];
+        if ( padValue < 1 || padValue > BLOCK_BYTES ) {
+            rec->status = TDES_ERR_PADDING;
+            rec->outLen = 0;
+        } else {
+            rec->outLen -= padValue;
+        }
+    }
+}
+
+static void runRecords( Pool *pool, TDESRecord records[], size_t count, bool decrypt )
+{
+    RecordJob work = { records, count, decrypt };
+    poolRun( pool, ( count + RECORD_JOB_COUNT - 1 ) / RECORD_JOB_COUNT, recordChunk, &work );
+}
+
+void tdesEncryptRecords( Pool *pool, TDESRecord records[], size_t count )
+{
+    runRecords( pool, records, count, false );
+}
+
+void tdesDecryptRecords( Pool *pool, TDESRecord records[], size_t count )
+{
+    runRecords( pool, records, count, true );
+}
@@ -0,0 +1,57 @@
+/** 
+    @file records.h
+    @author Jayani Sivakumar
+    Batched Triple DES for many small records that each have their own
+    key.  Instead of running tdesInit() and a mostly empty batch for every
+    record, blocks from different records share the lanes of the bitsliced
+    kernel, and the subkeys for all of their keys are worked out together.
+*/
+
+#ifndef _RECORDS_H_
+#define _RECORDS_H_
+
+#include <stddef.h>
+#include "TDES.h"
+
+/** One record to encrypt or decrypt, with its own key and buffers.  The
+    caller fills in the first five fields, and the last two are filled in
+    with the result. */
+typedef struct {
+    /** TDES_KEY_BYTES key for this record. */
+    byte const *key;
+    /** Data to encrypt or decrypt. */
+    byte const *in;
+    /** Number of bytes of data. */
+    size_t inLen;
+    /** Buffer for the result, which may be the same as in. */
+    byte *out;
+    /** Number of bytes available in out. */
+    size_t outCap;
+    /** Number of bytes stored in out, if status is TDES_OK. */
+    size_t outLen;
+    /** TDES_OK, or the error code tdesEncryptInto() or tdesDecryptInto()
+        would give for this record. */
+    int status;
+} TDESRecord;
+
+/**
+    This function pads and encrypts every record in ECB mode with its own
+    key, giving the same result as tdesEncryptInto() for each one.  Nothing
+    is allocated, so it's fine to call with many small records.
+    @param pool threads to share the work, or NULL to do it all in this thread.
+    @param records array of records, where outLen and status are filled in.
+    @param count number of records.
+ */
+void tdesEncryptRecords( Pool *pool, TDESRecord records[], size_t count );
+
+/**
+    This function decrypts every record in ECB mode with its own key and
+    removes the padding, giving the same result as tdesDecryptInto() for
+    each one.
+    @param pool threads to share the work, or NULL to do it all in this thread.
+    @param records array of records, where outLen and status are filled in.
+    @param count number of records.
+ */
+void tdesDecryptRecords( Pool *pool, TDESRecord records[], size_t count );
+
+#endif
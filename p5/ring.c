@@ -0,0 +1,65 @@
+/** 
+    @file ring.c
+    @author Jayani Sivakumar
+    Implementation of the single-producer, single-consumer ring.  A post to
+    a semaphore makes everything its thread wrote before it visible to the
+    thread that waits on it, so a slot's contents are seen by the consumer
+    once it gets past the items semaphore.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include "ring.h"
+
+/** Mask to turn an item count into a slot index. */
+#define SLOT_MASK ( RING_SLOTS - 1 )
+
+/**
+    Helper method that waits on a semaphore, retrying if a signal interrupts the wait.
+    @param sem the semaphore.
+ */
+static void waitFor( sem_t *sem );
+
+static void waitFor( sem_t *sem )
+{
+    while ( sem_wait( sem ) != 0 && errno == EINTR ) {
+    }
+}
+
+bool ringInit( Ring *ring )
+{
+    ring->head = 0;
+    ring->tail = 0;
+    if ( sem_init( &ring->items, 0, 0 ) != 0 ) {
+        return false;
+    }
+    if ( sem_init( &ring->spaces, 0, RING_SLOTS ) != 0 ) {
+        sem_destroy( &ring->items );
+        return false;
+    }
+    return true;
+}
+
+void ringPush( Ring *ring, void *item )
+{
+    waitFor( &ring->spaces );
+    ring->slots[ ring->tail & SLOT_MASK ] = item;
+    ring->tail++;
+    sem_post( &ring->items );
+}
+
+void *ringPop( Ring *ring )
+{
+    waitFor( &ring->items );
+    void *item = ring->slots[ ring->head & SLOT_MASK ];
+    ring->head++;
+    sem_post( &ring->spaces );
+    return item;
+}
+
+void ringDestroy( Ring *ring )
+{
+    sem_destroy( &ring->items );
+    sem_destroy( &ring->spaces );
+}
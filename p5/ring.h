@@ -0,0 +1,64 @@
+/** 
+    @file ring.h
+    @author Jayani Sivakumar
+    Bounded ring for handing pointers from one thread to another.  There's
+    exactly one producer and one consumer, so each end of the ring is only
+    ever moved by its own thread and no lock is needed.  A pair of counting
+    semaphores hands the slots across, and lets a thread sleep while the
+    ring is empty or full instead of spinning.
+*/
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <semaphore.h>
+
+/** Number of slots in a ring, a power of two. */
+#define RING_SLOTS 8
+
+/** A ring with one producer thread and one consumer thread. */
+typedef struct {
+    /** Pointers in the ring. */
+    void *slots[ RING_SLOTS ];
+    /** Number of items popped so far, only changed by the consumer. */
+    size_t head;
+    /** Number of items pushed so far, only changed by the producer. */
+    size_t tail;
+    /** Number of slots with an item in them. */
+    sem_t items;
+    /** Number of empty slots. */
+    sem_t spaces;
+} Ring;
+
+/**
+    This function initializes an empty ring.
+    @param ring the ring to initialize.
+    @return true if successful, false if the semaphores can't be created.
+ */
+bool ringInit( Ring *ring );
+
+/**
+    This function adds an item to the ring, waiting while it's full.  Only the
+    producer thread may call it.
+    @param ring the ring.
+    @param item pointer to add, which may be NULL.
+ */
+void ringPush( Ring *ring, void *item );
+
+/**
+    This function removes the oldest item from the ring, waiting while it's empty.
+    Only the consumer thread may call it.
+    @param ring the ring.
+    @return the item.
+ */
+void *ringPop( Ring *ring );
+
+/**
+    This function frees the resources used by a ring.
+    @param ring the ring, which no thread can be waiting on.
+ */
+void ringDestroy( Ring *ring );
+
+#endif
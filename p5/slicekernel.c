@@ -0,0 +1,297 @@
+/** 
+    @file slicekernel.c
+    @author Jayani Sivakumar
+    Bitsliced Triple DES kernel.  This file is compiled once for each
+    vector width, with SLICE_BLOCKS set to the number of blocks handled
+    per call and the compiler flags for the instruction set that width
+    needs.  Its tables come from destables.h, so there's nothing to set up,
+    and nothing here runs unless the CPU supports it.
+*/
+
+#include <string.h>
+#include "bitslice.h"
+#include "destables.h"
+#include "magic.h"
+
+#ifndef SLICE_BLOCKS
+/** Number of blocks handled per call, one for each bit of a vector. */
+#define SLICE_BLOCKS 64
+#endif
+
+/** Number of 64-bit words in each vector. */
+#define SLICE_WORDS ( SLICE_BLOCKS / BLOCK_BITS )
+
+/** Name of the kernel for this width. */
+#define KERNEL_NAME( blocks ) KERNEL_PASTE( blocks )
+#define KERNEL_PASTE( blocks ) bitsliceTDES ## blocks
+
+/** Name of the kernel with a key for each block, for this width. */
+#define KEYS_KERNEL_NAME( blocks ) KEYS_KERNEL_PASTE( blocks )
+#define KEYS_KERNEL_PASTE( blocks ) bitsliceKeysTDES ## blocks
+
+/** One bit from each block in the batch. */
+typedef uint64_t vec __attribute__(( vector_size( SLICE_WORDS * sizeof( uint64_t ) ) ));
+
+/**
+    Helper method that transposes a 64 x 64 matrix of bits in place, so
+    bit ( 63 - c ) of row r moves to bit ( 63 - r ) of row c.
+    @param rows the 64 rows of the matrix.
+ */
+static void transpose( uint64_t rows[ BLOCK_BITS ] );
+
+/**
+    Helper method that transposes SLICE_BLOCKS blocks into bit planes.
+    @param planes where plane b gets bit b + 1 of every block.
+    @param in array of blocks.
+ */
+static void loadPlanes( vec planes[ BLOCK_BITS ], byte const in[] );
+
+/**
+    Helper method that applies the final permutation to the halves left by
+    the rounds, and transposes the planes back into blocks.
+    @param out array where the blocks are stored.
+    @param L left half after the last pass.
+    @param R right half after the last pass.
+ */
+static void storePlanes( byte out[], vec const L[ HALF_BLOCK_BITS ], vec const R[ HALF_BLOCK_BITS ] );
+
+/**
+    Helper method that XORs the f function of src with the given subkey
+    into dst, which is one bitsliced DES round.
+    @param dst half that's updated, L for this round.
+    @param src half the f function is computed from, R for this round.
+    @param K one vector for each bit of the subkey, so each block can have its own key.
+ */
+static void sliceRound( vec dst[ HALF_BLOCK_BITS ], vec const src[ HALF_BLOCK_BITS ],
+                        vec const K[ SUBKEY_BITS ] );
+
+/**
+    Helper method that runs one bitsliced DES round with the same subkey for every block.
+    @param dst half that's updated, L for this round.
+    @param src half the f function is computed from, R for this round.
+    @param K 48-bit subkey for the round.
+ */
+static void sliceRoundShared( vec dst[ HALF_BLOCK_BITS ], vec const src[ HALF_BLOCK_BITS ], uint64_t K );
+
+static void transpose( uint64_t rows[ BLOCK_BITS ] )
+{
+    uint64_t mask = 0x00000000FFFFFFFFULL;
+    for ( int j = HALF_BLOCK_BITS; j != 0; j >>= 1, mask ^= mask << j ) {
+        for ( int k = 0; k < BLOCK_BITS; k = ( ( k | j ) + 1 ) & ~j ) {
+            uint64_t t = ( rows[ k ] ^ ( rows[ k | j ] >> j ) ) & mask;
+            rows[ k ] ^= t;
+            rows[ k | j ] ^= t << j;
+        }
+    }
+}
+
+static void loadPlanes( vec planes[ BLOCK_BITS ], byte const in[] )
+{
+    for ( int w = 0; w < SLICE_WORDS; w++ ) {
+        uint64_t rows[ BLOCK_BITS ];
+        for ( int r = 0; r < BLOCK_BITS; r++ ) {
+            rows[ r ] = loadBlock( in + ( w * BLOCK_BITS + r ) * BLOCK_BYTES );
+        }
+        transpose( rows );
+        for ( int b = 0; b < BLOCK_BITS; b++ ) {
+            planes[ b ][ w ] = rows[ b ];
+        }
+    }
+}
+
+static void storePlanes( byte out[], vec const L[ HALF_BLOCK_BITS ], vec const R[ HALF_BLOCK_BITS ] )
+{
+    // the final permutation just picks planes
+    vec planes[ BLOCK_BITS ];
+    for ( int b = 0; b < BLOCK_BITS; b++ ) {
+        int from = finalPerm[ b ] - 1;
+        planes[ b ] = from < HALF_BLOCK_BITS ? L[ from ] : R[ from - HALF_BLOCK_BITS ];
+    }
+    
+    for ( int w = 0; w < SLICE_WORDS; w++ ) {
+        uint64_t rows[ BLOCK_BITS ];
+        for ( int b = 0; b < BLOCK_BITS; b++ ) {
+            rows[ b ] = planes[ b ][ w ];
+        }
+        transpose( rows );
+        for ( int r = 0; r < BLOCK_BITS; r++ ) {
+            storeBlock( out + ( w * BLOCK_BITS + r ) * BLOCK_BYTES, rows[ r ] );
+        }
+    }
+}
+
+static void sliceRoundShared( vec dst[ HALF_BLOCK_BITS ], vec const src[ HALF_BLOCK_BITS ], uint64_t K )
+{
+    vec keys[ SUBKEY_BITS ];
+    for ( int bit = 0; bit < SUBKEY_BITS; bit++ ) {
+        uint64_t keyBit = ( K >> ( SUBKEY_BITS - 1 - bit ) ) & 1;
+        keys[ bit ] = ( vec ){ 0 } - keyBit;
+    }
+    sliceRound( dst, src, keys );
+}
+
+static void sliceRound( vec dst[ HALF_BLOCK_BITS ], vec const src[ HALF_BLOCK_BITS ],
+                        vec const K[ SUBKEY_BITS ] )
+{
+    for ( int i = 0; i < SBOX_COUNT; i++ ) {
+        // expanded R XORed with the subkey, one vector per S-Box input bit
+        vec x[ SBOX_INPUT_BITS ];
+        for ( int j = 0; j < SBOX_INPUT_BITS; j++ ) {
+            int bit = i * SBOX_INPUT_BITS + j;
+            x[ j ] = src[ expandedRSelector[ bit ] - 1 ] ^ K[ bit ];
+        }
+        
+        // every boolean function of the last two input bits
+        vec fn[ PAIR_FUNCTIONS ];
+        vec b5 = x[ SBOX_INPUT_BITS - 2 ];
+        vec b6 = x[ SBOX_INPUT_BITS - 1 ];
+        vec minterm[ PAIR_INPUTS ] = { ~b5 & ~b6, ~b5 & b6, b5 & ~b6, b5 & b6 };
+        fn[ 0 ] = ( vec ){ 0 };
+        for ( int c = 1; c < PAIR_FUNCTIONS; c++ ) {
+            int low = __builtin_ctz( c );
+            fn[ c ] = fn[ c & ( c - 1 ) ] | minterm[ low ];
+        }
+        
+        for ( int j = 0; j < SBOX_OUTPUT_BITS; j++ ) {
+            // choosing between the groups with the first four input bits,
+            // from the fourth bit up to the first
+            vec level[ SLICE_GROUPS ];
+            for ( int g = 0; g < SLICE_GROUPS; g++ ) {
+                level[ g ] = fn[ sliceTables.code[ i ][ j ][ g ] ];
+            }
+            int var = SLICE_GROUP_BITS - 1;
+            for ( int n = SLICE_GROUPS / 2; n >= 1; n /= 2, var-- ) {
+                for ( int g = 0; g < n; g++ ) {
+                    vec a = level[ 2 * g ];
+                    level[ g ] = a ^ ( x[ var ] & ( a ^ level[ 2 * g + 1 ] ) );
+                }
+            }
+            dst[ sliceTables.outputBit[ i * SBOX_OUTPUT_BITS + j ] ] ^= level[ 0 ];
+        }
+    }
+}
+
+/**
+    Bitsliced kernel for SLICE_BLOCKS blocks.  It gives the same result
+    as calling tdesEncryptBlock64() or tdesDecryptBlock64() on each block.
+    @param ctx key schedule made by tdesInit().
+    @param out array where the result blocks are stored.
+    @param in array of blocks to encrypt or decrypt, which may be the same as out.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+void KERNEL_NAME( SLICE_BLOCKS )( TDESContext const *ctx, byte out[], byte const in[], bool decrypt )
+{
+    // transposing each group of 64 blocks into bit planes
+    vec planes[ BLOCK_BITS ];
+    loadPlanes( planes, in );
+    
+    // the initial permutation just picks which plane goes where
+    vec left[ HALF_BLOCK_BITS ];
+    vec right[ HALF_BLOCK_BITS ];
+    for ( int b = 0; b < HALF_BLOCK_BITS; b++ ) {
+        left[ b ] = planes[ leftInitialPerm[ b ] - 1 ];
+        right[ b ] = planes[ rightInitialPerm[ b ] - 1 ];
+    }
+    
+    TDESSchedule const *passes[ NUM_KEY_PARTS ];
+    int passCount = NUM_KEY_PARTS;
+    if ( ctx->singleKey != NO_SINGLE_KEY ) {
+        // a key that reduces to single DES
+        passes[ 0 ] = decrypt ? &ctx->dec[ ctx->singleKey ] : &ctx->enc[ ctx->singleKey ];
+        passCount = 1;
+    } else if ( decrypt ) {
+        passes[ 0 ] = &ctx->dec[ 2 ];
+        passes[ 1 ] = &ctx->enc[ 1 ];
+        passes[ 2 ] = &ctx->dec[ 0 ];
+    } else {
+        passes[ 0 ] = &ctx->enc[ 0 ];
+        passes[ 1 ] = &ctx->dec[ 1 ];
+        passes[ 2 ] = &ctx->enc[ 2 ];
+    }
+    
+    // two rounds at a time, with the halves trading places after each pass
+    vec *L = left;
+    vec *R = right;
+    for ( int pass = 0; pass < passCount; pass++ ) {
+        for ( int round = 1; round < ROUND_COUNT; round += 2 ) {
+            sliceRoundShared( L, R, passes[ pass ]->K[ round ] );
+            sliceRoundShared( R, L, passes[ pass ]->K[ round + 1 ] );
+        }
+        vec *temp = L;
+        L = R;
+        R = temp;
+    }
+    
+    storePlanes( out, L, R );
+}
+
+/**
+    Kernel with a key for each block.  The keys are transposed into bit
+    planes like the blocks, and since every subkey bit is just one of the
+    key bits, the subkeys for the whole batch are picked from those planes
+    with sliceTables.keyBit as the rounds run.
+    @param keys pointer to the TDES_KEY_BYTES key for each of the SLICE_BLOCKS blocks.
+    @param out array where the result blocks are stored.
+    @param in array of blocks to encrypt or decrypt, which may be the same as out.
+    @param decrypt true to decrypt, false to encrypt.
+ */
+void KEYS_KERNEL_NAME( SLICE_BLOCKS )( byte const *const keys[], byte out[], byte const in[], bool decrypt )
+{
+    // the same bit of every key, for each part of the key
+    vec keyPlanes[ NUM_KEY_PARTS ][ BLOCK_BITS ];
+    for ( int part = 0; part < NUM_KEY_PARTS; part++ ) {
+        for ( int w = 0; w < SLICE_WORDS; w++ ) {
+            uint64_t rows[ BLOCK_BITS ];
+            for ( int r = 0; r < BLOCK_BITS; r++ ) {
+                rows[ r ] = loadBlock( keys[ w * BLOCK_BITS + r ] + part * BLOCK_BYTES );
+            }
+            transpose( rows );
+            for ( int b = 0; b < BLOCK_BITS; b++ ) {
+                keyPlanes[ part ][ b ][ w ] = rows[ b ];
+            }
+        }
+    }
+    
+    vec planes[ BLOCK_BITS ];
+    loadPlanes( planes, in );
+    vec left[ HALF_BLOCK_BITS ];
+    vec right[ HALF_BLOCK_BITS ];
+    for ( int b = 0; b < HALF_BLOCK_BITS; b++ ) {
+        left[ b ] = planes[ leftInitialPerm[ b ] - 1 ];
+        right[ b ] = planes[ rightInitialPerm[ b ] - 1 ];
+    }
+    
+    // key part for each pass, and whether its subkeys run backward
+    int parts[ NUM_KEY_PARTS ] = { 0, 1, 2 };
+    bool backward[ NUM_KEY_PARTS ] = { false, true, false };
+    if ( decrypt ) {
+        for ( int pass = 0; pass < NUM_KEY_PARTS; pass++ ) {
+            parts[ pass ] = NUM_KEY_PARTS - 1 - pass;
+            backward[ pass ] = !backward[ pass ];
+        }
+    }
+    
+    vec *L = left;
+    vec *R = right;
+    for ( int pass = 0; pass < NUM_KEY_PARTS; pass++ ) {
+        vec const *key = keyPlanes[ parts[ pass ] ];
+        for ( int round = 1; round < ROUND_COUNT; round++ ) {
+            int r = backward[ pass ] ? ROUND_COUNT - round : round;
+            vec K[ SUBKEY_BITS ];
+            for ( int bit = 0; bit < SUBKEY_BITS; bit++ ) {
+                K[ bit ] = key[ sliceTables.keyBit[ r ][ bit ] ];
+            }
+            // odd rounds update L and even rounds update R, like the other kernel
+            if ( round % 2 == 1 ) {
+                sliceRound( L, R, K );
+            } else {
+                sliceRound( R, L, K );
+            }
+        }
+        vec *temp = L;
+        L = R;
+        R = temp;
+    }
+    
+    storePlanes( out, L, R );
+}
@@ -0,0 +1,180 @@
+/** 
+    @file stats.c
+    @author Jayani Sivakumar
+    Implementation of the per-stage counters.  Each thread gets its own
+    block of counters the first time it adds to one, so the threads in a
+    pool never write to the same cache line.  The blocks are kept on a list
+    for statsReport(), and never freed, since a pool's threads can end
+    before the report is printed.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+/** Defined when the time stamp counter can be read to count cycles. */
+#define HAVE_CYCLES
+#endif
+
+/** Number of nanoseconds in a second. */
+#define NANOS_PER_SECOND 1000000000LL
+
+/** Number of bytes in a megabyte, for MB/s. */
+#define MEGABYTE ( 1024.0 * 1024.0 )
+
+/** Counters are aligned to this, the size of a cache line. */
+#define COUNTER_ALIGN 64
+
+#ifdef TDES_STATS
+
+/** Names of the stages in the report, indexed by stage. */
+static char const *stageNames[ STAGE_COUNT ] = {
+    "key schedule", "permute", "sBox", "fFunction", "kernel", "scalar", "read", "write",
+    "compress"
+};
+
+/**
+    This function returns the time on a clock that only goes forward.
+    @return time in nanoseconds.
+ */
+static uint64_t wallNanos( void );
+
+/** Time the program was loaded, for the throughput. */
+static uint64_t startNanos;
+
+/**
+    Helper method that records when the program was loaded.  It runs before main().
+ */
+static void startClock( void ) __attribute__(( constructor ));
+
+static uint64_t wallNanos( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( uint64_t ) now.tv_sec * NANOS_PER_SECOND + now.tv_nsec;
+}
+
+static void startClock( void )
+{
+    startNanos = wallNanos();
+}
+
+/** Counters for one thread. */
+typedef struct StatsCountersStruct {
+    /** Number of calls to each stage. */
+    uint64_t calls[ STAGE_COUNT ];
+    /** Time spent in each stage, from statsNow(). */
+    uint64_t ticks[ STAGE_COUNT ];
+    /** Bytes handled by each stage. */
+    uint64_t bytes[ STAGE_COUNT ];
+    /** Counters for the thread that started before this one. */
+    struct StatsCountersStruct *next;
+} StatsCounters;
+
+/** Counters for the calling thread, or NULL until it adds to one. */
+static __thread StatsCounters *local;
+
+/** Counters for every thread that has added to one. */
+static StatsCounters *allCounters;
+
+/** Lock for adding to allCounters. */
+static pthread_mutex_t countersLock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t statsNow( void )
+{
+#ifdef HAVE_CYCLES
+    return __rdtsc();
+#else
+    return wallNanos();
+#endif
+}
+
+void statsAdd( int stage, uint64_t ticks, uint64_t bytes )
+{
+    if ( local == NULL ) {
+        void *block;
+        if ( posix_memalign( &block, COUNTER_ALIGN, sizeof( StatsCounters ) ) != 0 ) {
+            return;
+        }
+        local = block;
+        *local = ( StatsCounters ){ { 0 } };
+        pthread_mutex_lock( &countersLock );
+        local->next = allCounters;
+        allCounters = local;
+        pthread_mutex_unlock( &countersLock );
+    }
+    local->calls[ stage ]++;
+    local->ticks[ stage ] += ticks;
+    local->bytes[ stage ] += bytes;
+}
+
+void statsReset( void )
+{
+    pthread_mutex_lock( &countersLock );
+    for ( StatsCounters *counters = allCounters; counters; counters = counters->next ) {
+        StatsCounters *next = counters->next;
+        *counters = ( StatsCounters ){ { 0 } };
+        counters->next = next;
+    }
+    pthread_mutex_unlock( &countersLock );
+    startNanos = wallNanos();
+}
+
+void statsReport( FILE *out )
+{
+    double seconds = ( double )( wallNanos() - startNanos ) / NANOS_PER_SECOND;
+#ifdef HAVE_CYCLES
+    char const *unit = "cycles";
+#else
+    char const *unit = "ns";
+#endif
+
+    StatsCounters total = { { 0 } };
+    pthread_mutex_lock( &countersLock );
+    for ( StatsCounters *counters = allCounters; counters; counters = counters->next ) {
+        for ( int stage = 0; stage < STAGE_COUNT; stage++ ) {
+            total.calls[ stage ] += counters->calls[ stage ];
+            total.ticks[ stage ] += counters->ticks[ stage ];
+            total.bytes[ stage ] += counters->bytes[ stage ];
+        }
+    }
+    pthread_mutex_unlock( &countersLock );
+
+    // times are summed over the threads, and fFunction includes the stages it calls
+    fprintf( out, "%-14s %12s %16s %14s\n", "stage", "calls", unit, "bytes" );
+    for ( int stage = 0; stage < STAGE_COUNT; stage++ ) {
+        if ( total.calls[ stage ] > 0 ) {
+            fprintf( out, "%-14s %12llu %16llu %14llu\n", stageNames[ stage ],
+                     ( unsigned long long ) total.calls[ stage ],
+                     ( unsigned long long ) total.ticks[ stage ],
+                     ( unsigned long long ) total.bytes[ stage ] );
+        }
+    }
+
+    uint64_t crypto = total.ticks[ STAGE_KEY_SCHEDULE ] + total.ticks[ STAGE_KERNEL ] +
+                      total.ticks[ STAGE_SCALAR ];
+    uint64_t read = total.bytes[ STAGE_READ ];
+    fprintf( out, "bytes read: %llu\n", ( unsigned long long ) read );
+    fprintf( out, "bytes written: %llu\n", ( unsigned long long ) total.bytes[ STAGE_WRITE ] );
+    fprintf( out, "crypto time: %llu %s\n", ( unsigned long long ) crypto, unit );
+    fprintf( out, "elapsed: %.3f s, %.2f MB/s\n", seconds,
+             seconds > 0 ? read / MEGABYTE / seconds : 0.0 );
+}
+
+#else
+
+void statsReset( void )
+{
+}
+
+void statsReport( FILE *out )
+{
+    fprintf( out, "Stage counters aren't compiled in, build with -DTDES_STATS\n" );
+}
+
+#endif
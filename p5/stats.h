@@ -0,0 +1,94 @@
+/** 
+    @file stats.h
+    @author Jayani Sivakumar
+    Optional counters for where the time goes in each stage of Triple DES
+    and file I/O.  They're compiled out unless TDES_STATS is defined, so
+    the STATS_BEGIN() and STATS_END() markers in the hot paths cost
+    nothing in a normal build.  When they're compiled in, each thread adds
+    to its own counters, and statsReport() sums them.
+*/
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** Stage for generating the subkeys of a DES key. */
+#define STAGE_KEY_SCHEDULE 0
+
+/** Stage for the bit-at-a-time permute() function. */
+#define STAGE_PERMUTE 1
+
+/** Stage for the reference sBox() function. */
+#define STAGE_SBOX 2
+
+/** Stage for the reference fFunction(), which includes its permute() and sBox() calls. */
+#define STAGE_FFUNCTION 3
+
+/** Stage for batches of blocks done by a bitsliced kernel. */
+#define STAGE_KERNEL 4
+
+/** Stage for blocks done one at a time by the 64-bit engine. */
+#define STAGE_SCALAR 5
+
+/** Stage for reading input. */
+#define STAGE_READ 6
+
+/** Stage for writing output. */
+#define STAGE_WRITE 7
+
+/** Stage for compressing or decompressing a container's chunks. */
+#define STAGE_COMPRESS 8
+
+/** Number of stages that are counted. */
+#define STAGE_COUNT 9
+
+#ifdef TDES_STATS
+
+/** Marks the start of a stage, in the same block as its STATS_END(). */
+#define STATS_BEGIN( stage ) uint64_t statsStart ## stage = statsNow()
+
+/** Marks the end of a stage, adding one call, the time since its
+    STATS_BEGIN() and the given number of bytes to the stage. */
+#define STATS_END( stage, bytes ) statsAdd( stage, statsNow() - statsStart ## stage, bytes )
+
+/**
+    This function returns the current time in the units the stages are
+    counted in, cycles where the CPU has a time stamp counter, else nanoseconds.
+    @return current time.
+ */
+uint64_t statsNow( void );
+
+/**
+    This function adds one call to a stage in the counters for this thread.
+    @param stage one of the STAGE_ values.
+    @param ticks time the call took, from statsNow().
+    @param bytes number of bytes the call handled, or zero if it doesn't apply.
+ */
+void statsAdd( int stage, uint64_t ticks, uint64_t bytes );
+
+#else
+
+#define STATS_BEGIN( stage )
+#define STATS_END( stage, bytes )
+
+#endif
+
+/**
+    This function clears the counters of every thread and restarts the clock
+    for the throughput, so work done before the real run isn't reported.  If
+    the counters are compiled out, it does nothing.
+ */
+void statsReset( void );
+
+/**
+    This function prints the calls, time and bytes for each stage summed over
+    every thread, then the bytes read and written, the crypto time and the
+    throughput since the program started.  If the counters are compiled
+    out, it just says so.
+    @param out where to print the report.
+ */
+void statsReport( FILE *out );
+
+#endif
@@ -0,0 +1,196 @@
+/** 
+    @file stream.c
+    @author Jayani Sivakumar
+    Streaming interface for Triple DES.  The padding is only added or
+    removed in streamFinal(), so the blocks given to streamUpdate() can be
+    handled as soon as they arrive.  In CBC and CTR mode, the IV goes in
+    front of the first block of ciphertext.
+*/
+
+#include <string.h>
+#include "stream.h"
+
+/**
+    Helper method that encrypts or decrypts whole blocks in the stream's mode.
+    @param stream the stream.
+    @param out array where the result blocks are stored.
+    @param in array of blocks to encrypt or decrypt.
+    @param blocks number of blocks.
+ */
+static void cryptBlocks( TDESStream *stream, byte out[], byte const in[], size_t blocks );
+
+/**
+    Helper method that stores the IV in front of the ciphertext, if it hasn't been yet.
+    @param stream the stream, which must be encrypting.
+    @param out array where the IV is stored.
+    @return number of bytes stored in out.
+ */
+static size_t writeIV( TDESStream *stream, byte out[] );
+
+/**
+    Helper method that takes the IV from the front of the ciphertext, if it hasn't
+    all been read yet.
+    @param stream the stream, which must be decrypting.
+    @param in pointer to the next piece of input, moved past the bytes used.
+    @param len pointer to the number of bytes of input, reduced by the bytes used.
+ */
+static void readIV( TDESStream *stream, byte const **in, size_t *len );
+
+void streamInit( TDESStream *stream, TDESContext const *ctx, Pool *pool, bool decrypt,
+                 int mode, byte const iv[] )
+{
+    stream->ctx = ctx;
+    stream->pool = pool;
+    stream->decrypt = decrypt;
+    stream->mode = mode;
+    stream->ivLen = modeHasIV( mode ) ? 0 : BLOCK_BYTES;
+    memset( stream->iv, 0, BLOCK_BYTES );
+    if ( !decrypt && iv != NULL ) {
+        memcpy( stream->iv, iv, BLOCK_BYTES );
+    }
+    stream->chain = loadBlock( stream->iv );
+    stream->position = 0;
+    stream->pendingLen = 0;
+    stream->bytesIn = 0;
+    stream->bytesOut = 0;
+}
+
+static void cryptBlocks( TDESStream *stream, byte out[], byte const in[], size_t blocks )
+{
+    if ( stream->mode == MODE_CBC && stream->decrypt ) {
+        stream->chain = cbcDecrypt( stream->ctx, stream->pool, out, in, blocks, stream->chain );
+    } else if ( stream->mode == MODE_CBC ) {
+        stream->chain = cbcEncrypt( stream->ctx, out, in, blocks, stream->chain );
+    } else {
+        tdesCryptBlocksParallel( stream->ctx, stream->pool, out, in, blocks, stream->decrypt );
+    }
+}
+
+static size_t writeIV( TDESStream *stream, byte out[] )
+{
+    if ( stream->ivLen == BLOCK_BYTES ) {
+        return 0;
+    }
+    memcpy( out, stream->iv, BLOCK_BYTES );
+    stream->ivLen = BLOCK_BYTES;
+    return BLOCK_BYTES;
+}
+
+static void readIV( TDESStream *stream, byte const **in, size_t *len )
+{
+    if ( stream->ivLen == BLOCK_BYTES ) {
+        return;
+    }
+    size_t take = BLOCK_BYTES - stream->ivLen;
+    if ( take > *len ) {
+        take = *len;
+    }
+    memcpy( stream->iv + stream->ivLen, *in, take );
+    stream->ivLen += take;
+    *in += take;
+    *len -= take;
+    stream->chain = loadBlock( stream->iv );
+}
+
+size_t streamUpdate( TDESStream *stream, byte out[], byte const in[], size_t len )
+{
+    size_t produced = 0;
+    stream->bytesIn += len;
+    if ( stream->decrypt ) {
+        readIV( stream, &in, &len );
+    } else {
+        produced = writeIV( stream, out );
+    }
+    
+    // counter mode has no padding, so nothing is held back
+    if ( stream->mode == MODE_CTR ) {
+        if ( len > 0 ) {
+            ctrCrypt( stream->ctx, stream->pool, out + produced, in, len, stream->chain,
+                      stream->position );
+        }
+        stream->position += len;
+        produced += len;
+        stream->bytesOut += produced;
+        return produced;
+    }
+    
+    // completing a block left over from the last call
+    if ( stream->pendingLen > 0 ) {
+        size_t take = BLOCK_BYTES - stream->pendingLen;
+        if ( take > len ) {
+            take = len;
+        }
+        memcpy( stream->pending + stream->pendingLen, in, take );
+        stream->pendingLen += take;
+        in += take;
+        len -= take;
+        
+        // when decrypting, the block is only safe to use if more data follows
+        if ( stream->pendingLen == BLOCK_BYTES && ( !stream->decrypt || len > 0 ) ) {
+            cryptBlocks( stream, out + produced, stream->pending, 1 );
+            stream->pendingLen = 0;
+            produced += BLOCK_BYTES;
+        }
+        if ( len == 0 ) {
+            stream->bytesOut += produced;
+            return produced;
+        }
+    }
+    
+    // whole blocks go straight from the input
+    size_t blocks = len / BLOCK_BYTES;
+    size_t rest = len % BLOCK_BYTES;
+    if ( stream->decrypt && rest == 0 && blocks > 0 ) {
+        blocks--;
+        rest = BLOCK_BYTES;
+    }
+    cryptBlocks( stream, out + produced, in, blocks );
+    produced += blocks * BLOCK_BYTES;
+    
+    memcpy( stream->pending, in + blocks * BLOCK_BYTES, rest );
+    stream->pendingLen = rest;
+    stream->bytesOut += produced;
+    return produced;
+}
+
+int streamFinal( TDESStream *stream, byte out[], size_t *outLen )
+{
+    *outLen = 0;
+    if ( !stream->decrypt ) {
+        size_t produced = writeIV( stream, out );
+        if ( stream->mode != MODE_CTR ) {
+            // a whole block of padding if the data ended on a block boundary
+            int padCount = BLOCK_BYTES - stream->pendingLen;
+            memset( stream->pending + stream->pendingLen, padCount, padCount );
+            cryptBlocks( stream, out + produced, stream->pending, 1 );
+            stream->pendingLen = 0;
+            produced += BLOCK_BYTES;
+        }
+        *outLen = produced;
+        stream->bytesOut += produced;
+        return TDES_OK;
+    }
+    
+    if ( stream->ivLen != BLOCK_BYTES ) {
+        return TDES_ERR_LENGTH;
+    }
+    if ( stream->mode == MODE_CTR ) {
+        return TDES_OK;
+    }
+    if ( stream->pendingLen != BLOCK_BYTES ) {
+        return TDES_ERR_LENGTH;
+    }
+    byte last[ BLOCK_BYTES ];
+    cryptBlocks( stream, last, stream->pending, 1 );
+    stream->pendingLen = 0;
+    
+    // removing padding
+    int padValue = last[ BLOCK_BYTES - 1 ];
+    if ( padValue < 1 || padValue > BLOCK_BYTES ) {
+        return TDES_ERR_PADDING;
+    }
+    memcpy( out, last, BLOCK_BYTES - padValue );
+    *outLen = BLOCK_BYTES - padValue;
+    stream->bytesOut += *outLen;
+    return TDES_OK;
+}
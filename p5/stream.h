@@ -0,0 +1,91 @@
+/** 
+    @file stream.h
+    @author Jayani Sivakumar
+    Streaming interface for Triple DES, so data of any length can be
+    encrypted or decrypted a piece at a time with a fixed amount of memory.
+*/
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "TDES.h"
+#include "modes.h"
+
+/** Extra room streamUpdate() and streamFinal() may need in their output, past
+    the length of the input, for the IV and a block held over from before. */
+#define STREAM_SLACK ( 2 * BLOCK_BYTES )
+
+/** State for encrypting or decrypting one stream of data. */
+typedef struct {
+    /** Key schedule made by tdesInit(). */
+    TDESContext const *ctx;
+    /** Pool of threads to use, or NULL. */
+    Pool *pool;
+    /** True to decrypt, false to encrypt. */
+    bool decrypt;
+    /** Mode of operation, MODE_ECB, MODE_CBC or MODE_CTR. */
+    int mode;
+    /** The IV, which is written in front of the ciphertext when encrypting
+        and read from there when decrypting. */
+    byte iv[ BLOCK_BYTES ];
+    /** Number of bytes of the IV written or read so far. */
+    int ivLen;
+    /** Last ciphertext block, which the next CBC block is chained to. */
+    uint64_t chain;
+    /** Number of bytes of data after the IV handled so far in CTR mode. */
+    uint64_t position;
+    /** Bytes that didn't make up a whole block yet.  When decrypting, the
+        last whole block is held here too, since it has the padding. */
+    byte pending[ BLOCK_BYTES ];
+    /** Number of bytes in pending. */
+    int pendingLen;
+    /** Total number of bytes given to streamUpdate(). */
+    uint64_t bytesIn;
+    /** Total number of bytes produced so far. */
+    uint64_t bytesOut;
+} TDESStream;
+
+/**
+    This function starts a new stream.
+    @param stream the stream to initialize.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL to do all the work in the calling thread.
+    @param decrypt true to decrypt, false to encrypt.
+    @param mode mode of operation, MODE_ECB, MODE_CBC or MODE_CTR.
+    @param iv random IV to use when encrypting in CBC or CTR mode, else NULL.
+ */
+void streamInit( TDESStream *stream, TDESContext const *ctx, Pool *pool, bool decrypt,
+                 int mode, byte const iv[] );
+
+/**
+    This function encrypts or decrypts the next piece of a stream. Whole blocks are
+    processed right away, and anything left over is kept for the next call. The
+    output array must have room for len + STREAM_SLACK bytes, and it must not overlap
+    the input. On the first call for a stream, the output stops short of the length
+    modeOutputLen() gives by at least what streamFinal() adds, so a whole input can
+    be handled in one call into an output of that size.
+    @param stream the stream.
+    @param out array where the output is stored.
+    @param in the next piece of input.
+    @param len number of bytes of input.
+    @return number of bytes stored in out.
+ */
+size_t streamUpdate( TDESStream *stream, byte out[], byte const in[], size_t len );
+
+/**
+    This function finishes a stream. When encrypting, it stores the last block with
+    the padding. When decrypting, it checks the length of the data, decrypts the last
+    block and stores whatever is left of it once the padding is removed. CTR mode
+    has no padding, so there's nothing left to do but check the length.
+    @param stream the stream.
+    @param out array with room for STREAM_SLACK bytes where the output is stored.
+    @param outLen pointer to where the number of bytes stored in out is returned.
+    @return TDES_OK if successful, or TDES_ERR_LENGTH or TDES_ERR_PADDING if the
+    encrypted data isn't valid.
+ */
+int streamFinal( TDESStream *stream, byte out[], size_t *outLen );
+
+#endif
@@ -6,37 +6,590 @@
     or decryption and to write the output.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "IO.h"
+#include "container.h"
 #include "TDES.h" 
+#include "modes.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "stats.h"
+#include "stream.h"
+#include "uring.h"
+
+/** Number of file names expected after the options. */
+#define FILE_ARGS 3
+
+/** Largest number of threads that can be requested with -j. */
+#define MAX_THREADS 1024
+
+/** Base used to parse the thread count. */
+#define DECIMAL 10
+
+/** Number of bytes read from the input at a time.  It's a whole number
+    of chunks for the thread pool. */
+#define STREAM_BYTES ( 1024 * 1024 )
+
+/** Result code from cryptMapped() when the output can't be mapped, so
+    the file should be streamed instead. */
+#define MAP_ERROR -3
+
+/** Result code from cryptWhole() when the output file can't be created. */
+#define OPEN_ERROR -5
+
+/** Character between the offset and length given with --range. */
+#define RANGE_SEPARATOR ':'
+
+/** Character between the input and output file names of a pair in batch mode. */
+#define PAIR_SEPARATOR ':'
+
+/** Largest input file batch mode gives to a single worker, with several of
+    them going at once.  Bigger files are split into chunks across all the
+    workers, one file at a time. */
+#define BATCH_SMALL_BYTES STREAM_BYTES
+
+/** Number of nanoseconds in a second. */
+#define NANOS_PER_SECOND 1000000000.0
+
+/** Multiplier that turns a fraction into a percentage. */
+#define PERCENT 100.0
+
+/** Number of bytes in a megabyte, for MB/s. */
+#define MEGABYTE ( 1024.0 * 1024.0 )
+
+/** A file to encrypt or decrypt in batch mode. */
+typedef struct {
+    /** Name of the input file. */
+    char *input;
+    /** Name of the output file. */
+    char *output;
+    /** Number of bytes read from the input. */
+    uint64_t len;
+    /** True if one worker does the whole file. */
+    bool small;
+    /** IV for encrypting the file, if the mode has one. */
+    byte iv[ BLOCK_BYTES ];
+    /** Result code for the file. */
+    int status;
+    /** Error number that goes with READ_ERROR, WRITE_ERROR or OPEN_ERROR. */
+    int error;
+    /** Number of seconds the file took. */
+    double seconds;
+} BatchFile;
+
+/** The files for batch mode and what to do with them. */
+typedef struct {
+    /** Files in the order they were given. */
+    BatchFile *files;
+    /** Number of files. */
+    size_t count;
+    /** Number of elements the files array has room for. */
+    size_t capacity;
+    /** Indices of the small files, which the workers take one at a time. */
+    size_t *small;
+    /** Key schedule shared by every file. */
+    TDESContext const *ctx;
+    /** True to decrypt, false to encrypt. */
+    bool decrypt;
+    /** MODE_ECB, MODE_CBC or MODE_CTR. */
+    int mode;
+    /** True to stream regular files through io_uring. */
+    bool uring;
+    /** True to use O_DIRECT with io_uring. */
+    bool direct;
+} Batch;
+
+/**
+    This function prints a usage message and exits unsuccessfully.
+ */
+static void usage( void )
+{
+    fprintf( stderr, "usage: tcrypt [-d] [-j THREADS] [-m ecb|cbc|ctr] [--range OFFSET:LEN] [--container] [--compress] [--stats] [--memo] [--uring] [--direct] KEY_FILE INPUT_FILE OUTPUT_FILE\n"
+                     "       tcrypt --batch [-d] [-j THREADS] [-m ecb|cbc|ctr] [--stats] [--memo] [--uring] [--direct] KEY_FILE INPUT:OUTPUT|MANIFEST...\n" );
+    exit( EXIT_FAILURE );
+}
+
+/**
+    This function encrypts or decrypts the whole contents of a mapped input file
+    straight into a mapped output file, with no copies in between.
+    @param in the mapped input file.
+    @param outputFileName name of the output file to create and map.
+    @param stream stream set up for encryption or decryption.
+    @return TDES_OK if successful, an error code from streamFinal(), WRITE_ERROR
+    or MAP_ERROR.
+ */
+static int cryptMapped( MappedFile const *in, const char *outputFileName, TDESStream *stream )
+{
+    uint64_t outLen = modeOutputLen( stream->mode, stream->decrypt, in->len );
+    MappedFile out;
+    if ( !mapOutput( outputFileName, outLen, &out ) ) {
+        return MAP_ERROR;
+    }
+    
+    size_t produced = 0;
+    if ( in->len > 0 ) {
+        produced = streamUpdate( stream, out.data, in->data, in->len );
+    }
+    size_t finalLen = 0;
+    int status = streamFinal( stream, out.data + produced, &finalLen );
+    
+    if ( !unmapFile( &out, status == TDES_OK ? produced + finalLen : 0 ) && status == TDES_OK ) {
+        status = WRITE_ERROR;
+    }
+    return status;
+}
+
+/**
+    This function reads the whole contents of an open file into memory. It's used
+    when the input and output are the same file, so the input is read before the
+    output truncates it.
+    @param file the open file, at its start.
+    @param copy where the contents are returned, with no file descriptor.
+    @return true if successful, else false.
+ */
+static bool loadFile( FILE *file, MappedFile *copy )
+{
+    MappedFile map;
+    if ( !mapInput( file, &map ) ) {
+        return false;
+    }
+    copy->fd = -1;
+    copy->len = map.len;
+    copy->data = malloc( map.len > 0 ? map.len : 1 );
+    if ( copy->data == NULL ) {
+        exit( EXIT_FAILURE );
+    }
+    if ( map.len > 0 ) {
+        memcpy( copy->data, map.data, map.len );
+    }
+    unmapFile( &map, 0 );
+    return true;
+}
+
+/**
+    This function parses the OFFSET:LEN value given with --range.
+    @param text the value from the command line.
+    @param offset pointer to where the offset is returned.
+    @param len pointer to where the length is returned.
+    @return true if the value is valid, else false.
+ */
+static bool parseRange( const char *text, uint64_t *offset, uint64_t *len )
+{
+    char *end;
+    if ( *text < '0' || *text > '9' ) {
+        return false;
+    }
+    *offset = strtoull( text, &end, DECIMAL );
+    if ( *end != RANGE_SEPARATOR || end[ 1 ] < '0' || end[ 1 ] > '9' ) {
+        return false;
+    }
+    *len = strtoull( end + 1, &end, DECIMAL );
+    return *end == '\0';
+}
+
+/**
+    This function decrypts just part of the plaintext from a seekable input file,
+    reading only the blocks that hold it. The padding is only read and checked when
+    the range reaches the last block, and the range stops where the plaintext does.
+    @param in input file, with a valid length for the mode.
+    @param out file to write.
+    @param ctx key schedule made by tdesInit().
+    @param pool pool of threads to use, or NULL.
+    @param mode MODE_ECB, MODE_CBC or MODE_CTR.
+    @param offset position of the first byte of plaintext to write.
+    @param len number of bytes of plaintext to write.
+    @return TDES_OK if successful, TDES_ERR_PADDING, READ_ERROR or WRITE_ERROR.
+ */
+static int cryptRange( FILE *in, FILE *out, TDESContext const *ctx, Pool *pool, int mode,
+                       uint64_t offset, uint64_t len )
+{
+    if ( fseek( in, 0, SEEK_END ) != 0 ) {
+        return READ_ERROR;
+    }
+    uint64_t header = modeHasIV( mode ) ? BLOCK_BYTES : 0;
+    uint64_t bodyLen = ftell( in ) - header;
+    byte block[ BLOCK_BYTES ] = { 0 };
+    if ( header > 0 && !readAt( in, 0, block, BLOCK_BYTES ) ) {
+        return READ_ERROR;
+    }
+    uint64_t iv = loadBlock( block );
+    
+    // the last block is only needed if the range reaches it
+    uint64_t plainLen = bodyLen;
+    if ( mode != MODE_CTR && ( offset >= bodyLen - BLOCK_BYTES ||
+                               len > bodyLen - BLOCK_BYTES - offset ) ) {
+        uint64_t last = bodyLen / BLOCK_BYTES - 1;
+        uint64_t chain = iv;
+        if ( mode == MODE_CBC && last > 0 ) {
+            if ( !readAt( in, header + ( last - 1 ) * BLOCK_BYTES, block, BLOCK_BYTES ) ) {
+                return READ_ERROR;
+            }
+            chain = loadBlock( block );
+        }
+        if ( !readAt( in, header + last * BLOCK_BYTES, block, BLOCK_BYTES ) ) {
+            return READ_ERROR;
+        }
+        modeDecryptAt( ctx, NULL, mode, block, block, 1, last, chain );
+        int padValue = block[ BLOCK_BYTES - 1 ];
+        if ( padValue < 1 || padValue > BLOCK_BYTES ) {
+            return TDES_ERR_PADDING;
+        }
+        plainLen = bodyLen - padValue;
+    }
+    uint64_t end = offset;
+    if ( offset < plainLen ) {
+        end = len < plainLen - offset ? offset + len : plainLen;
+    }
+    
+    // the blocks holding the range, a piece at a time
+    byte *buffer = malloc( STREAM_BYTES );
+    if ( buffer == NULL ) {
+        exit( EXIT_FAILURE );
+    }
+    int status = TDES_OK;
+    for ( uint64_t pos = offset; status == TDES_OK && pos < end; ) {
+        uint64_t first = pos / BLOCK_BYTES;
+        uint64_t blocks = ( end - first * BLOCK_BYTES + BLOCK_BYTES - 1 ) / BLOCK_BYTES;
+        if ( blocks > STREAM_BYTES / BLOCK_BYTES ) {
+            blocks = STREAM_BYTES / BLOCK_BYTES;
+        }
+        uint64_t chain = iv;
+        if ( mode == MODE_CBC && first > 0 ) {
+            if ( !readAt( in, header + ( first - 1 ) * BLOCK_BYTES, block, BLOCK_BYTES ) ) {
+                status = READ_ERROR;
+                break;
+            }
+            chain = loadBlock( block );
+        }
+        // in CTR mode, the last block can be short
+        size_t readLen = blocks * BLOCK_BYTES;
+        if ( readLen > bodyLen - first * BLOCK_BYTES ) {
+            readLen = bodyLen - first * BLOCK_BYTES;
+        }
+        if ( !readAt( in, header + first * BLOCK_BYTES, buffer, readLen ) ) {
+            status = READ_ERROR;
+            break;
+        }
+        modeDecryptAt( ctx, pool, mode, buffer, buffer, blocks, first, chain );
+        
+        size_t skip = pos - first * BLOCK_BYTES;
+        size_t take = blocks * BLOCK_BYTES - skip;
+        if ( take > end - pos ) {
+            take = end - pos;
+        }
+        if ( !writeBytes( out, buffer + skip, take ) ) {
+            status = WRITE_ERROR;
+        }
+        pos += take;
+    }
+    free( buffer );
+    return status;
+}
+
+/**
+    This function streams a copy of the input that's already in memory into the
+    output a piece at a time. It's used when the input and output are the same
+    file and the output can't be mapped, since the file itself has been truncated.
+    @param in the copy of the input.
+    @param output the open output file.
+    @param stream stream set up for encryption or decryption.
+    @return TDES_OK if successful, an error code from streamFinal() or WRITE_ERROR.
+ */
+static int cryptCopy( MappedFile const *in, FILE *output, TDESStream *stream )
+{
+    byte *buffer = malloc( STREAM_BYTES + STREAM_SLACK );
+    if ( buffer == NULL ) {
+        exit( EXIT_FAILURE );
+    }
+    int status = TDES_OK;
+    for ( uint64_t pos = 0; status == TDES_OK && pos < in->len; pos += STREAM_BYTES ) {
+        size_t len = in->len - pos < STREAM_BYTES ? in->len - pos : STREAM_BYTES;
+        size_t produced = streamUpdate( stream, buffer, in->data + pos, len );
+        if ( !writeBytes( output, buffer, produced ) ) {
+            status = WRITE_ERROR;
+        }
+    }
+    if ( status == TDES_OK ) {
+        size_t finalLen = 0;
+        status = streamFinal( stream, buffer, &finalLen );
+        if ( status == TDES_OK && !writeBytes( output, buffer, finalLen ) ) {
+            status = WRITE_ERROR;
+        }
+    }
+    free( buffer );
+    return status;
+}
+
+/**
+    This function encrypts or decrypts the whole input file into the named output
+    file. Regular files are mapped and processed in place, unless they're asked to
+    go through io_uring and aren't the same file, and anything else is streamed.
+    When the input is also the output, it's read into memory first, and nothing
+    streams from the file after that, since opening the output empties it.
+    @param input the open input file, at its start.
+    @param outputFileName name of the output file.
+    @param stream stream set up for encryption or decryption.
+    @param uring true to stream regular files through io_uring instead of mapping them.
+    @param direct true to use O_DIRECT with io_uring.
+    @return TDES_OK if successful, an error code from streamFinal(), READ_ERROR,
+    WRITE_ERROR or OPEN_ERROR.
+ */
+static int cryptWhole( FILE *input, const char *outputFileName, TDESStream *stream,
+                       bool uring, bool direct )
+{
+    int status = MAP_ERROR;
+    bool same = strcmp( outputFileName, STDIO_NAME ) != 0 && sameFile( input, outputFileName );
+    MappedFile copy = { NULL, 0, -1 };
+    if ( same ) {
+        if ( !loadFile( input, &copy ) ) {
+            return READ_ERROR;
+        }
+        status = cryptMapped( &copy, outputFileName, stream );
+    } else if ( strcmp( outputFileName, STDIO_NAME ) != 0 && !uring ) {
+        MappedFile inMap;
+        if ( mapInput( input, &inMap ) ) {
+            status = cryptMapped( &inMap, outputFileName, stream );
+            unmapFile( &inMap, 0 );
+        }
+    }
+    if ( status != MAP_ERROR ) {
+        free( copy.data );
+        return status;
+    }
 
-/** Number of command-line arguments expected in decryption mode. */
-#define ARGS_DECRYPT 5
+    FILE *output = openOutput( outputFileName );
+    if ( output == NULL ) {
+        free( copy.data );
+        return OPEN_ERROR;
+    }
+    if ( same ) {
+        status = cryptCopy( &copy, output, stream );
+    } else {
+        status = URING_UNAVAILABLE;
+        if ( uring ) {
+            status = uringRun( input, output, stream, direct );
+        }
+        if ( status == URING_UNAVAILABLE ) {
+            status = pipelineRun( input, output, stream );
+        }
+    }
+    if ( fclose( output ) != 0 && status == TDES_OK ) {
+        status = WRITE_ERROR;
+    }
+    free( copy.data );
+    return status;
+}
+
+/**
+    This function returns the time from a clock that only moves forward.
+    @return the time in seconds.
+ */
+static double currentSeconds( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec + now.tv_nsec / NANOS_PER_SECOND;
+}
+
+/**
+    This function adds an INPUT:OUTPUT pair to the files for batch mode, exiting
+    with a usage message if it isn't one. The output can't be standard output, since
+    that's shared by every file.
+    @param batch the batch.
+    @param pair the pair of names, which is kept by the batch.
+ */
+static void addPair( Batch *batch, char *pair )
+{
+    char *separator = strchr( pair, PAIR_SEPARATOR );
+    if ( separator == NULL || separator == pair || separator[ 1 ] == '\0' ||
+         strcmp( separator + 1, STDIO_NAME ) == 0 ) {
+        usage();
+    }
+    if ( batch->count >= batch->capacity ) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 1;
+        batch->files = realloc( batch->files, batch->capacity * sizeof( BatchFile ) );
+        if ( batch->files == NULL ) {
+            exit( EXIT_FAILURE );
+        }
+    }
+    *separator = '\0';
+    BatchFile *file = &batch->files[ batch->count++ ];
+    memset( file, 0, sizeof( *file ) );
+    file->input = pair;
+    file->output = separator + 1;
+}
+
+/**
+    This function adds every INPUT:OUTPUT pair in a manifest file, one to a line, to
+    the files for batch mode.  Blank lines are skipped.
+    @param batch the batch.
+    @param manifestName name of the manifest file.
+ */
+static void readManifest( Batch *batch, const char *manifestName )
+{
+    FILE *manifest = fopen( manifestName, "r" );
+    if ( manifest == NULL ) {
+        perror( manifestName );
+        exit( EXIT_FAILURE );
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ( ( len = getline( &line, &cap, manifest ) ) >= 0 ) {
+        while ( len > 0 && ( line[ len - 1 ] == '\n' || line[ len - 1 ] == '\r' ) ) {
+            line[ --len ] = '\0';
+        }
+        if ( len > 0 ) {
+            char *pair = strdup( line );
+            if ( pair == NULL ) {
+                exit( EXIT_FAILURE );
+            }
+            addPair( batch, pair );
+        }
+    }
+    free( line );
+    fclose( manifest );
+}
 
-/** Number of DES key parts used in Triple DES.*/
-#define NUM_KEY_PARTS 3
+/**
+    This function encrypts or decrypts one file of a batch, recording how it went
+    in the file's entry. A failed file's output isn't left behind.
+    @param batch the batch.
+    @param file the file.
+    @param pool pool of threads to split the file across, or NULL.
+ */
+static void cryptBatchFile( Batch const *batch, BatchFile *file, Pool *pool )
+{
+    double start = currentSeconds();
+    FILE *input = openInput( file->input );
+    if ( input == NULL ) {
+        file->status = READ_ERROR;
+        file->error = errno;
+    } else {
+        TDESStream stream;
+        streamInit( &stream, batch->ctx, pool, batch->decrypt, batch->mode, file->iv );
+        file->status = cryptWhole( input, file->output, &stream, batch->uring, batch->direct );
+        if ( file->status == READ_ERROR || file->status == WRITE_ERROR ||
+             file->status == OPEN_ERROR ) {
+            file->error = errno;
+        }
+        file->len = stream.bytesIn;
+        fclose( input );
+        if ( file->status != TDES_OK && file->status != OPEN_ERROR ) {
+            remove( file->output );
+        }
+    }
+    file->seconds = currentSeconds() - start;
+}
 
-/** Argument index for the input file in encryption mode. */
-#define ENCRYPT_INPUT_ARG_INDEX 2
+/**
+    This function is run by the pool for each small file in a batch.
+    @param arg pointer to the Batch.
+    @param job number of the small file.
+ */
+static void cryptSmallFile( void *arg, size_t job )
+{
+    Batch *batch = arg;
+    cryptBatchFile( batch, &batch->files[ batch->small[ job ] ], NULL );
+}
 
-/** Argument index for the output file in encryption mode. */
-#define ENCRYPT_OUTPUT_ARG_INDEX 3
+/**
+    This function encrypts or decrypts every file in a batch and prints how each one
+    went to standard error, with the total throughput. The workers take the small files from a queue,
+    several at once, and then each large file is split into chunks across all of them.
+    @param batch the batch, with a fresh IV for each file if the mode has one.
+    @param pool pool of threads to use, or NULL.
+    @return true if every file was successful, else false.
+ */
+static bool runBatch( Batch *batch, Pool *pool )
+{
+    batch->small = malloc( batch->count * sizeof( size_t ) );
+    if ( batch->small == NULL ) {
+        exit( EXIT_FAILURE );
+    }
+    size_t smallCount = 0;
+    for ( size_t i = 0; i < batch->count; i++ ) {
+        BatchFile *file = &batch->files[ i ];
+        struct stat info;
+        if ( stat( file->input, &info ) == 0 && S_ISREG( info.st_mode ) ) {
+            file->small = ( uint64_t ) info.st_size <= BATCH_SMALL_BYTES;
+        }
+        if ( file->small ) {
+            batch->small[ smallCount++ ] = i;
+        }
+    }
 
-/** Argument index for the key file in decryption mode. */
-#define DECRYPT_KEY_ARG_INDEX 2
+    double start = currentSeconds();
+    poolRun( pool, smallCount, cryptSmallFile, batch );
+    for ( size_t i = 0; i < batch->count; i++ ) {
+        if ( !batch->files[ i ].small ) {
+            cryptBatchFile( batch, &batch->files[ i ], pool );
+        }
+    }
+    double seconds = currentSeconds() - start;
 
-/** Argument index for the input file in decryption mode. */
-#define DECRYPT_INPUT_ARG_INDEX 3
+    size_t failed = 0;
+    uint64_t total = 0;
+    for ( size_t i = 0; i < batch->count; i++ ) {
+        BatchFile const *file = &batch->files[ i ];
+        fprintf( stderr, "%s -> %s: ", file->input, file->output );
+        if ( file->status == TDES_OK ) {
+            fprintf( stderr, "%llu bytes in %.3f s\n", ( unsigned long long ) file->len,
+                     file->seconds );
+            total += file->len;
+        } else if ( file->status == READ_ERROR || file->status == WRITE_ERROR ||
+                    file->status == OPEN_ERROR ) {
+            fprintf( stderr, "%s\n", strerror( file->error ) );
+            failed++;
+        } else {
+            fprintf( stderr, "%s\n", tdesErrorMessage( file->status ) );
+            failed++;
+        }
+    }
+    fprintf( stderr, "%zu files, %zu failed, %llu bytes in %.3f s, %.2f MB/s\n", batch->count,
+             failed, ( unsigned long long ) total, seconds,
+             seconds > 0 ? total / MEGABYTE / seconds : 0.0 );
+    free( batch->small );
+    return failed == 0;
+}
 
-/** Argument index for the output file in decryption mode. */
-#define DECRYPT_OUTPUT_ARG_INDEX 4
+/**
+    This function prints how many of the blocks looked up in the ECB memo were repeats.
+    @param memo counts added to by every thread.
+ */
+static void reportMemo( TDESMemoStats const *memo )
+{
+    unsigned long long lookups = memo->lookups;
+    unsigned long long hits = memo->hits;
+    fprintf( stderr, "memo hits: %llu of %llu blocks, %.1f%%\n", hits, lookups,
+             lookups > 0 ? hits * PERCENT / lookups : 0.0 );
+}
 
 /**
     This function reads command-line arguments and performs Triple DES encryption or decryption.
-    The program reads the key file and input file. It then calls encryptTDES() or decryptTDES()
-    accordingly and writes the output to the specified file.
+    The program reads the key file and sets up the key schedule with tdesInit(). When
+    the input and output are regular files, they're mapped into memory and the input is
+    encrypted or decrypted straight into the output. Otherwise, the input is streamed
+    through the cipher a piece at a time. With -j, the blocks are split across a pool of threads,
+    and -m picks the mode of operation, which is ECB unless it says otherwise. When decrypting,
+    --range writes just part of the plaintext, and only the blocks that hold it are read. With
+    --container, the output is a container with a header and an index of chunks instead of
+    flat ciphertext, and decryption reads the mode from the container. --compress makes a
+    container too, with each chunk compressed before it's encrypted, so redundant input like
+    logs takes fewer blocks and less space. In ECB, --memo remembers blocks that have been
+    done already, so repeated ones like the zeros in sparse images skip the rounds, and it
+    reports how many did. With --batch, the files after the key are INPUT:OUTPUT pairs
+    or manifests listing them, one to a line, and they're all done in one run with a
+    summary of each one on standard error. Either file name can be - to use standard
+    input or standard output, except for the outputs in a batch.
     @param numArgs number of command-line arguments
     @param argValues array of command-line argument strings
     @return int returns EXIT_SUCCESS if processed successfully, else EXIT_FAILURE.
@@ -44,25 +597,72 @@
 int main( int numArgs, char *argValues[] ) 
 {
     int decryptMode = 0;
-    char *keyFileName = NULL;
-    char *inputFileName = NULL;
-    char *outputFileName = NULL;
-
-    // command-line arguments
-    if (numArgs == ARGS_DECRYPT && strcmp( argValues[ 1 ], "-d" ) == 0 ) {
-        decryptMode = 1;
-        keyFileName = argValues[ DECRYPT_KEY_ARG_INDEX ];
-        inputFileName = argValues[ DECRYPT_INPUT_ARG_INDEX ];
-        outputFileName = argValues[ DECRYPT_OUTPUT_ARG_INDEX ];
-    } else if ( numArgs == ( ARGS_DECRYPT - 1 ) ) {
-        decryptMode = 0;
-        keyFileName = argValues[ 1 ];
-        inputFileName = argValues[ ENCRYPT_INPUT_ARG_INDEX ];
-        outputFileName = argValues[ ENCRYPT_OUTPUT_ARG_INDEX ];
-    } else {
-        fprintf( stderr, "usage: tcrypt [-d] KEY_FILE INPUT_FILE OUTPUT_FILE\n" );
-        exit( EXIT_FAILURE );
+    int threads = 1;
+    int mode = MODE_ECB;
+    bool range = false;
+    bool container = false;
+    bool compress = false;
+    bool stats = false;
+    bool memo = false;
+    bool uring = false;
+    bool direct = false;
+    bool batchMode = false;
+    uint64_t rangeOffset = 0;
+    uint64_t rangeLen = 0;
+
+    // options come before the file names
+    int arg = 1;
+    while ( arg < numArgs && argValues[ arg ][ 0 ] == '-' &&
+            strcmp( argValues[ arg ], STDIO_NAME ) != 0 ) {
+        if ( strcmp( argValues[ arg ], "-d" ) == 0 ) {
+            decryptMode = 1;
+        } else if ( strcmp( argValues[ arg ], "-j" ) == 0 && arg + 1 < numArgs ) {
+            char *end;
+            long count = strtol( argValues[ ++arg ], &end, DECIMAL );
+            if ( *end != '\0' || count < 1 || count > MAX_THREADS ) {
+                usage();
+            }
+            threads = count;
+        } else if ( strcmp( argValues[ arg ], "-m" ) == 0 && arg + 1 < numArgs ) {
+            mode = modeParse( argValues[ ++arg ] );
+            if ( mode < 0 ) {
+                usage();
+            }
+        } else if ( strcmp( argValues[ arg ], "--container" ) == 0 ) {
+            container = true;
+        } else if ( strcmp( argValues[ arg ], "--compress" ) == 0 ) {
+            container = true;
+            compress = true;
+        } else if ( strcmp( argValues[ arg ], "--stats" ) == 0 ) {
+            stats = true;
+        } else if ( strcmp( argValues[ arg ], "--memo" ) == 0 ) {
+            memo = true;
+        } else if ( strcmp( argValues[ arg ], "--uring" ) == 0 ) {
+            uring = true;
+        } else if ( strcmp( argValues[ arg ], "--direct" ) == 0 ) {
+            uring = true;
+            direct = true;
+        } else if ( strcmp( argValues[ arg ], "--batch" ) == 0 ) {
+            batchMode = true;
+        } else if ( strcmp( argValues[ arg ], "--range" ) == 0 && arg + 1 < numArgs ) {
+            range = true;
+            if ( !parseRange( argValues[ ++arg ], &rangeOffset, &rangeLen ) ) {
+                usage();
+            }
+        } else {
+            usage();
+        }
+        arg++;
+    }
+    if ( batchMode ? numArgs - arg < 2 || range || container
+                   : numArgs - arg != FILE_ARGS || ( range && !decryptMode ) ) {
+        usage();
     }
+    // containers have their own chunks, and only ECB gives the same output for the same block
+    if ( memo && ( mode != MODE_ECB || container ) ) {
+        usage();
+    }
+    char *keyFileName = argValues[ arg ];
 
     // reading the key file
     int keyLength = 0;
@@ -72,51 +672,153 @@ int main( int numArgs, char *argValues[] )
         exit( EXIT_FAILURE );
     }
 
-    if ( keyLength != ( NUM_KEY_PARTS * BLOCK_BYTES ) ) {
+    TDESContext ctx;
+    if ( !tdesInit( &ctx, keyData, keyLength ) ) {
         fprintf( stderr, "Invalid key length\n" );
         free( keyData );
         exit( EXIT_FAILURE );
     }
+    free( keyData );
+
+    // every thread adds to the same counts for the memo
+    TDESMemoStats memoStats = { 0, 0 };
+    if ( memo ) {
+        ctx.memo = &memoStats;
+    }
+
+    // worker threads sharing the key schedule
+    Pool *pool = NULL;
+    if ( threads > 1 ) {
+        pool = poolCreate( threads );
+        if ( pool == NULL ) {
+            fprintf( stderr, "Can't start worker threads\n" );
+            exit( EXIT_FAILURE );
+        }
+    }
 
-    // reading the input file
-    int fileLength = 0;
-    byte *inputData = readFile( inputFileName, &fileLength );
-    if ( inputData == NULL ) {
+    // every file in a batch shares the key schedule and the pool
+    if ( batchMode ) {
+        Batch batch = { NULL, 0, 0, NULL, &ctx, decryptMode, mode, uring, direct };
+        for ( arg++; arg < numArgs; arg++ ) {
+            if ( strchr( argValues[ arg ], PAIR_SEPARATOR ) != NULL ) {
+                addPair( &batch, argValues[ arg ] );
+            } else {
+                readManifest( &batch, argValues[ arg ] );
+            }
+        }
+        for ( size_t i = 0; i < batch.count; i++ ) {
+            if ( !decryptMode && modeHasIV( mode ) && !randomBytes( batch.files[ i ].iv, BLOCK_BYTES ) ) {
+                fprintf( stderr, "Can't generate an IV\n" );
+                exit( EXIT_FAILURE );
+            }
+        }
+        bool success = runBatch( &batch, pool );
+        poolDestroy( pool );
+        free( batch.files );
+        if ( memo ) {
+            reportMemo( &memoStats );
+        }
+        if ( stats ) {
+            statsReport( stderr );
+        }
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    char *inputFileName = argValues[ arg + 1 ];
+    char *outputFileName = argValues[ arg + 2 ];
+
+    // opening the input file
+    FILE *input = openInput( inputFileName );
+    if ( input == NULL ) {
         perror( inputFileName );
-        free( keyData );
         exit( EXIT_FAILURE );
     }
     
-    // decryption
-    if ( decryptMode && ( fileLength == 0 || ( fileLength % BLOCK_BYTES ) != 0 ) ) {
-        fprintf( stderr, "Invalid encrypted data length\n" );
-        free( keyData );
-        free( inputData );
+    // decryption, checked up front when the input's size is known
+    bool seekable = fseek( input, 0, SEEK_END ) == 0;
+    long fileLength = seekable ? ftell( input ) : 0;
+    rewind( input );
+    if ( decryptMode && seekable && !container ) {
+        if ( !modeValidLength( mode, fileLength ) ) {
+            fprintf( stderr, "%s\n", tdesErrorMessage( TDES_ERR_LENGTH ) );
+            exit( EXIT_FAILURE );
+        }
+    }
+    if ( ( range || ( container && decryptMode ) ) && !seekable ) {
+        fprintf( stderr, "Input has to be a file that can be read at any position\n" );
+        exit( EXIT_FAILURE );
+    }
+    if ( ( range || container ) && sameFile( input, outputFileName ) ) {
+        fprintf( stderr, "Input and output have to be different files\n" );
         exit( EXIT_FAILURE );
     }
 
-    // process encryption/decryption
-    int outputLength = 0;
-    byte *resultData = NULL;
-    if ( decryptMode ) {
-        resultData = decryptTDES( inputData, fileLength, keyData, keyLength, &outputLength );
+    // a fresh IV for every file that's encrypted with one
+    byte iv[ BLOCK_BYTES ];
+    if ( !decryptMode && modeHasIV( mode ) && !randomBytes( iv, BLOCK_BYTES ) ) {
+        fprintf( stderr, "Can't generate an IV\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    // containers and ranges are written a piece at a time, and anything else is done whole
+    int status;
+    if ( container || range ) {
+        FILE *output = openOutput( outputFileName );
+        if ( output == NULL ) {
+            perror( outputFileName );
+            exit( EXIT_FAILURE );
+        }
+        // the header of a container is filled in at the end when the input's length isn't known
+        if ( container && !decryptMode && !seekable && fseek( output, 0, SEEK_CUR ) != 0 ) {
+            fprintf( stderr, "Output has to be a file that can be written at any position\n" );
+            exit( EXIT_FAILURE );
+        }
+        if ( container && decryptMode ) {
+            status = containerRead( input, output, &ctx, pool, rangeOffset,
+                                    range ? rangeLen : UINT64_MAX );
+        } else if ( container ) {
+            status = containerWrite( input, output, &ctx, pool, mode, modeHasIV( mode ) ? iv : NULL,
+                                     seekable ? ( uint64_t ) fileLength : CONTAINER_UNKNOWN_LEN,
+                                     compress );
+        } else {
+            status = cryptRange( input, output, &ctx, pool, mode, rangeOffset, rangeLen );
+        }
+        if ( fclose( output ) != 0 && status == TDES_OK ) {
+            status = WRITE_ERROR;
+        }
     } else {
-        resultData = encryptTDES( inputData, fileLength, keyData, keyLength, &outputLength );
+        TDESStream stream;
+        streamInit( &stream, &ctx, pool, decryptMode, mode, iv );
+        status = cryptWhole( input, outputFileName, &stream, uring, direct );
+        if ( status == OPEN_ERROR ) {
+            perror( outputFileName );
+            exit( EXIT_FAILURE );
+        }
     }
+    poolDestroy( pool );
+    fclose( input );
 
-    // writing result to output file
-    if ( !writeFile( outputFileName, resultData, outputLength ) ) {
-        free( keyData );
-        free( inputData );
-        free( resultData );
+    if ( status != TDES_OK ) {
+        if ( status == READ_ERROR ) {
+            perror( inputFileName );
+        } else if ( status == WRITE_ERROR ) {
+            perror( outputFileName );
+        } else {
+            fprintf( stderr, "%s\n", tdesErrorMessage( status ) );
+        }
+        // not leaving a partial output file behind
+        if ( strcmp( outputFileName, STDIO_NAME ) != 0 ) {
+            remove( outputFileName );
+        }
         exit( EXIT_FAILURE );
     }
-
-    // freeing memory
-    free( keyData );
-    free( inputData );
-    free( resultData );
+    
+    // the breakdown goes to standard error, so it can't mix with output on standard output
+    if ( memo ) {
+        reportMemo( &memoStats );
+    }
+    if ( stats ) {
+        statsReport( stderr );
+    }
     return EXIT_SUCCESS;
     
 }
-
@@ -0,0 +1,456 @@
+/**
+    @file tdesbench.c
+    @author Jayani Sivakumar
+    Benchmark for the Triple DES implementation.  It times the key
+    schedule, the reference block functions, encryptTDES()/decryptTDES()
+    and every block engine over a range of input sizes, and prints the
+    throughput, cycles per byte and latency of each one as CSV or JSON,
+    so runs from different builds or machines can be compared.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "TDES.h"
+#include "engine.h"
+#include "pool.h"
+#include "records.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+/** Defined when the time stamp counter can be read to count cycles. */
+#define HAVE_CYCLES
+#endif
+
+/** Largest number of threads that can be requested with -j. */
+#define MAX_THREADS 1024
+
+/** Base used to parse numbers on the command line. */
+#define DECIMAL 10
+
+/** Number of threads used by the parallel engine if -j isn't given. */
+#define DEFAULT_THREADS 4
+
+/** Largest input size measured if -s isn't given. */
+#define DEFAULT_MAX_BYTES ( 64 * 1024 * 1024 )
+
+/** Largest input size that can be requested with -s, 1 GB. */
+#define MAX_BYTES ( 1024 * 1024 * 1024 )
+
+/** Each input size is this many times the one before, starting at one
+    block, so 1 GB is the tenth size. */
+#define SIZE_STEP 8
+
+/** Every case runs at least this long, unless it reaches MAX_SAMPLES first. */
+#define MIN_NANOS 200000000LL
+
+/** Every case runs at least this many times, however long it takes. */
+#define MIN_SAMPLES 3
+
+/** Most times a case is run, which is also the number of latencies kept. */
+#define MAX_SAMPLES 100000
+
+/** Number of bytes in each record for the records engine. */
+#define RECORD_BYTES 256
+
+/** Number of different keys the records take turns using. */
+#define RECORD_KEYS 256
+
+/** Number of nanoseconds in a second. */
+#define NANOS_PER_SECOND 1000000000LL
+
+/** Number of bytes in a megabyte, for MB/s. */
+#define MEGABYTE ( 1024.0 * 1024.0 )
+
+/** Percentiles reported for latency. */
+#define P50 50
+#define P99 99
+
+/** Everything a benchmarked operation needs.  The buffers are big enough
+    for the largest size, with room for padding. */
+typedef struct {
+    /** Key schedule for the engines that use one. */
+    TDESContext ctx;
+    /** Whole Triple DES key. */
+    byte key[ TDES_KEY_BYTES ];
+    /** Subkeys for the first part of the key, for encryptBlock(). */
+    byte subkeys[ ROUND_COUNT ][ SUBKEY_BYTES ];
+    /** Threads for the parallel engine. */
+    Pool *pool;
+    /** Input data. */
+    byte *in;
+    /** Output buffer. */
+    byte *out;
+    /** Ciphertext of in for the decryption cases, made once per size. */
+    byte *cipher;
+    /** Number of bytes of ciphertext. */
+    int cipherLen;
+    /** Key for each record, for the records engine. */
+    byte *recordKeys;
+    /** Descriptor for each record. */
+    TDESRecord *records;
+    /** Number of bytes of input the operation handles. */
+    size_t len;
+    /** Batch function of the engine being timed. */
+    SliceKernel kernel;
+    /** Number of blocks handled by kernel. */
+    int kernelBlocks;
+} Bench;
+
+/** An operation to time, run once per sample. */
+typedef void (*BenchOp)( Bench *bench );
+
+/** Output format, CSV or JSON. */
+static bool json = false;
+
+/** True until the first JSON result has been printed. */
+static bool firstResult = true;
+
+/** Latency of each sample in the current case, in nanoseconds. */
+static long long samples[ MAX_SAMPLES ];
+
+/**
+    This function prints a usage message and exits unsuccessfully.
+ */
+static void usage( void )
+{
+    fprintf( stderr, "usage: tdesbench [-f csv|json] [-j THREADS] [-s MAX_BYTES]\n" );
+    exit( EXIT_FAILURE );
+}
+
+/**
+    This function returns the current time from a clock that only goes forward.
+    @return time in nanoseconds.
+ */
+static long long nowNanos( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec * NANOS_PER_SECOND + now.tv_nsec;
+}
+
+/**
+    This function returns the number of CPU cycles since some point in the past.
+    @return cycle count, or zero if it can't be read on this CPU.
+ */
+static unsigned long long nowCycles( void )
+{
+#ifdef HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+    This function compares two latencies, for qsort().
+    @param a pointer to the first latency.
+    @param b pointer to the second latency.
+    @return negative, zero or positive as a is less than, equal to or greater than b.
+ */
+static int compareSamples( void const *a, void const *b )
+{
+    long long x = *( long long const * ) a;
+    long long y = *( long long const * ) b;
+    return ( x > y ) - ( x < y );
+}
+
+/**
+    This function runs an operation until it has enough samples, then prints
+    one result line for it.
+    @param bench state passed to the operation.
+    @param op operation to time.
+    @param name name of the operation.
+    @param engine name of the engine or implementation used.
+    @param bytes number of bytes the operation handles each time it runs.
+ */
+static void measure( Bench *bench, BenchOp op, char const *name, char const *engine, size_t bytes )
+{
+    // one untimed run, so the buffers and tables are in memory
+    op( bench );
+
+    int count = 0;
+    long long total = 0;
+    unsigned long long cycles = 0;
+    while ( count < MAX_SAMPLES && ( count < MIN_SAMPLES || total < MIN_NANOS ) ) {
+        unsigned long long startCycles = nowCycles();
+        long long start = nowNanos();
+        op( bench );
+        long long elapsed = nowNanos() - start;
+        cycles += nowCycles() - startCycles;
+        samples[ count++ ] = elapsed;
+        total += elapsed;
+    }
+    qsort( samples, count, sizeof( samples[ 0 ] ), compareSamples );
+
+    double seconds = ( double ) total / NANOS_PER_SECOND;
+    double mbPerSecond = seconds > 0 ? bytes * ( double ) count / MEGABYTE / seconds : 0;
+    double cyclesPerByte = ( double ) cycles / ( ( double ) bytes * count );
+    long long p50 = samples[ ( count - 1 ) * P50 / 100 ];
+    long long p99 = samples[ ( count - 1 ) * P99 / 100 ];
+    int threads = poolThreads( bench->pool );
+
+    if ( json ) {
+        printf( "%s  {\"op\": \"%s\", \"engine\": \"%s\", \"bytes\": %zu, \"samples\": %d, "
+                "\"threads\": %d, \"mb_per_s\": %.2f, ",
+                firstResult ? "" : ",\n", name, engine, bytes, count, threads, mbPerSecond );
+#ifdef HAVE_CYCLES
+        printf( "\"cycles_per_byte\": %.2f, ", cyclesPerByte );
+#else
+        printf( "\"cycles_per_byte\": null, " );
+#endif
+        printf( "\"p50_ns\": %lld, \"p99_ns\": %lld}", p50, p99 );
+        firstResult = false;
+    } else {
+        printf( "%s,%s,%zu,%d,%d,%.2f,", name, engine, bytes, count, threads, mbPerSecond );
+#ifdef HAVE_CYCLES
+        printf( "%.2f", cyclesPerByte );
+#endif
+        printf( ",%lld,%lld\n", p50, p99 );
+    }
+    fflush( stdout );
+}
+
+/**
+    This function times generateSubkeys() for the first part of the key.
+    @param bench state for the benchmark.
+ */
+static void runGenerateSubkeys( Bench *bench )
+{
+    byte K[ ROUND_COUNT ][ SUBKEY_BYTES ];
+    generateSubkeys( K, bench->key );
+}
+
+/**
+    This function times scheduleKey() for the first part of the key.
+    @param bench state for the benchmark.
+ */
+static void runScheduleKey( Bench *bench )
+{
+    TDESSchedule sched;
+    scheduleKey( &sched, bench->key );
+}
+
+/**
+    This function times tdesInit() for the whole key.
+    @param bench state for the benchmark.
+ */
+static void runInit( Bench *bench )
+{
+    TDESContext ctx;
+    tdesInit( &ctx, bench->key, TDES_KEY_BYTES );
+}
+
+/**
+    This function times encryptBlock() on one block with the subkeys for
+    the first part of the key.
+    @param bench state for the benchmark.
+ */
+static void runEncryptBlock( Bench *bench )
+{
+    encryptBlock( bench->out, ( byte const ( * )[ SUBKEY_BYTES ] ) bench->subkeys );
+}
+
+/**
+    This function times encryptTDES(), including its key setup and allocation.
+    @param bench state for the benchmark.
+ */
+static void runEncryptTDES( Bench *bench )
+{
+    int n;
+    free( encryptTDES( bench->in, bench->len, bench->key, TDES_KEY_BYTES, &n ) );
+}
+
+/**
+    This function times decryptTDES() on the ciphertext for the current size.
+    @param bench state for the benchmark.
+ */
+static void runDecryptTDES( Bench *bench )
+{
+    int n;
+    free( decryptTDES( bench->cipher, bench->cipherLen, bench->key, TDES_KEY_BYTES, &n ) );
+}
+
+/**
+    This function times one engine on whole batches, with the
+    blocks left over done one at a time like tdesCryptBlocks().
+    @param bench state for the benchmark.
+ */
+static void runSlice( Bench *bench )
+{
+    size_t batchBytes = bench->kernelBlocks * BLOCK_BYTES;
+    size_t pos = 0;
+    for ( ; bench->len - pos >= batchBytes; pos += batchBytes ) {
+        bench->kernel( &bench->ctx, bench->out + pos, bench->in + pos, false );
+    }
+    for ( ; pos < bench->len; pos += BLOCK_BYTES ) {
+        storeBlock( bench->out + pos, tdesEncryptBlock64( &bench->ctx, loadBlock( bench->in + pos ) ) );
+    }
+}
+
+/**
+    This function times tdesCryptBlocks() with the engine picked at startup.
+    @param bench state for the benchmark.
+ */
+static void runAuto( Bench *bench )
+{
+    tdesCryptBlocks( &bench->ctx, bench->out, bench->in, bench->len / BLOCK_BYTES, false );
+}
+
+/**
+    This function times tdesCryptBlocksParallel() with the pool.
+    @param bench state for the benchmark.
+ */
+static void runParallel( Bench *bench )
+{
+    tdesCryptBlocksParallel( &bench->ctx, bench->pool, bench->out, bench->in,
+                             bench->len / BLOCK_BYTES, false );
+}
+
+/**
+    This function times tdesEncryptRecords() with the input split into
+    RECORD_BYTES records, each with its own key.
+    @param bench state for the benchmark.
+ */
+static void runRecords( Bench *bench )
+{
+    size_t count = ( bench->len + RECORD_BYTES - 1 ) / RECORD_BYTES;
+    for ( size_t r = 0; r < count; r++ ) {
+        size_t start = r * RECORD_BYTES;
+        size_t len = bench->len - start < RECORD_BYTES ? bench->len - start : RECORD_BYTES;
+        // each record is padded, so the output has an extra block for every record
+        bench->records[ r ] = ( TDESRecord ){ bench->recordKeys + r % RECORD_KEYS * TDES_KEY_BYTES,
+                                              bench->in + start, len,
+                                              bench->out + start + r * BLOCK_BYTES,
+                                              len + BLOCK_BYTES, 0, TDES_OK };
+    }
+    tdesEncryptRecords( bench->pool, bench->records, count );
+}
+
+/**
+    This function allocates a buffer for the benchmark, exiting if there isn't enough memory.
+    @param size number of bytes needed.
+    @return pointer to the buffer.
+ */
+static void *allocate( size_t size )
+{
+    void *buffer = malloc( size );
+    if ( buffer == NULL ) {
+        fprintf( stderr, "Can't allocate %zu bytes\n", size );
+        exit( EXIT_FAILURE );
+    }
+    return buffer;
+}
+
+/**
+    Program starting point.  It parses the options, then measures every
+    operation and engine at every size up to the largest one.
+    @param numArgs number of command-line arguments
+    @param argValues array of command-line argument strings
+    @return int returns EXIT_SUCCESS if processed successfully, else EXIT_FAILURE.
+*/
+int main( int numArgs, char *argValues[] )
+{
+    int threads = DEFAULT_THREADS;
+    size_t maxBytes = DEFAULT_MAX_BYTES;
+    for ( int arg = 1; arg < numArgs; arg++ ) {
+        if ( strcmp( argValues[ arg ], "-f" ) == 0 && arg + 1 < numArgs ) {
+            char const *format = argValues[ ++arg ];
+            if ( strcmp( format, "json" ) == 0 ) {
+                json = true;
+            } else if ( strcmp( format, "csv" ) != 0 ) {
+                usage();
+            }
+        } else if ( strcmp( argValues[ arg ], "-j" ) == 0 && arg + 1 < numArgs ) {
+            char *end;
+            long count = strtol( argValues[ ++arg ], &end, DECIMAL );
+            if ( *end != '\0' || count < 1 || count > MAX_THREADS ) {
+                usage();
+            }
+            threads = count;
+        } else if ( strcmp( argValues[ arg ], "-s" ) == 0 && arg + 1 < numArgs ) {
+            char *end;
+            long long size = strtoll( argValues[ ++arg ], &end, DECIMAL );
+            if ( *end != '\0' || size < BLOCK_BYTES || size > MAX_BYTES ) {
+                usage();
+            }
+            maxBytes = size;
+        } else {
+            usage();
+        }
+    }
+
+    Bench bench;
+    uint64_t state = 0x5DEECE66DULL;
+    for ( int i = 0; i < TDES_KEY_BYTES; i++ ) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        bench.key[ i ] = state >> 56;
+    }
+    tdesInit( &bench.ctx, bench.key, TDES_KEY_BYTES );
+    generateSubkeys( bench.subkeys, bench.key );
+    bench.pool = threads > 1 ? poolCreate( threads ) : NULL;
+
+    // room for a block of padding on every record
+    size_t recordCount = ( maxBytes + RECORD_BYTES - 1 ) / RECORD_BYTES;
+    size_t capacity = maxBytes + ( recordCount + 1 ) * BLOCK_BYTES;
+    bench.in = allocate( capacity );
+    bench.out = allocate( capacity );
+    bench.records = allocate( recordCount * sizeof( TDESRecord ) );
+    bench.recordKeys = allocate( RECORD_KEYS * TDES_KEY_BYTES );
+    for ( size_t i = 0; i < capacity; i++ ) {
+        bench.in[ i ] = i * 131 + ( i >> 8 );
+    }
+    for ( int i = 0; i < RECORD_KEYS * TDES_KEY_BYTES; i++ ) {
+        bench.recordKeys[ i ] = i * 151 + ( i >> 8 );
+    }
+
+    if ( json ) {
+        printf( "[\n" );
+    } else {
+        printf( "op,engine,bytes,samples,threads,mb_per_s,cycles_per_byte,p50_ns,p99_ns\n" );
+    }
+
+    // the key schedule and reference block function only have one size
+    measure( &bench, runGenerateSubkeys, "generateSubkeys", "reference", BLOCK_BYTES );
+    measure( &bench, runScheduleKey, "scheduleKey", "packed", BLOCK_BYTES );
+    measure( &bench, runInit, "tdesInit", "packed", TDES_KEY_BYTES );
+    measure( &bench, runEncryptBlock, "encryptBlock", "reference", BLOCK_BYTES );
+
+    for ( size_t len = BLOCK_BYTES; len <= maxBytes; len *= SIZE_STEP ) {
+        bench.len = len;
+        measure( &bench, runEncryptTDES, "encryptTDES", "default", len );
+        bench.cipher = encryptTDES( bench.in, len, bench.key, TDES_KEY_BYTES, &bench.cipherLen );
+        measure( &bench, runDecryptTDES, "decryptTDES", "default", bench.cipherLen );
+        free( bench.cipher );
+
+        // every engine in the registry this CPU can run
+        for ( int e = 0; e < engineCount(); e++ ) {
+            Engine const *engine = engineAt( e );
+            if ( engineSupported( engine ) ) {
+                bench.kernel = engine->crypt;
+                bench.kernelBlocks = engine->blocks;
+                measure( &bench, runSlice, "blocks", engine->name, len );
+            }
+        }
+        measure( &bench, runAuto, "blocks", "auto", len );
+        if ( bench.pool != NULL ) {
+            measure( &bench, runParallel, "blocks", "parallel", len );
+        }
+        measure( &bench, runRecords, "records", "multikey", len );
+    }
+
+    if ( json ) {
+        printf( "\n]\n" );
+    }
+
+    poolDestroy( bench.pool );
+    free( bench.in );
+    free( bench.out );
+    free( bench.records );
+    free( bench.recordKeys );
+    return EXIT_SUCCESS;
+}
@@ -144,6 +144,90 @@ runTest() {
     return 0
 }
 
+# Run a test case that reads standard input and writes standard output.
+runPipeTest() {
+    TESTNO="$1"
+    INFILE="$2"
+    EOUTPUT="$3"
+    ESTATUS="$4"
+
+    rm -f output.bin
+    
+    echo "Test $TESTNO"
+    echo "   ./tcrypt ${args[@]} < $INFILE > output.bin 2> stderr.txt"
+    ./tcrypt ${args[@]} < "$INFILE" > output.bin 2> stderr.txt
+    ASTATUS=$?
+
+    if ! checkStatus "$ESTATUS" "$ASTATUS" ||
+	    ! checkFile "Output" "$EOUTPUT" "output.bin" ||
+	    ! checkFileOrEmpty "Stderr output" "error-$TESTNO.txt" "stderr.txt"
+    then
+	FAIL=1
+	return 1
+    fi
+
+    echo "Test $TESTNO PASS"
+    return 0
+}
+
+# Run a test case that reads standard input and writes standard output
+# through pipes, so neither one can seek.
+runFullPipeTest() {
+    TESTNO="$1"
+    INFILE="$2"
+    EOUTPUT="$3"
+    ESTATUS="$4"
+
+    rm -f output.bin
+    
+    echo "Test $TESTNO"
+    echo "   cat $INFILE | ./tcrypt ${args[@]} 2> stderr.txt | cat > output.bin"
+    cat "$INFILE" | ./tcrypt ${args[@]} 2> stderr.txt | cat > output.bin
+    ASTATUS=${PIPESTATUS[1]}
+
+    if ! checkStatus "$ESTATUS" "$ASTATUS" ||
+	    ! checkFileOrEmpty "Output" "$EOUTPUT" "output.bin" ||
+	    ! checkFileOrEmpty "Stderr output" "error-$TESTNO.txt" "stderr.txt"
+    then
+	FAIL=1
+	return 1
+    fi
+
+    echo "Test $TESTNO PASS"
+    return 0
+}
+
+# Run a test case in batch mode.  The summary on standard error has
+# timings in it, so only the start of its last line is checked.
+runBatchTest() {
+    TESTNO="$1"
+    EOUTPUT="$2"
+    ESTATUS="$3"
+    ESUMMARY="$4"
+
+    rm -f output.bin
+    
+    echo "Test $TESTNO"
+    echo "   ./tcrypt ${args[@]} > stdout.txt 2> stderr.txt"
+    ./tcrypt ${args[@]} > stdout.txt 2> stderr.txt
+    ASTATUS=$?
+
+    if ! checkStatus "$ESTATUS" "$ASTATUS" ||
+	    ! checkFileOrDNE "Output file" "$EOUTPUT" "output.bin" ||
+	    ! checkEmpty "Terminal output" "stdout.txt"
+    then
+	FAIL=1
+	return 1
+    fi
+    if ! tail -n 1 stderr.txt | grep -q "^$ESUMMARY"; then
+	fail "FAILED - summary doesn't start with \"$ESUMMARY\""
+	return 1
+    fi
+
+    echo "Test $TESTNO PASS"
+    return 0
+}
+
 # Try the unit tests
 make clean
 make TDEStest
@@ -224,6 +308,89 @@ if [ -x tcrypt ]; then
     
     args=(-d key-k.bin cipher-k.bin output.bin)
     runTest 18 no-expected-output-file 1
+
+    # Multithreaded tests
+    args=(-j 4 key-d.txt plain-d.txt output.bin)
+    runTest 19 cipher-d.bin 0
+
+    args=(-d -j 4 key-f.bin cipher-f.bin output.bin)
+    runTest 20 plain-f.bin 0
+
+    # Streaming tests
+    args=(key-d.txt - -)
+    runPipeTest 21 plain-d.txt cipher-d.bin 0
+
+    args=(-d key-f.bin - -)
+    runPipeTest 22 cipher-f.bin plain-f.bin 0
+
+    args=(-d key-k.bin - -)
+    runPipeTest 23 cipher-k.bin no-expected-output-file 1
+
+    # Chaining mode tests
+    args=(-d -m cbc key-d.txt cipher-l.bin output.bin)
+    runTest 24 plain-d.txt 0
+
+    args=(-d -m ctr -j 4 key-f.bin - -)
+    runPipeTest 25 cipher-m.bin plain-f.bin 0
+
+    args=(-m ofb key-a.txt plain-a.txt output.bin)
+    runTest 26 no-expected-output-file 1
+
+    # Range tests
+    args=(-d --range 10:50 key-d.txt cipher-d.bin output.bin)
+    runTest 27 range-a.txt 0
+
+    args=(-d -m cbc --range 280:100 key-d.txt cipher-l.bin output.bin)
+    runTest 28 range-b.txt 0
+
+    args=(--range 10:50 key-d.txt plain-d.txt output.bin)
+    runTest 29 no-expected-output-file 1
+
+    # Container tests
+    args=(--container key-d.txt plain-d.txt output.bin)
+    runTest 30 container-a.bin 0
+
+    args=(-d --container key-d.txt container-a.bin output.bin)
+    runTest 31 plain-d.txt 0
+
+    args=(-d --container -j 4 --range 100:60 key-f.bin container-b.bin output.bin)
+    runTest 32 range-c.txt 0
+
+    # Asking for statistics doesn't change the output
+    args=(--stats key-a.txt plain-a.txt output.bin)
+    runTest 33 cipher-a.bin 0
+
+    # io_uring, where it's available, doesn't change the output either
+    args=(--uring key-a.txt plain-a.txt output.bin)
+    runTest 34 cipher-a.bin 0
+
+    args=(-d --direct -m cbc key-d.txt cipher-l.bin output.bin)
+    runTest 35 plain-d.txt 0
+
+    # Batch mode, with a file that can't be read and with a manifest
+    args=(--batch key-a.txt plain-a.txt:output.bin no-such-file.txt:output2.bin)
+    runBatchTest 36 cipher-a.bin 1 "2 files, 1 failed, 7 bytes"
+
+    args=(--batch -d key-a.txt manifest-a.txt)
+    runBatchTest 37 plain-a.txt 0 "1 files, 0 failed, 8 bytes"
+
+    # Compressed containers, which decrypt like any other container
+    args=(--compress key-d.txt plain-d.txt output.bin)
+    runTest 38 container-c.bin 0
+
+    args=(-d --container key-d.txt container-c.bin output.bin)
+    runTest 39 plain-d.txt 0
+
+    # The memo of repeated ECB blocks doesn't change the output, and reports its hits
+    args=(--memo key-a.txt plain-n.bin output.bin)
+    runTest 40 cipher-n.bin 0
+
+    args=(-d --memo -j 2 key-a.txt cipher-n.bin output.bin)
+    runTest 41 plain-n.bin 0
+
+    # A container of unknown length can't be written down a pipe, and nothing is
+    args=(--container key-d.txt - -)
+    runFullPipeTest 42 plain-d.txt no-expected-output-file 1
 else
     fail "Since your program didn't compile, we couldn't test it"
 fi
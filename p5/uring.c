@@ -0,0 +1,431 @@
+/** 
+    @file uring.c
+    @author Jayani Sivakumar
+    Implementation of the io_uring backend, using the system calls directly
+    so there's nothing extra to link.  The submission and completion queues
+    are shared with the kernel, and this thread is the only one that uses
+    them.  Output is gathered into buffers and written a whole number of
+    aligned pieces at a time, with what's left over carried into the next
+    buffer, so the same requests work with O_DIRECT.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+#include "pipeline.h"
+#include "stats.h"
+
+/** Alignment of buffers, file positions and lengths for O_DIRECT. */
+#define DIRECT_ALIGN 4096
+
+/** Number of bytes in each write buffer, room for a carried piece and the
+    output from a whole read buffer. */
+#define WRITE_BYTES ( ( DIRECT_ALIGN + PIPELINE_BYTES + STREAM_SLACK + DIRECT_ALIGN - 1 ) \
+                      / DIRECT_ALIGN * DIRECT_ALIGN )
+
+/** Number of entries in the submission queue, enough for every buffer to
+    have a request in flight. */
+#define QUEUE_ENTRIES ( 2 * URING_BUFFERS )
+
+/** The queues shared with the kernel. */
+typedef struct {
+    /** Descriptor for the io_uring instance. */
+    int fd;
+    /** Mapping that holds both queues' indices and the completions. */
+    void *rings;
+    /** Number of bytes in the rings mapping. */
+    size_t ringsLen;
+    /** Submission queue entries. */
+    struct io_uring_sqe *sqes;
+    /** Number of bytes in the sqes mapping. */
+    size_t sqesLen;
+    /** Next submission queue entry, only changed by this thread. */
+    unsigned *sqTail;
+    /** Mask to turn a submission queue index into an entry number. */
+    unsigned *sqMask;
+    /** Entry number for each place in the submission queue. */
+    unsigned *sqArray;
+    /** Next completion to look at, only changed by this thread. */
+    unsigned *cqHead;
+    /** End of the completions, changed by the kernel. */
+    unsigned *cqTail;
+    /** Mask to turn a completion queue index into an entry number. */
+    unsigned *cqMask;
+    /** Completion queue entries. */
+    struct io_uring_cqe *cqes;
+    /** Error number once submitting has failed, after which nothing else is
+        submitted, or 0. */
+    int error;
+} Uring;
+
+/** One buffer and the read or write that goes with it. */
+typedef struct {
+    /** Descriptor of the file to read or write. */
+    int fd;
+    /** True for a write, false for a read. */
+    bool write;
+    /** True to round reads up to whole DIRECT_ALIGN pieces, as O_DIRECT needs. */
+    bool aligned;
+    /** Contents of the buffer. */
+    byte *data;
+    /** Position in the file of the first byte in the buffer. */
+    uint64_t offset;
+    /** Number of bytes to transfer. */
+    size_t len;
+    /** Number of bytes transferred so far. */
+    size_t done;
+    /** True while the request is in flight. */
+    bool busy;
+    /** Error number from a failed request, or 0. */
+    int error;
+} IoRequest;
+
+/**
+    Helper method that creates the queues, checking the kernel has what's needed.
+    @param ring the queues to set up.
+    @return true if successful, false if io_uring can't be used.
+ */
+static bool uringSetup( Uring *ring );
+
+/**
+    Helper method that frees the queues.
+    @param ring the queues to free, with nothing in flight.
+ */
+static void uringClose( Uring *ring );
+
+/**
+    Helper method that submits the rest of a request to the kernel.  If the kernel
+    won't take it, the entry is taken back off the queue, the request gets the error
+    and so does every request after it.
+    @param ring the queues.
+    @param req the request, which isn't in flight.
+ */
+static void submit( Uring *ring, IoRequest *req );
+
+/**
+    Helper method that handles every completion that's ready, waiting for at least
+    one.  Requests that transferred less than they asked for are submitted again.
+    @param ring the queues.
+    @return true if successful, false if the kernel couldn't be waited on.
+ */
+static bool reap( Uring *ring );
+
+/**
+    Helper method that waits until a request isn't in flight.
+    @param ring the queues.
+    @param req the request to wait for.
+ */
+static void waitRequest( Uring *ring, IoRequest *req );
+
+static bool uringSetup( Uring *ring )
+{
+    struct io_uring_params params;
+    memset( &params, 0, sizeof( params ) );
+    ring->fd = syscall( __NR_io_uring_setup, QUEUE_ENTRIES, &params );
+    if ( ring->fd < 0 ) {
+        return false;
+    }
+
+    // one mapping for both queues, and plain read and write requests, came in Linux 5.6
+    if ( !( params.features & IORING_FEAT_SINGLE_MMAP ) ||
+         !( params.features & IORING_FEAT_RW_CUR_POS ) ) {
+        close( ring->fd );
+        return false;
+    }
+    size_t sqLen = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+    size_t cqLen = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+    ring->ringsLen = sqLen > cqLen ? sqLen : cqLen;
+    ring->rings = mmap( NULL, ring->ringsLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING );
+    if ( ring->rings == MAP_FAILED ) {
+        close( ring->fd );
+        return false;
+    }
+    ring->sqesLen = params.sq_entries * sizeof( struct io_uring_sqe );
+    ring->sqes = mmap( NULL, ring->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring->fd, IORING_OFF_SQES );
+    if ( ring->sqes == MAP_FAILED ) {
+        munmap( ring->rings, ring->ringsLen );
+        close( ring->fd );
+        return false;
+    }
+
+    byte *base = ring->rings;
+    ring->sqTail = ( unsigned * ) ( base + params.sq_off.tail );
+    ring->sqMask = ( unsigned * ) ( base + params.sq_off.ring_mask );
+    ring->sqArray = ( unsigned * ) ( base + params.sq_off.array );
+    ring->cqHead = ( unsigned * ) ( base + params.cq_off.head );
+    ring->cqTail = ( unsigned * ) ( base + params.cq_off.tail );
+    ring->cqMask = ( unsigned * ) ( base + params.cq_off.ring_mask );
+    ring->cqes = ( struct io_uring_cqe * ) ( base + params.cq_off.cqes );
+    ring->error = 0;
+    return true;
+}
+
+static void uringClose( Uring *ring )
+{
+    munmap( ring->sqes, ring->sqesLen );
+    munmap( ring->rings, ring->ringsLen );
+    close( ring->fd );
+}
+
+static void submit( Uring *ring, IoRequest *req )
+{
+    uint64_t pos = req->offset + req->done;
+    size_t ask = req->len - req->done;
+
+    // a direct read has to be for whole pieces, even past the end of the file
+    if ( req->aligned && pos % DIRECT_ALIGN == 0 && ask % DIRECT_ALIGN != 0 ) {
+        ask += DIRECT_ALIGN - ask % DIRECT_ALIGN;
+    }
+    if ( ring->error != 0 ) {
+        req->error = ring->error;
+        return;
+    }
+
+    unsigned tail = *ring->sqTail;
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[ index ];
+    memset( sqe, 0, sizeof( *sqe ) );
+    sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = req->fd;
+    sqe->off = pos;
+    sqe->addr = ( uintptr_t ) ( req->data + req->done );
+    sqe->len = ask;
+    sqe->user_data = ( uintptr_t ) req;
+    ring->sqArray[ index ] = index;
+    __atomic_store_n( ring->sqTail, tail + 1, __ATOMIC_RELEASE );
+    req->busy = true;
+
+    while ( syscall( __NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0 ) < 0 ) {
+        if ( errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+            // nothing was taken from the queue, so the entry can't go out with a later call
+            __atomic_store_n( ring->sqTail, tail, __ATOMIC_RELEASE );
+            ring->error = errno;
+            req->busy = false;
+            req->error = errno;
+            return;
+        }
+    }
+}
+
+static bool reap( Uring *ring )
+{
+    unsigned head = *ring->cqHead;
+    unsigned tail;
+    while ( head == ( tail = __atomic_load_n( ring->cqTail, __ATOMIC_ACQUIRE ) ) ) {
+        if ( syscall( __NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 ) < 0 &&
+             errno != EINTR ) {
+            return false;
+        }
+    }
+
+    while ( head != tail ) {
+        struct io_uring_cqe *cqe = &ring->cqes[ head & *ring->cqMask ];
+        IoRequest *req = ( IoRequest * ) ( uintptr_t ) cqe->user_data;
+        int res = cqe->res;
+        head++;
+        __atomic_store_n( ring->cqHead, head, __ATOMIC_RELEASE );
+
+        req->busy = false;
+        if ( res == -EINTR || res == -EAGAIN ) {
+            submit( ring, req );
+        } else if ( res < 0 ) {
+            req->error = -res;
+        } else if ( res == 0 && req->write ) {
+            req->error = EIO;
+        } else if ( res == 0 ) {
+            // the file ended sooner than expected
+            req->len = req->done;
+        } else {
+            req->done += res;
+            if ( req->done > req->len ) {
+                req->done = req->len;
+            }
+            if ( req->done < req->len ) {
+                submit( ring, req );
+            }
+        }
+    }
+    return true;
+}
+
+static void waitRequest( Uring *ring, IoRequest *req )
+{
+    while ( req->busy ) {
+        if ( !reap( ring ) ) {
+            req->busy = false;
+            req->error = errno;
+        }
+    }
+}
+
+int uringRun( FILE *in, FILE *out, TDESStream *stream, bool direct )
+{
+    int inFd = fileno( in );
+    int outFd = fileno( out );
+    struct stat inStat, outStat;
+    if ( fstat( inFd, &inStat ) != 0 || !S_ISREG( inStat.st_mode ) ||
+         fstat( outFd, &outStat ) != 0 || !S_ISREG( outStat.st_mode ) ) {
+        return URING_UNAVAILABLE;
+    }
+    Uring ring;
+    if ( !uringSetup( &ring ) ) {
+        return URING_UNAVAILABLE;
+    }
+
+    byte *memory;
+    if ( posix_memalign( ( void ** ) &memory, DIRECT_ALIGN,
+                         URING_BUFFERS * ( PIPELINE_BYTES + WRITE_BYTES ) ) != 0 ) {
+        exit( EXIT_FAILURE );
+    }
+    IoRequest reads[ URING_BUFFERS ];
+    IoRequest writes[ URING_BUFFERS ];
+
+    // file systems that can't do direct I/O just go through the page cache
+    int inFlags = fcntl( inFd, F_GETFL );
+    int outFlags = fcntl( outFd, F_GETFL );
+    bool inDirect = false;
+    bool outDirect = false;
+    if ( direct ) {
+        inDirect = fcntl( inFd, F_SETFL, inFlags | O_DIRECT ) == 0;
+        outDirect = fcntl( outFd, F_SETFL, outFlags | O_DIRECT ) == 0;
+    }
+    for ( int i = 0; i < URING_BUFFERS; i++ ) {
+        reads[ i ] = ( IoRequest ) { inFd, false, inDirect, memory + i * PIPELINE_BYTES };
+        writes[ i ] = ( IoRequest ) { outFd, true, false,
+                                      memory + URING_BUFFERS * PIPELINE_BYTES + i * WRITE_BYTES };
+    }
+
+    // every read buffer starts out with a request in flight
+    uint64_t size = inStat.st_size;
+    uint64_t next = 0;
+    for ( int i = 0; i < URING_BUFFERS && next < size; i++ ) {
+        reads[ i ].offset = next;
+        reads[ i ].len = size - next < PIPELINE_BYTES ? size - next : PIPELINE_BYTES;
+        submit( &ring, &reads[ i ] );
+        next += PIPELINE_BYTES;
+    }
+
+    int status = TDES_OK;
+    int error = 0;
+    uint64_t pos = 0;
+    uint64_t outPos = 0;
+    size_t fill = 0;
+    int r = 0;
+    int w = 0;
+    while ( pos < size && ring.error == 0 ) {
+        IoRequest *rd = &reads[ r ];
+        STATS_BEGIN( STAGE_READ );
+        waitRequest( &ring, rd );
+        STATS_END( STAGE_READ, rd->done );
+        if ( rd->error != 0 ) {
+            status = READ_ERROR;
+            error = rd->error;
+            break;
+        }
+        if ( rd->done == 0 ) {
+            break;
+        }
+
+        IoRequest *wr = &writes[ w ];
+        fill += streamUpdate( stream, wr->data + fill, rd->data, rd->done );
+        pos += rd->done;
+        if ( rd->done < PIPELINE_BYTES ) {
+            size = pos;
+        }
+
+        // the buffer goes straight back for the next piece
+        if ( next < size ) {
+            rd->offset = next;
+            rd->len = size - next < PIPELINE_BYTES ? size - next : PIPELINE_BYTES;
+            rd->done = 0;
+            submit( &ring, rd );
+            next += PIPELINE_BYTES;
+        }
+        r = ( r + 1 ) % URING_BUFFERS;
+
+        // writing the whole pieces, and carrying the rest into the next buffer
+        size_t whole = fill / DIRECT_ALIGN * DIRECT_ALIGN;
+        if ( whole > 0 ) {
+            STATS_BEGIN( STAGE_WRITE );
+            IoRequest *nextWr = &writes[ ( w + 1 ) % URING_BUFFERS ];
+            waitRequest( &ring, nextWr );
+            if ( nextWr->error != 0 ) {
+                status = WRITE_ERROR;
+                error = nextWr->error;
+                break;
+            }
+            memcpy( nextWr->data, wr->data + whole, fill - whole );
+            wr->offset = outPos;
+            wr->len = whole;
+            wr->done = 0;
+            submit( &ring, wr );
+            outPos += whole;
+            fill -= whole;
+            w = ( w + 1 ) % URING_BUFFERS;
+            STATS_END( STAGE_WRITE, whole );
+        }
+    }
+
+    // nothing can still be using the buffers once this returns
+    for ( int i = 0; i < URING_BUFFERS; i++ ) {
+        waitRequest( &ring, &reads[ i ] );
+        if ( reads[ i ].error != 0 && status == TDES_OK ) {
+            status = READ_ERROR;
+            error = reads[ i ].error;
+        }
+    }
+    for ( int i = 0; i < URING_BUFFERS; i++ ) {
+        waitRequest( &ring, &writes[ i ] );
+        if ( writes[ i ].error != 0 && status == TDES_OK ) {
+            status = WRITE_ERROR;
+            error = writes[ i ].error;
+        }
+    }
+
+    // the last block has the padding, and the end of the file doesn't have to be aligned
+    if ( status == TDES_OK ) {
+        IoRequest *wr = &writes[ w ];
+        size_t len;
+        status = streamFinal( stream, wr->data + fill, &len );
+        fill += len;
+        if ( status == TDES_OK && fill > 0 ) {
+            STATS_BEGIN( STAGE_WRITE );
+            if ( outDirect && fill % DIRECT_ALIGN != 0 ) {
+                fcntl( outFd, F_SETFL, outFlags );
+            }
+            wr->offset = outPos;
+            wr->len = fill;
+            wr->done = 0;
+            submit( &ring, wr );
+            waitRequest( &ring, wr );
+            if ( wr->error != 0 ) {
+                status = WRITE_ERROR;
+                error = wr->error;
+            }
+            STATS_END( STAGE_WRITE, fill );
+        }
+    }
+
+    if ( inDirect ) {
+        fcntl( inFd, F_SETFL, inFlags );
+    }
+    if ( outDirect ) {
+        fcntl( outFd, F_SETFL, outFlags );
+    }
+    uringClose( &ring );
+    free( memory );
+    errno = error;
+    return status;
+}
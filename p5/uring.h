@@ -0,0 +1,40 @@
+/** 
+    @file uring.h
+    @author Jayani Sivakumar
+    Encryption or decryption of a whole file with Linux io_uring.  Several
+    reads and writes are kept in flight at once, at their own positions in
+    the files, and the stream works on each buffer as soon as its read
+    completes.  It only works for regular files on a kernel that supports
+    it, and the caller falls back to pipelineRun() otherwise.
+*/
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "stream.h"
+
+/** Result code from uringRun() when io_uring can't be used, so the file
+    should be streamed with stdio instead.  Nothing has been read or
+    written when it's returned. */
+#define URING_UNAVAILABLE -4
+
+/** Number of buffers for reading, and for writing, each of which can have
+    a request in flight. */
+#define URING_BUFFERS 4
+
+/**
+    This function encrypts or decrypts everything in the input file and writes the
+    result to the output file, starting at the beginning of each.
+    @param in file to read, which has to be a regular file.
+    @param out file to write, which has to be an empty regular file.
+    @param stream stream set up for encryption or decryption.
+    @param direct true to bypass the page cache with O_DIRECT, where the file
+    system supports it.
+    @return TDES_OK if successful, an error code from streamFinal(), READ_ERROR,
+    WRITE_ERROR or URING_UNAVAILABLE.
+ */
+int uringRun( FILE *in, FILE *out, TDESStream *stream, bool direct );
+
+#endif